@@ -0,0 +1,268 @@
+#include "components.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Marks an open tile that hasn't been given a label yet while building.
+#define UNLABELED -1
+
+// Gives a label to every open tile that can be reached from a tile.
+// The stack holds tile indices. Each tile is labeled when it's pushed, so it's only pushed once.
+static void flood(ComponentMap *map, int *stack, int start, int label) {
+    int width = map->width;
+    int height = map->height;
+    int count = 0;
+    
+    map->labels[start] = label;
+    stack[count++] = start;
+    
+    while (count > 0) {
+        int index = stack[--count];
+        int x = index % width;
+        int y = index / width;
+        int dx, dy;
+        
+        for (dy = -1; dy <= 1; ++dy) {
+            for (dx = -1; dx <= 1; ++dx) {
+                int nx = x + dx;
+                int ny = y + dy;
+                int next = ny * width + nx;
+                
+                if ((unsigned)nx >= (unsigned)width || (unsigned)ny >= (unsigned)height) continue;
+                if (map->labels[next] != UNLABELED) continue;
+                
+                map->labels[next] = label;
+                stack[count++] = next;
+            }
+        }
+    }
+}
+
+void components_build(ComponentMap *map, const Grid *grid) {
+    int size = grid->width * grid->height;
+    int *stack;
+    int x, y;
+    
+    if (!map->labels || map->mapped || map->width != grid->width || map->height != grid->height) {
+        if (!map->mapped) free(map->labels);
+        map->labels = malloc(sizeof(int) * size);
+        map->mapped = FALSE;
+    }
+    
+    map->width = grid->width;
+    map->height = grid->height;
+    map->epoch = grid->epoch;
+    map->count = 0;
+    
+    // Read the grid once so the flood only has to look at the labels.
+    for (y = 0; y < map->height; ++y) {
+        for (x = 0; x < map->width; ++x)
+            map->labels[y * map->width + x] = grid_is_open(grid, x, y) ? UNLABELED : COMPONENT_NONE;
+    }
+    
+    stack = malloc(sizeof(int) * size);
+    
+    for (x = 0; x < size; ++x) {
+        if (map->labels[x] == UNLABELED)
+            flood(map, stack, x, ++map->count);
+    }
+    
+    free(stack);
+    
+    // Every label starts out as its own region.
+    map->capacity = map->count + 1;
+    map->parents = realloc(map->parents, sizeof(int) * map->capacity);
+    
+    for (x = 0; x < map->capacity; ++x)
+        map->parents[x] = x;
+}
+
+// Returns the region of a label. Shortens the path to it for the next time.
+static int find_region(ComponentMap *map, int label) {
+    int region = label;
+    
+    while (map->parents[region] != region)
+        region = map->parents[region];
+    
+    while (map->parents[label] != region) {
+        int next = map->parents[label];
+        map->parents[label] = region;
+        label = next;
+    }
+    
+    return region;
+}
+
+// Gives out a new label that's a region of its own.
+static int new_label(ComponentMap *map) {
+    int label = ++map->count;
+    
+    if (label >= map->capacity) {
+        map->capacity *= 2;
+        map->parents = realloc(map->parents, sizeof(int) * map->capacity);
+    }
+    
+    map->parents[label] = label;
+    return label;
+}
+
+void components_update(ComponentMap *map, const Grid *grid, int left, int top, int right, int bottom) {
+    int x, y, dx, dy;
+    
+    // Changing a tile can change the open state of its neighbors.
+    if (--left < 0) left = 0;
+    if (--top < 0) top = 0;
+    if (++right >= map->width) right = map->width - 1;
+    if (++bottom >= map->height) bottom = map->height - 1;
+    
+    for (y = top; y <= bottom; ++y) {
+        for (x = left; x <= right; ++x) {
+            int *label = &map->labels[y * map->width + x];
+            int region = COMPONENT_NONE;
+            
+            if (!grid_is_open(grid, x, y)) {
+                // The region might be split now, but it keeps its label.
+                *label = COMPONENT_NONE;
+                continue;
+            }
+            
+            if (*label != COMPONENT_NONE) continue;
+            
+            // A tile that opened up joins every region around it into one.
+            for (dy = -1; dy <= 1; ++dy) {
+                for (dx = -1; dx <= 1; ++dx) {
+                    int neighbor = components_get(map, x + dx, y + dy);
+                    
+                    if (neighbor == COMPONENT_NONE || (dx == 0 && dy == 0)) continue;
+                    
+                    neighbor = find_region(map, neighbor);
+                    
+                    if (region == COMPONENT_NONE)
+                        region = neighbor;
+                    else if (neighbor != region)
+                        map->parents[neighbor] = region;
+                }
+            }
+            
+            *label = region != COMPONENT_NONE ? region : new_label(map);
+        }
+    }
+    
+    map->epoch = grid->epoch;
+}
+
+void components_copy(ComponentMap *dest, const ComponentMap *src) {
+    int size = src->width * src->height;
+    
+    dest->labels = malloc(sizeof(int) * size);
+    memcpy(dest->labels, src->labels, sizeof(int) * size);
+    dest->parents = malloc(sizeof(int) * src->capacity);
+    memcpy(dest->parents, src->parents, sizeof(int) * src->capacity);
+    dest->count = src->count;
+    dest->capacity = src->capacity;
+    dest->width = src->width;
+    dest->height = src->height;
+    dest->epoch = src->epoch;
+    dest->mapped = FALSE;
+}
+
+void components_free(ComponentMap *map) {
+    if (!map->mapped) free(map->labels);
+    map->mapped = FALSE;
+    free(map->parents);
+    map->labels = NULL;
+    map->parents = NULL;
+    map->width = map->height = 0;
+    map->count = map->capacity = 0;
+}
+
+int components_memory_usage(const ComponentMap *map) {
+    return sizeof(int) * (map->width * map->height + map->capacity);
+}
+
+// Collects the labels that a tile connects to. Returns the number of labels.
+static int connected_labels(const ComponentMap *map, int x, int y, int labels[9]) {
+    int label = components_get(map, x, y);
+    int count = 0;
+    int dx, dy;
+    
+    if (label != COMPONENT_NONE) {
+        labels[0] = label;
+        return 1;
+    }
+    
+    for (dy = -1; dy <= 1; ++dy) {
+        for (dx = -1; dx <= 1; ++dx) {
+            label = components_get(map, x + dx, y + dy);
+            if (label != COMPONENT_NONE)
+                labels[count++] = label;
+        }
+    }
+    
+    return count;
+}
+
+int components_label_near(const ComponentMap *map, int x, int y) {
+    int labels[9];
+    
+    return connected_labels(map, x, y, labels) > 0 ? labels[0] : COMPONENT_NONE;
+}
+
+BOOL components_connected(const ComponentMap *map, int startX, int startY, int endX, int endY) {
+    int start_labels[9], end_labels[9];
+    int start_count = connected_labels(map, startX, startY, start_labels);
+    int end_count = connected_labels(map, endX, endY, end_labels);
+    int i, j;
+    
+    if (startX == endX && startY == endY) return TRUE;
+    
+    for (i = 0; i < start_count; ++i) {
+        for (j = 0; j < end_count; ++j) {
+            if (start_labels[i] == end_labels[j]) return TRUE;
+        }
+    }
+    
+    return FALSE;
+}
+
+BOOL components_nearest(const ComponentMap *map, int label, short *x, short *y, int radius) {
+    int best_distance = -1;
+    int best_x = 0, best_y = 0;
+    int r, i;
+    
+    if (components_get(map, *x, *y) == label) return TRUE;
+    
+    // Search rings of tiles outward. A tile in a later ring can still be closer than one
+    // found in a corner of an earlier ring, so keep going until the rings are farther away.
+    for (r = 1; r <= radius; ++r) {
+        if (best_distance != -1 && r * r > best_distance) break;
+        
+        for (i = -r; i <= r; ++i) {
+            // The top, bottom, left and right sides of the ring
+            int ring[4][2] = {
+                { *x + i, *y - r }, { *x + i, *y + r },
+                { *x - r, *y + i }, { *x + r, *y + i }
+            };
+            int side;
+            
+            for (side = 0; side < 4; ++side) {
+                int tx = ring[side][0];
+                int ty = ring[side][1];
+                int distance = (tx - *x) * (tx - *x) + (ty - *y) * (ty - *y);
+                
+                if (components_get(map, tx, ty) != label) continue;
+                
+                if (best_distance == -1 || distance < best_distance) {
+                    best_distance = distance;
+                    best_x = tx;
+                    best_y = ty;
+                }
+            }
+        }
+    }
+    
+    if (best_distance == -1) return FALSE;
+    
+    *x = best_x;
+    *y = best_y;
+    return TRUE;
+}
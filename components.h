@@ -0,0 +1,130 @@
+#ifndef COMPONENTS_H_
+#define COMPONENTS_H_
+
+#include "grid.h"
+
+/** The label of a tile that isn't open. */
+#define COMPONENT_NONE 0
+
+/** Connected regions of open tiles.
+ * Tiles with the same label can reach each other, so a search between two
+ * labels that differ can be rejected without looking at the map.
+ * Regions that get joined by an update are merged instead of relabeled. Regions that
+ * get split by an update keep one label until the map is built again, so labels
+ * that match only mean the tiles might be connected.
+ */
+typedef struct ComponentMap {
+    /** The label that each tile was given. COMPONENT_NONE if the tile isn't open. (width * height)
+     * Use components_get to read a tile's region, since the label may have been merged into another.
+     */
+    int *labels;
+    
+    /** The label that each label was merged into. A label is a region of its own if it's its own parent. (capacity) */
+    int *parents;
+    
+    /** The number of labels that were given out. Labels go from 1 to count. */
+    int count;
+    
+    /** The number of labels that parents has room for. */
+    int capacity;
+    
+    /** The width of the grid the map was built for. */
+    short width;
+    
+    /** The height of the grid the map was built for. */
+    short height;
+    
+    /** The grid epoch the map was built with. The labels can't be used once the grid changes. */
+    unsigned int epoch;
+    
+    /** TRUE if the labels point into a mapped cache file instead of being allocated. */
+    BOOL mapped;
+} ComponentMap;
+
+/** Labels the connected regions of a grid.
+ * Tiles are connected the same way searches move: to any of the 8 open neighbors.
+ * @param map The map to build. Any old map memory is reused.
+ * @param grid The grid
+ */
+void components_build(ComponentMap *map, const Grid *grid);
+
+/** Updates the labels after tiles changed.
+ * Only the tiles in the rectangle and one tile around it are looked at, since those
+ * are the only tiles whose open state can change.
+ * @param map The map to update. Must have been built for the grid.
+ * @param grid The grid
+ * @param left The first x tile that changed
+ * @param top The first y tile that changed
+ * @param right The last x tile that changed
+ * @param bottom The last y tile that changed
+ */
+void components_update(ComponentMap *map, const Grid *grid, int left, int top, int right, int bottom);
+
+/** Copies a map into newly allocated memory, so the copy can be updated on its own.
+ * @param dest The map to copy into. Any memory it had is not freed.
+ * @param src The map to copy
+ */
+void components_copy(ComponentMap *dest, const ComponentMap *src);
+
+/** Frees the memory used by the map.
+ * @param map The map
+ */
+void components_free(ComponentMap *map);
+
+/** Returns the number of bytes used by the map.
+ * @param map The map
+ * @return the size of the labels and parents in bytes.
+ */
+int components_memory_usage(const ComponentMap *map);
+
+/** Returns the region of a tile.
+ * @param map The map
+ * @param x The x tile
+ * @param y The y tile
+ * @return the label of the region, or COMPONENT_NONE if the tile isn't open or is outside of the map.
+ */
+static inline int components_get(const ComponentMap *map, int x, int y) {
+    int label;
+    
+    if ((unsigned)x >= (unsigned)map->width || (unsigned)y >= (unsigned)map->height) return COMPONENT_NONE;
+    
+    label = map->labels[y * map->width + x];
+    
+    while (map->parents[label] != label)
+        label = map->parents[label];
+    
+    return label;
+}
+
+/** Returns the label that a search from a tile would move through.
+ * A tile that isn't open takes the label of its first open neighbor.
+ * @param map The map
+ * @param x The x tile
+ * @param y The y tile
+ * @return the label, or COMPONENT_NONE if neither the tile nor its neighbors are open.
+ */
+int components_label_near(const ComponentMap *map, int x, int y);
+
+/** Returns whether or not a search could get from one tile to another.
+ * Tiles that aren't open connect through their open neighbors, since a search
+ * leaves the start and reaches the goal through one of them.
+ * @param map The map
+ * @param startX The starting x tile
+ * @param startY The starting y tile
+ * @param endX The ending x tile
+ * @param endY The ending y tile
+ * @return TRUE if the tiles might be connected, FALSE if they can't be.
+ */
+BOOL components_connected(const ComponentMap *map, int startX, int startY, int endX, int endY);
+
+/** Finds the open tile closest to a position that has a label.
+ * @param map The map
+ * @param label The label to look for
+ * @param x The x tile. Set to the tile that was found.
+ * @param y The y tile. Set to the tile that was found.
+ * @param radius The farthest to look in each direction.
+ * @return TRUE if a tile was found, FALSE otherwise.
+ */
+BOOL components_nearest(const ComponentMap *map, int label, short *x, short *y, int radius);
+
+#endif
@@ -0,0 +1,415 @@
+#include "dstar.h"
+#include "hierarchy.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The cost of a tile that can't reach the goal. Small enough that adding a step doesn't overflow.
+#define INFINITE_COST (INT_MAX / 2)
+
+// Used as offsets for neighbors.
+static GridPosition directions[8] = {
+    { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 },
+    { -1, -1 }, { 1, -1 }, { -1, 1 }, { 1, 1 }
+};
+
+// Octile distance with the hierarchy costs. Never more than the real cost.
+static int heuristic(int x0, int y0, int x1, int y1) {
+    int dx = abs(x1 - x0);
+    int dy = abs(y1 - y0);
+    int diagonal = dx < dy ? dx : dy;
+    int straight = dx + dy - 2 * diagonal;
+    
+    return diagonal * HIERARCHY_DIAGONAL_COST + straight * HIERARCHY_STRAIGHT_COST;
+}
+
+// Searches can end at the goal even if it's next to a wall, the same as the other searches.
+static BOOL is_passable(const DStar *search, const Grid *grid, int x, int y) {
+    return grid_is_open(grid, x, y) || (x == search->goal_x && y == search->goal_y);
+}
+
+// Returns the cost of moving from a tile to its neighbor. The cost is the same in both directions,
+// so it's also the cost of the edge that the backward search follows.
+static int step_cost(const DStar *search, const Grid *grid, int x, int y, int dx, int dy) {
+    if (!is_passable(search, grid, x, y) || !is_passable(search, grid, x + dx, y + dy)) return INFINITE_COST;
+    
+    if (dx != 0 && dy != 0) {
+        if (!grid_is_open(grid, x + dx, y) && !grid_is_open(grid, x, y + dy)) return INFINITE_COST;
+        return HIERARCHY_DIAGONAL_COST;
+    }
+    
+    return HIERARCHY_STRAIGHT_COST;
+}
+
+// Mixes the high bits of the product down, since the low bits of tiles in the same column only differ by their row.
+static int hash_slot(const DStar *search, int tile) {
+    unsigned int hash = (unsigned int)tile * 2654435761u;
+    
+    return (int)((hash ^ (hash >> 16)) & (unsigned int)(search->table_size - 1));
+}
+
+// Returns the index of the node of a tile, or -1 if the tile hasn't been looked at.
+static int find_node(const DStar *search, int tile) {
+    int slot = hash_slot(search, tile);
+    
+    while (search->table[slot] != -1) {
+        if (search->nodes[search->table[slot]].tile == tile) return search->table[slot];
+        slot = (slot + 1) & (search->table_size - 1);
+    }
+    
+    return -1;
+}
+
+static void insert_slot(DStar *search, int index) {
+    int slot = hash_slot(search, search->nodes[index].tile);
+    
+    while (search->table[slot] != -1)
+        slot = (slot + 1) & (search->table_size - 1);
+    
+    search->table[slot] = index;
+}
+
+// Adds a node that hasn't been reached yet. Pointers to nodes aren't valid afterwards.
+static int add_node(DStar *search, int tile) {
+    int index = search->node_count++;
+    int i;
+    
+    if (index >= search->node_capacity) {
+        search->node_capacity *= 2;
+        search->nodes = realloc(search->nodes, sizeof(DStarNode) * search->node_capacity);
+        ipq_reserve(&search->open, search->node_capacity);
+    }
+    
+    search->nodes[index].tile = tile;
+    search->nodes[index].g = INFINITE_COST;
+    search->nodes[index].rhs = INFINITE_COST;
+    
+    // Keep the table at most half full so probes stay short.
+    if (search->node_count * 2 > search->table_size) {
+        search->table_size *= 2;
+        search->table = realloc(search->table, sizeof(int) * search->table_size);
+        memset(search->table, -1, sizeof(int) * search->table_size);
+        
+        for (i = 0; i < search->node_count; ++i)
+            insert_slot(search, i);
+    } else {
+        insert_slot(search, index);
+    }
+    
+    return index;
+}
+
+static int get_g(const DStar *search, int x, int y) {
+    int index = find_node(search, y * search->width + x);
+    
+    return index != -1 ? search->nodes[index].g : INFINITE_COST;
+}
+
+// The D* Lite key is the estimated cost through the start, with ties broken by the cost to the goal.
+// Both are packed into one key so the open list compares them in order.
+static int64_t calculate_key(const DStar *search, int index) {
+    const DStarNode *node = &search->nodes[index];
+    int cost = node->g < node->rhs ? node->g : node->rhs;
+    int estimate;
+    
+    if (cost >= INFINITE_COST) return INT64_MAX;
+    
+    estimate = cost + heuristic(search->start_x, search->start_y, node->tile % search->width, node->tile / search->width) + search->km;
+    
+    return ((int64_t)estimate << 32) | cost;
+}
+
+// Puts a node in the open list if it needs to be expanded, or takes it out if it doesn't.
+static void update_node(DStar *search, int index) {
+    ipq_remove(&search->open, index);
+    
+    if (search->nodes[index].g != search->nodes[index].rhs)
+        ipq_push(&search->open, calculate_key(search, index), index);
+}
+
+// Returns the best cost of getting to the goal through one of a tile's neighbors.
+static int lookahead(const DStar *search, const Grid *grid, int x, int y) {
+    int best = INFINITE_COST;
+    int i;
+    
+    if (x == search->goal_x && y == search->goal_y) return 0;
+    
+    for (i = 0; i < 8; ++i) {
+        int cost = step_cost(search, grid, x, y, directions[i].x, directions[i].y);
+        
+        if (cost >= INFINITE_COST) continue;
+        
+        cost += get_g(search, x + directions[i].x, y + directions[i].y);
+        
+        if (cost < best) best = cost;
+    }
+    
+    return best;
+}
+
+// Throws away everything that was searched and starts over from the goal.
+static void reset(DStar *search, const Grid *grid) {
+    int goal;
+    
+    search->width = grid->width;
+    search->epoch = grid->epoch;
+    search->km = 0;
+    search->node_count = 0;
+    search->started = TRUE;
+    memset(search->table, -1, sizeof(int) * search->table_size);
+    ipq_clear(&search->open);
+    
+    goal = add_node(search, search->goal_y * search->width + search->goal_x);
+    search->nodes[goal].rhs = 0;
+    update_node(search, goal);
+}
+
+// Fixes the costs of the tiles around a tile that changed.
+// Changing a tile changes the open state of its neighbors, which changes the edges of the tiles
+// next to those, so every tile within 2 of it is looked at again.
+static void repair(DStar *search, const Grid *grid, int tile) {
+    int cx = tile % search->width;
+    int cy = tile / search->width;
+    int x, y;
+    
+    for (y = cy - 2; y <= cy + 2; ++y) {
+        for (x = cx - 2; x <= cx + 2; ++x) {
+            int rhs, index;
+            
+            if (!grid_is_valid(grid, x, y)) continue;
+            if (x == search->goal_x && y == search->goal_y) continue;
+            
+            rhs = lookahead(search, grid, x, y);
+            index = find_node(search, y * search->width + x);
+            
+            if (index == -1) {
+                if (rhs >= INFINITE_COST) continue;
+                index = add_node(search, y * search->width + x);
+            }
+            
+            if (search->nodes[index].rhs != rhs) {
+                search->nodes[index].rhs = rhs;
+                update_node(search, index);
+            }
+        }
+    }
+}
+
+// Expands nodes until the start's cost is known.
+// Returns FALSE if the expansion limit was reached first.
+static BOOL compute_shortest_path(DStar *search, const Grid *grid, int max_expansions) {
+    int start_tile = search->start_y * search->width + search->start_x;
+    int expansions = 0;
+    int i;
+    
+    while (!ipq_empty(&search->open)) {
+        int start = find_node(search, start_tile);
+        IndexedPQEntry top = search->open.entries[0];
+        int u = top.index;
+        int64_t key = calculate_key(search, u);
+        int x, y;
+        
+        if (start != -1 && top.key >= calculate_key(search, start) &&
+            search->nodes[start].rhs <= search->nodes[start].g)
+            break;
+        
+        if (max_expansions > 0 && expansions >= max_expansions) return FALSE;
+        ++expansions;
+        
+        x = search->nodes[u].tile % search->width;
+        y = search->nodes[u].tile / search->width;
+        
+        if (top.key < key) {
+            // The start moved since the key was computed.
+            ipq_remove(&search->open, u);
+            ipq_push(&search->open, key, u);
+        } else if (search->nodes[u].g > search->nodes[u].rhs) {
+            int g = search->nodes[u].g = search->nodes[u].rhs;
+            
+            ipq_remove(&search->open, u);
+            
+            for (i = 0; i < 8; ++i) {
+                int nx = x + directions[i].x;
+                int ny = y + directions[i].y;
+                int cost = step_cost(search, grid, nx, ny, -directions[i].x, -directions[i].y);
+                int index;
+                
+                if (cost >= INFINITE_COST) continue;
+                if (nx == search->goal_x && ny == search->goal_y) continue;
+                
+                index = find_node(search, ny * search->width + nx);
+                if (index == -1) index = add_node(search, ny * search->width + nx);
+                
+                if (g + cost < search->nodes[index].rhs) {
+                    search->nodes[index].rhs = g + cost;
+                    update_node(search, index);
+                }
+            }
+        } else {
+            int old_g = search->nodes[u].g;
+            
+            search->nodes[u].g = INFINITE_COST;
+            update_node(search, u);
+            
+            // Neighbors that got their cost through this tile have to look for another way.
+            for (i = 0; i < 8; ++i) {
+                int nx = x + directions[i].x;
+                int ny = y + directions[i].y;
+                int cost = step_cost(search, grid, nx, ny, -directions[i].x, -directions[i].y);
+                int index;
+                
+                if (cost >= INFINITE_COST) continue;
+                if (nx == search->goal_x && ny == search->goal_y) continue;
+                
+                index = find_node(search, ny * search->width + nx);
+                
+                if (index == -1 || search->nodes[index].rhs != old_g + cost) continue;
+                
+                search->nodes[index].rhs = lookahead(search, grid, nx, ny);
+                update_node(search, index);
+            }
+        }
+    }
+    
+    return TRUE;
+}
+
+// Follows the cheapest neighbors from the start to the goal.
+// The path starts at the origin, which is the start unless the start had to be moved off of a wall.
+static BOOL build_path(const DStar *search, const Grid *grid, short originX, short originY, Path *path) {
+    int x = search->start_x;
+    int y = search->start_y;
+    int count = 0;
+    int i;
+    
+    // The search stops once the start's best neighbor is known, which can be before the start itself is expanded.
+    if (lookahead(search, grid, x, y) >= INFINITE_COST) return FALSE;
+    
+    if (x != originX || y != originY) {
+        path_resize(path, 1);
+        path->points[count].x = originX;
+        path->points[count++].y = originY;
+    }
+    
+    path_resize(path, count + 1);
+    path->points[count].x = x;
+    path->points[count++].y = y;
+    
+    while (x != search->goal_x || y != search->goal_y) {
+        int best = INFINITE_COST;
+        int best_x = 0, best_y = 0;
+        
+        // Costs that haven't been repaired yet could make a loop, but a path never needs more tiles than were searched.
+        if (count > search->node_count + 1) return FALSE;
+        
+        for (i = 0; i < 8; ++i) {
+            int nx = x + directions[i].x;
+            int ny = y + directions[i].y;
+            int cost = step_cost(search, grid, x, y, directions[i].x, directions[i].y);
+            
+            if (cost >= INFINITE_COST) continue;
+            
+            cost += get_g(search, nx, ny);
+            
+            if (cost < best) {
+                best = cost;
+                best_x = nx;
+                best_y = ny;
+            }
+        }
+        
+        if (best >= INFINITE_COST) return FALSE;
+        
+        x = best_x;
+        y = best_y;
+        
+        path_resize(path, count + 1);
+        path->points[count].x = x;
+        path->points[count++].y = y;
+    }
+    
+    return TRUE;
+}
+
+// Moves the start and searches from it.
+static BOOL search_from(DStar *search, const Grid *grid, short startX, short startY, short originX, short originY, int max_expansions, Path *path) {
+    if (startX != search->start_x || startY != search->start_y) {
+        search->km += heuristic(search->start_x, search->start_y, startX, startY);
+        search->start_x = startX;
+        search->start_y = startY;
+    }
+    
+    if (!compute_shortest_path(search, grid, max_expansions)) {
+        search->complete = FALSE;
+        return FALSE;
+    }
+    
+    return build_path(search, grid, originX, originY, path);
+}
+
+void dstar_init(DStar *search, short goalX, short goalY) {
+    memset(search, 0, sizeof(DStar));
+    
+    search->goal_x = goalX;
+    search->goal_y = goalY;
+    search->node_capacity = 1024;
+    search->nodes = malloc(sizeof(DStarNode) * search->node_capacity);
+    search->table_size = search->node_capacity * 2;
+    search->table = malloc(sizeof(int) * search->table_size);
+    ipq_init(&search->open, search->node_capacity, 256);
+    search->started = FALSE;
+}
+
+void dstar_free(DStar *search) {
+    free(search->nodes);
+    free(search->table);
+    ipq_free(&search->open);
+    search->nodes = NULL;
+    search->table = NULL;
+    search->node_count = search->node_capacity = search->table_size = 0;
+    search->started = FALSE;
+}
+
+int dstar_memory_usage(const DStar *search) {
+    return sizeof(DStarNode) * search->node_capacity + sizeof(int) * search->table_size +
+        sizeof(IndexedPQEntry) * search->open.size + sizeof(int) * search->open.index_count;
+}
+
+BOOL dstar_find_path(DStar *search, const Grid *grid, short startX, short startY, int max_expansions, Path *path) {
+    int i;
+    
+    path_clear(path);
+    search->complete = TRUE;
+    
+    if (!grid_is_valid(grid, startX, startY) || !grid_is_valid(grid, search->goal_x, search->goal_y)) return FALSE;
+    
+    if (!search->started || search->width != grid->width || grid->epoch - search->epoch >= GRID_CHANGE_LOG) {
+        search->start_x = startX;
+        search->start_y = startY;
+        reset(search, grid);
+    } else {
+        // Keys pushed while repairing use the old start. They're still low enough, and get raised when they come up.
+        while (search->epoch != grid->epoch)
+            repair(search, grid, grid_get_change(grid, ++search->epoch));
+    }
+    
+    if (is_passable(search, grid, startX, startY)) {
+        if (search_from(search, grid, startX, startY, startX, startY, max_expansions, path)) return TRUE;
+    } else {
+        // Searches can leave a start that's next to a wall through any of its open neighbors.
+        for (i = 0; i < 8; ++i) {
+            short nx = startX + directions[i].x;
+            short ny = startY + directions[i].y;
+            
+            if (!grid_is_open(grid, nx, ny)) continue;
+            
+            if (search_from(search, grid, nx, ny, startX, startY, max_expansions, path)) return TRUE;
+            
+            // The next neighbor would get a whole new budget.
+            if (!search->complete) break;
+        }
+    }
+    
+    path_clear(path);
+    return FALSE;
+}
@@ -0,0 +1,105 @@
+#ifndef DSTAR_H_
+#define DSTAR_H_
+
+#include "grid.h"
+#include "path.h"
+#include "pqueue.h"
+
+/** The search state of a tile that a replanner has looked at. */
+typedef struct DStarNode {
+    /** The tile as y * width + x. */
+    int tile;
+    
+    /** The cost of getting from this tile to the goal the last time the tile was expanded. */
+    int g;
+    
+    /** The cost of getting to the goal through the best neighbor. The tile needs to be expanded when it doesn't match g. */
+    int rhs;
+} DStarNode;
+
+/** An incremental search from a moving start to a fixed goal (D* Lite).
+ * The search runs backward from the goal, so the costs it found stay valid while the start
+ * moves. When tiles change, only the tiles around them are repaired instead of searching again.
+ * Uses the same movement rules and costs as the hierarchy.
+ */
+typedef struct DStar {
+    /** The tiles that have been looked at. Tiles that aren't here haven't been reached. */
+    DStarNode *nodes;
+    
+    /** The number of nodes in use. */
+    int node_count;
+    
+    /** The number of nodes allocated. */
+    int node_capacity;
+    
+    /** An open addressing table from tiles to node indices. -1 marks an empty slot. (table_size) */
+    int *table;
+    
+    /** The number of slots in the table. Always a power of 2. */
+    int table_size;
+    
+    /** The nodes whose g and rhs don't match, keyed by their distance through the start. */
+    IndexedPriorityQueue open;
+    
+    /** The x tile that paths lead to. */
+    short goal_x;
+    
+    /** The y tile that paths lead to. */
+    short goal_y;
+    
+    /** The x tile of the start that the keys in the open list were computed with. */
+    short start_x;
+    
+    /** The y tile of the start that the keys in the open list were computed with. */
+    short start_y;
+    
+    /** The width of the grid the search was started on. */
+    short width;
+    
+    /** How much the start has moved since the search began. Added to new keys so the old keys stay ordered. */
+    int km;
+    
+    /** The grid epoch that the search is up to date with. */
+    unsigned int epoch;
+    
+    /** TRUE once the search has been started on a grid. */
+    BOOL started;
+    
+    /** FALSE if the last call ran out of expansions before it knew the path. The next call continues the search. */
+    BOOL complete;
+} DStar;
+
+/** Initializes a replanner. Nothing is searched until the first path is found.
+ * @param search The replanner
+ * @param goalX The x tile that paths lead to
+ * @param goalY The y tile that paths lead to
+ */
+void dstar_init(DStar *search, short goalX, short goalY);
+
+/** Frees the memory used by a replanner.
+ * @param search The replanner
+ */
+void dstar_free(DStar *search);
+
+/** Returns the number of bytes used by a replanner.
+ * @param search The replanner
+ * @return the size of the nodes, table and open list in bytes.
+ */
+int dstar_memory_usage(const DStar *search);
+
+/** Finds a path from a start to the goal.
+ * The tiles that changed since the last call are repaired first. The search starts over
+ * if more tiles changed than the grid remembers. search->complete is FALSE afterwards if
+ * max_expansions ran out before the path was known.
+ * @param search The replanner
+ * @param grid The grid. Must be the same size every time.
+ * @param startX The starting x tile
+ * @param startY The starting y tile
+ * @param max_expansions Give up after expanding this many nodes. 0 for no limit.
+ *        The search picks up where it stopped on the next call.
+ * @param path Filled with every tile of the path. Emptied if no path was found.
+ * @return TRUE if a path was found, FALSE otherwise.
+ */
+BOOL dstar_find_path(DStar *search, const Grid *grid, short startX, short startY, int max_expansions, Path *path);
+
+#endif
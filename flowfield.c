@@ -0,0 +1,164 @@
+#include "flowfield.h"
+#include "hierarchy.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Used as offsets for flow directions.
+static GridPosition directions[8] = {
+    { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 },
+    { -1, -1 }, { 1, -1 }, { -1, 1 }, { 1, 1 }
+};
+
+// The index of the opposite of each direction.
+static const unsigned char opposite[8] = { 2, 3, 0, 1, 7, 6, 5, 4 };
+
+// Enough buckets that a cost and the cost plus the largest step never share one.
+#define BUCKET_COUNT (HIERARCHY_DIAGONAL_COST + 1)
+
+// A list of tiles that have the same cost.
+typedef struct {
+    int *tiles;
+    int count;
+    int capacity;
+} Bucket;
+
+static void bucket_add(Bucket *bucket, int tile) {
+    if (bucket->count >= bucket->capacity) {
+        bucket->capacity = bucket->capacity ? bucket->capacity * 2 : 256;
+        bucket->tiles = realloc(bucket->tiles, sizeof(int) * bucket->capacity);
+    }
+    
+    bucket->tiles[bucket->count++] = tile;
+}
+
+void flowfield_initialize(FlowField *field, int radius) {
+    int size = radius * 2 + 1;
+    
+    field->radius = radius;
+    field->target_x = field->target_y = -1;
+    field->left = field->top = 0;
+    field->width = field->height = 0;
+    field->directions = malloc(size * size);
+    memset(field->directions, FLOW_BLOCKED, size * size);
+}
+
+void flowfield_free(FlowField *field) {
+    free(field->directions);
+    field->directions = NULL;
+}
+
+int flowfield_memory_usage(const FlowField *field) {
+    int size = field->radius * 2 + 1;
+    
+    return size * size;
+}
+
+// Searches outward from the target with buckets of equal cost (Dial's algorithm).
+// Each tile stores the direction back toward the tile that reached it.
+void flowfield_build(FlowField *field, const Grid *grid, short targetX, short targetY) {
+    Bucket buckets[BUCKET_COUNT];
+    int right, bottom;
+    int remaining = 1;
+    int *cost;
+    int current = 0;
+    int i;
+    
+    field->target_x = targetX;
+    field->target_y = targetY;
+    
+    if (!grid_is_valid(grid, targetX, targetY)) {
+        field->width = field->height = 0;
+        return;
+    }
+    
+    field->left = targetX - field->radius < 0 ? 0 : targetX - field->radius;
+    field->top = targetY - field->radius < 0 ? 0 : targetY - field->radius;
+    right = targetX + field->radius >= grid->width ? grid->width - 1 : targetX + field->radius;
+    bottom = targetY + field->radius >= grid->height ? grid->height - 1 : targetY + field->radius;
+    field->width = right - field->left + 1;
+    field->height = bottom - field->top + 1;
+    
+    memset(field->directions, FLOW_BLOCKED, field->width * field->height);
+    
+    cost = malloc(sizeof(int) * field->width * field->height);
+    for (i = 0; i < field->width * field->height; ++i)
+        cost[i] = -1;
+    
+    memset(buckets, 0, sizeof(buckets));
+    
+    i = (targetY - field->top) * field->width + (targetX - field->left);
+    cost[i] = 0;
+    field->directions[i] = FLOW_TARGET;
+    bucket_add(&buckets[0], i);
+    
+    while (remaining > 0) {
+        Bucket *bucket = &buckets[current % BUCKET_COUNT];
+        int b;
+        
+        for (b = 0; b < bucket->count; ++b) {
+            int tile = bucket->tiles[b];
+            int x = field->left + tile % field->width;
+            int y = field->top + tile / field->width;
+            
+            --remaining;
+            
+            if (cost[tile] != current) continue;
+            
+            for (i = 0; i < 8; ++i) {
+                int dx = directions[i].x;
+                int dy = directions[i].y;
+                int nx = x + dx;
+                int ny = y + dy;
+                int step = HIERARCHY_STRAIGHT_COST;
+                int next;
+                
+                if (nx < field->left || nx > right || ny < field->top || ny > bottom) continue;
+                if (!grid_is_open(grid, nx, ny)) continue;
+                
+                if (dx != 0 && dy != 0) {
+                    if (!grid_is_open(grid, x + dx, y) && !grid_is_open(grid, x, y + dy)) continue;
+                    step = HIERARCHY_DIAGONAL_COST;
+                }
+                
+                next = (ny - field->top) * field->width + (nx - field->left);
+                
+                if (cost[next] == -1 || current + step < cost[next]) {
+                    cost[next] = current + step;
+                    field->directions[next] = opposite[i];
+                    bucket_add(&buckets[cost[next] % BUCKET_COUNT], next);
+                    ++remaining;
+                }
+            }
+        }
+        
+        bucket->count = 0;
+        ++current;
+    }
+    
+    for (i = 0; i < BUCKET_COUNT; ++i)
+        free(buckets[i].tiles);
+    free(cost);
+}
+
+BOOL flowfield_next(const FlowField *field, int x, int y, GridPosition *next) {
+    unsigned char direction;
+    
+    x -= field->left;
+    y -= field->top;
+    
+    if ((unsigned)x >= (unsigned)field->width || (unsigned)y >= (unsigned)field->height) return FALSE;
+    
+    direction = field->directions[y * field->width + x];
+    
+    if (direction == FLOW_BLOCKED) return FALSE;
+    
+    next->x = field->left + x;
+    next->y = field->top + y;
+    
+    if (direction != FLOW_TARGET) {
+        next->x += directions[direction].x;
+        next->y += directions[direction].y;
+    }
+    
+    return TRUE;
+}
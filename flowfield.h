@@ -0,0 +1,78 @@
+#ifndef FLOWFIELD_H_
+#define FLOWFIELD_H_
+
+#include "grid.h"
+
+/** The direction value of the target tile. */
+#define FLOW_TARGET 8
+
+/** The direction value of a tile that can't reach the target. */
+#define FLOW_BLOCKED 0xFF
+
+/** The direction to move from every tile around a target to get closer to it.
+ * Only a square region around the target is covered.
+ */
+typedef struct FlowField {
+    /** The x tile that the field leads to. */
+    short target_x;
+    
+    /** The y tile that the field leads to. */
+    short target_y;
+    
+    /** The first x tile of the region. */
+    short left;
+    
+    /** The first y tile of the region. */
+    short top;
+    
+    /** The width of the region. */
+    short width;
+    
+    /** The height of the region. */
+    short height;
+    
+    /** The number of tiles the region reaches out from the target. */
+    int radius;
+    
+    /** The direction to move from each tile of the region. (width * height)
+     * Either an index into the direction table, FLOW_TARGET or FLOW_BLOCKED.
+     */
+    unsigned char *directions;
+} FlowField;
+
+/** Allocates a flow field. Every tile starts out blocked.
+ * @param field The field to initialize
+ * @param radius The number of tiles the region reaches out from the target.
+ */
+void flowfield_initialize(FlowField *field, int radius);
+
+/** Frees the memory used by a flow field.
+ * @param field The field
+ */
+void flowfield_free(FlowField *field);
+
+/** Returns the number of bytes used by a flow field.
+ * @param field The field
+ * @return the size of the direction map in bytes.
+ */
+int flowfield_memory_usage(const FlowField *field);
+
+/** Builds the field by searching outward from the target.
+ * Uses the same movement rules and costs as the hierarchy.
+ * @param field The field
+ * @param grid The grid
+ * @param targetX The target x tile
+ * @param targetY The target y tile
+ */
+void flowfield_build(FlowField *field, const Grid *grid, short targetX, short targetY);
+
+/** Returns the next tile to move to from a tile.
+ * @param field The field
+ * @param x The x tile
+ * @param y The y tile
+ * @param next Set to the next tile. Set to the tile itself if it's the target.
+ * @return TRUE if the tile is in the region and can reach the target, FALSE otherwise.
+ */
+BOOL flowfield_next(const FlowField *field, int x, int y, GridPosition *next);
+
+#endif
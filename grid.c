@@ -1,83 +1,503 @@
 #include "grid.h"
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // Used as offsets for grid functions.
-static Node directions[8] = {
+static GridPosition directions[8] = {
     { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 },
     { -1, -1 }, { 1, -1 }, { -1, 1 }, { 1, 1 }
 };
 
-// Allocate memory and set defaults for the grid.
-void grid_initialize(Grid *grid, short width, short height) {
-    int x, y;
+static void set_bit(Grid *grid, uint64_t *plane, int x, int y) {
+    plane[y * grid->row_words + (x >> 6)] |= (uint64_t)1 << (x & 63);
+}
+
+static void clear_bit(Grid *grid, uint64_t *plane, int x, int y) {
+    plane[y * grid->row_words + (x >> 6)] &= ~((uint64_t)1 << (x & 63));
+}
+
+// Sets the clearance of every tile within GRID_MAX_CLEARANCE - 1 of a tile that was just removed.
+// Those tiles only depend on the walls within GRID_MAX_CLEARANCE - 1 of them, so a two-pass distance
+// transform over the tiles within twice that distance gives them their exact values.
+static void repair_clearance(Grid *grid, int x, int y) {
+    enum { REACH = GRID_MAX_CLEARANCE - 1, SIZE = REACH * 4 + 1 };
+    unsigned char distances[SIZE * SIZE];
+    int left = x - REACH * 2, top = y - REACH * 2;
+    int right = x + REACH * 2, bottom = y + REACH * 2;
+    int width, height, i, j;
     
-    grid->nodes = malloc(sizeof(Node) * width * height);
-    grid->width = width;
-    grid->height = height;
+    if (left < 0) left = 0;
+    if (top < 0) top = 0;
+    if (right >= grid->width) right = grid->width - 1;
+    if (bottom >= grid->height) bottom = grid->height - 1;
+    
+    width = right - left + 1;
+    height = bottom - top + 1;
+    
+    // The first pass carries distances down and to the right, the second up and to the left.
+    for (j = 0; j < height; ++j) {
+        for (i = 0; i < width; ++i) {
+            unsigned char *d = &distances[j * SIZE + i];
+            
+            *d = grid_is_solid(grid, left + i, top + j) ? 0 : GRID_MAX_CLEARANCE;
+            if (*d == 0) continue;
+            
+            if (i > 0 && d[-1] + 1 < *d) *d = d[-1] + 1;
+            if (j > 0) {
+                if (d[-SIZE] + 1 < *d) *d = d[-SIZE] + 1;
+                if (i > 0 && d[-SIZE - 1] + 1 < *d) *d = d[-SIZE - 1] + 1;
+                if (i < width - 1 && d[-SIZE + 1] + 1 < *d) *d = d[-SIZE + 1] + 1;
+            }
+        }
+    }
+    
+    for (j = height - 1; j >= 0; --j) {
+        for (i = width - 1; i >= 0; --i) {
+            unsigned char *d = &distances[j * SIZE + i];
+            
+            if (i < width - 1 && d[1] + 1 < *d) *d = d[1] + 1;
+            if (j < height - 1) {
+                if (d[SIZE] + 1 < *d) *d = d[SIZE] + 1;
+                if (i > 0 && d[SIZE - 1] + 1 < *d) *d = d[SIZE - 1] + 1;
+                if (i < width - 1 && d[SIZE + 1] + 1 < *d) *d = d[SIZE + 1] + 1;
+            }
+        }
+    }
     
-    for (y = 0; y < height; ++y) {
-        for (x = 0; x < width; ++x) {
-            grid->nodes[y * height + x].x = x;
-            grid->nodes[y * height + x].y = y;
-            grid->nodes[y * height + x].near_wall = FALSE;
-            grid->nodes[y * height + x].solid = FALSE;
+    for (j = y - REACH; j <= y + REACH; ++j) {
+        for (i = x - REACH; i <= x + REACH; ++i) {
+            if (!grid_is_valid(grid, i, j)) continue;
+            
+            grid->clearance[j * grid->width + i] = distances[(j - top) * SIZE + (i - left)];
         }
     }
 }
 
-void grid_free(Grid *grid) {
-    free(grid->nodes);
+// Lowers the clearance of the tiles around a wall that was just added.
+static void add_clearance(Grid *grid, int x, int y) {
+    int dx, dy;
+    
+    for (dy = 1 - GRID_MAX_CLEARANCE; dy < GRID_MAX_CLEARANCE; ++dy) {
+        for (dx = 1 - GRID_MAX_CLEARANCE; dx < GRID_MAX_CLEARANCE; ++dx) {
+            int distance = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+            unsigned char *clearance;
+            
+            if (!grid_is_valid(grid, x + dx, y + dy)) continue;
+            
+            clearance = &grid->clearance[(y + dy) * grid->width + x + dx];
+            if (distance < *clearance)
+                *clearance = distance;
+        }
+    }
+}
+
+// The state shared by the threads of a grid build. Each thread builds every threads-th row.
+typedef struct {
+    Grid *grid;
+    const unsigned char *tiles;
+    
+    // 0xFF for each solid tile type, 0 otherwise.
+    unsigned char masks[256];
+    
+    // The distance from each tile to the nearest solid tile in its own row, up to GRID_MAX_CLEARANCE.
+    unsigned char *row_distances;
+    
+    // The number of solid tiles in each tile's row from one to the left to one to the right,
+    // with the tile's own solid state in bit 2.
+    unsigned char *row_walls;
+    
+    int threads;
+} GridBuild;
+
+typedef struct {
+    GridBuild *build;
+    int first_row;
+} GridBuildThread;
+
+// Packs 64 tile masks into a word.
+static uint64_t pack_word(const unsigned char *masks) {
+    uint64_t word = 0;
+    int i;
+
+#ifdef __SSE2__
+    for (i = 0; i < 4; ++i) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(masks + i * 16));
+        word |= (uint64_t)(unsigned)_mm_movemask_epi8(bytes) << (i * 16);
+    }
+#else
+    for (i = 0; i < 64; ++i)
+        word |= (uint64_t)(masks[i] & 1) << i;
+#endif
+
+    return word;
 }
 
-Node* grid_get_node(Grid *grid, short x, short y) {
-    return &grid->nodes[y * grid->height + x];
+// Sets the wall counts of a row to the walls beside each tile in its own row.
+static void count_row_walls(unsigned char *count, const unsigned char *walls, int width) {
+    int x = 0;
+
+#ifdef __SSE2__
+    const __m128i sum_mask = _mm_set1_epi8(3), self_mask = _mm_set1_epi8(4);
+    
+    for (; x + 16 <= width; x += 16) {
+        __m128i w = _mm_loadu_si128((const __m128i *)(walls + x));
+        __m128i self = _mm_cmpeq_epi8(_mm_and_si128(w, self_mask), self_mask);
+        
+        // A solid tile compares as -1, which takes it back out of the sum.
+        _mm_storeu_si128((__m128i *)(count + x), _mm_add_epi8(_mm_and_si128(w, sum_mask), self));
+    }
+#endif
+
+    for (; x < width; ++x)
+        count[x] = (walls[x] & 3) - (walls[x] >> 2);
 }
 
-BOOL grid_is_solid(Grid *grid, short x, short y) {
-    return grid_get_node(grid, x, y)->solid;
+// Adds the walls of the row above or below to the wall counts of a row.
+static void add_row_walls(unsigned char *count, const unsigned char *walls, int width) {
+    int x = 0;
+
+#ifdef __SSE2__
+    const __m128i sum_mask = _mm_set1_epi8(3);
+    
+    for (; x + 16 <= width; x += 16) {
+        __m128i w = _mm_and_si128(_mm_loadu_si128((const __m128i *)(walls + x)), sum_mask);
+        __m128i c = _mm_loadu_si128((const __m128i *)(count + x));
+        
+        _mm_storeu_si128((__m128i *)(count + x), _mm_add_epi8(c, w));
+    }
+#endif
+
+    for (; x < width; ++x)
+        count[x] += walls[x] & 3;
 }
 
-BOOL grid_is_valid(Grid *grid, short x, short y) {
-    return x >= 0 && x < grid->width && y >= 0 && y < grid->height;
+// Lowers the clearance of a row to the walls of the row that's rows away from it.
+static void min_row_distances(unsigned char *clearance, const unsigned char *distances, unsigned char rows, int width) {
+    int x = 0;
+
+#ifdef __SSE2__
+    const __m128i minimum = _mm_set1_epi8(rows);
+    
+    for (; x + 16 <= width; x += 16) {
+        __m128i d = _mm_max_epu8(_mm_loadu_si128((const __m128i *)(distances + x)), minimum);
+        __m128i c = _mm_loadu_si128((const __m128i *)(clearance + x));
+        
+        _mm_storeu_si128((__m128i *)(clearance + x), _mm_min_epu8(c, d));
+    }
+#endif
+
+    for (; x < width; ++x) {
+        unsigned char distance = distances[x] > rows ? distances[x] : rows;
+        
+        if (distance < clearance[x])
+            clearance[x] = distance;
+    }
 }
 
-BOOL grid_is_open(Grid *grid, short x, short y) {
-    return grid_is_valid(grid, x, y) && 
-          !grid_is_solid(grid, x, y) && 
-          !grid_get_node(grid, x, y)->near_wall;
+// Sets the walls of a row from the masks of its tiles. The masks must be readable one tile past each end.
+static void sum_row_walls(unsigned char *walls, const unsigned char *masks, int width) {
+    int x = 0;
+
+#ifdef __SSE2__
+    const __m128i one = _mm_set1_epi8(1), self_mask = _mm_set1_epi8(4);
+    
+    for (; x + 16 <= width; x += 16) {
+        __m128i left = _mm_loadu_si128((const __m128i *)(masks + x - 1));
+        __m128i self = _mm_loadu_si128((const __m128i *)(masks + x));
+        __m128i right = _mm_loadu_si128((const __m128i *)(masks + x + 1));
+        __m128i sum = _mm_add_epi8(_mm_add_epi8(_mm_and_si128(left, one), _mm_and_si128(self, one)), _mm_and_si128(right, one));
+        
+        _mm_storeu_si128((__m128i *)(walls + x), _mm_or_si128(sum, _mm_and_si128(self, self_mask)));
+    }
+#endif
+
+    for (; x < width; ++x)
+        walls[x] = ((masks[x - 1] & 1) + (masks[x] & 1) + (masks[x + 1] & 1)) | (masks[x] & 4);
 }
 
-void grid_set_solid(Grid *grid, short x, short y, BOOL solid) {
+// Sets the distance from each tile of a row to the nearest solid tile in the row.
+// The masks must be readable GRID_MAX_CLEARANCE - 1 tiles past each end.
+static void find_row_distances(unsigned char *distances, const unsigned char *masks, int width) {
+    int x = 0, dx;
+
+#ifdef __SSE2__
+    const __m128i maximum = _mm_set1_epi8(GRID_MAX_CLEARANCE);
+    
+    for (; x + 16 <= width; x += 16) {
+        __m128i self = _mm_loadu_si128((const __m128i *)(masks + x));
+        __m128i distance = _mm_andnot_si128(self, maximum);
+        
+        // A solid tile dx away gives dx, anything else gives the maximum.
+        for (dx = 1; dx < GRID_MAX_CLEARANCE; ++dx) {
+            __m128i solid = _mm_or_si128(_mm_loadu_si128((const __m128i *)(masks + x - dx)),
+                                         _mm_loadu_si128((const __m128i *)(masks + x + dx)));
+            __m128i candidate = _mm_or_si128(_mm_and_si128(solid, _mm_set1_epi8(dx)), _mm_andnot_si128(solid, maximum));
+            
+            distance = _mm_min_epu8(distance, candidate);
+        }
+        
+        _mm_storeu_si128((__m128i *)(distances + x), distance);
+    }
+#endif
+
+    for (; x < width; ++x) {
+        unsigned char distance = masks[x] ? 0 : GRID_MAX_CLEARANCE;
+        
+        for (dx = 1; dx < distance; ++dx) {
+            if (masks[x - dx] || masks[x + dx])
+                distance = dx;
+        }
+        
+        distances[x] = distance;
+    }
+}
+
+// Fills the solid plane, row distances and row walls of the thread's rows.
+static void *build_rows(void *arg) {
+    enum { PADDING = GRID_MAX_CLEARANCE };
+    GridBuildThread *thread = arg;
+    GridBuild *build = thread->build;
+    Grid *grid = build->grid;
+    int width = grid->width;
+    unsigned char *buffer = malloc(grid->row_words * 64 + PADDING * 2);
+    unsigned char *masks = buffer + PADDING;
+    int x, y, w;
+    
+    // Nothing off either end of the row is solid.
+    memset(buffer, 0, grid->row_words * 64 + PADDING * 2);
+    
+    for (y = thread->first_row; y < grid->height; y += build->threads) {
+        const unsigned char *tiles = build->tiles + y * width;
+        uint64_t *solid = grid->solid + y * grid->row_words;
+        
+        for (x = 0; x < width; ++x)
+            masks[x] = build->masks[tiles[x]];
+        
+        for (w = 0; w < grid->row_words; ++w)
+            solid[w] = pack_word(masks + w * 64);
+        
+        sum_row_walls(build->row_walls + y * width, masks, width);
+        find_row_distances(build->row_distances + y * width, masks, width);
+    }
+    
+    free(buffer);
+    
+    return NULL;
+}
+
+// Fills the near wall plane, wall counts and clearance of the thread's rows from the first pass.
+static void *build_neighbors(void *arg) {
+    GridBuildThread *thread = arg;
+    GridBuild *build = thread->build;
+    Grid *grid = build->grid;
+    int width = grid->width;
+    int y, w, dy;
+    
+    for (y = thread->first_row; y < grid->height; y += build->threads) {
+        const uint64_t *above = y > 0 ? grid->solid + (y - 1) * grid->row_words : NULL;
+        const uint64_t *row = grid->solid + y * grid->row_words;
+        const uint64_t *below = y < grid->height - 1 ? grid->solid + (y + 1) * grid->row_words : NULL;
+        const unsigned char *walls = build->row_walls + y * width;
+        uint64_t *near_wall = grid->near_wall + y * grid->row_words;
+        unsigned char *count = grid->wall_count + y * width;
+        unsigned char *clearance = grid->clearance + y * width;
+        
+        // A tile is near a wall if a wall is above or below it, or beside any of the three.
+        for (w = 0; w < grid->row_words; ++w) {
+            uint64_t vertical = (above ? above[w] : 0) | (below ? below[w] : 0);
+            uint64_t column = vertical | row[w];
+            uint64_t previous = 0, next = 0;
+            
+            if (w > 0)
+                previous = (above ? above[w - 1] : 0) | row[w - 1] | (below ? below[w - 1] : 0);
+            if (w < grid->row_words - 1)
+                next = (above ? above[w + 1] : 0) | row[w + 1] | (below ? below[w + 1] : 0);
+            
+            near_wall[w] = vertical | (column << 1) | (previous >> 63) | (column >> 1) | (next << 63);
+        }
+        
+        // Nothing past the end of the row is solid, so only the last bit can spill over.
+        if (width & 63)
+            near_wall[grid->row_words - 1] &= ((uint64_t)1 << (width & 63)) - 1;
+        
+        // The walls around a tile are the walls of the three rows around it, less the tile itself.
+        count_row_walls(count, walls, width);
+        
+        for (dy = -1; dy <= 1; dy += 2) {
+            if (y + dy >= 0 && y + dy < grid->height)
+                add_row_walls(count, build->row_walls + (y + dy) * width, width);
+        }
+        
+        // The nearest wall in the rows dy away is max(dy, its distance in that row).
+        memcpy(clearance, build->row_distances + y * width, width);
+        
+        for (dy = 1 - GRID_MAX_CLEARANCE; dy < GRID_MAX_CLEARANCE; ++dy) {
+            if (dy != 0 && y + dy >= 0 && y + dy < grid->height)
+                min_row_distances(clearance, build->row_distances + (y + dy) * width, dy < 0 ? -dy : dy, width);
+        }
+    }
+    
+    return NULL;
+}
+
+// Runs a pass over every row, split between the threads. Runs on the calling thread if they can't be started.
+static void run_build_pass(GridBuild *build, void *(*run)(void *)) {
+    pthread_t handles[GRID_MAX_BUILD_THREADS];
+    GridBuildThread threads[GRID_MAX_BUILD_THREADS];
+    int started = 0, i;
+    
+    for (i = 0; i < build->threads; ++i) {
+        threads[i].build = build;
+        threads[i].first_row = i;
+    }
+    
+    for (i = 1; i < build->threads; ++i) {
+        if (pthread_create(&handles[i], NULL, run, &threads[i]) != 0) break;
+        ++started;
+    }
+    
+    run(&threads[0]);
+    
+    // Rows of threads that didn't start are built here.
+    for (i = started + 1; i < build->threads; ++i)
+        run(&threads[i]);
+    
+    for (i = 1; i <= started; ++i)
+        pthread_join(handles[i], NULL);
+}
+
+void grid_build(Grid *grid, const unsigned char *tiles, const unsigned char *solid_types, int threads) {
+    GridBuild build;
     int i;
     
-    grid_get_node(grid, x, y)->solid = solid;
+    if (threads < 1) threads = 1;
+    if (threads > GRID_MAX_BUILD_THREADS) threads = GRID_MAX_BUILD_THREADS;
+    
+    build.grid = grid;
+    build.tiles = tiles;
+    build.threads = threads;
+    build.row_distances = malloc(grid->width * grid->height);
+    build.row_walls = malloc(grid->width * grid->height);
+    
+    for (i = 0; i < 256; ++i)
+        build.masks[i] = solid_types[i] ? 0xFF : 0;
+    
+    // The second pass reads the rows around each row, so every row has to finish the first one.
+    run_build_pass(&build, build_rows);
+    run_build_pass(&build, build_neighbors);
+    
+    free(build.row_distances);
+    free(build.row_walls);
+    
+    // Starting after 0 keeps tables that were never built from looking current.
+    grid->epoch = 1;
+}
+
+// Allocate memory for the planes. Every tile starts out empty.
+void grid_initialize(Grid *grid, short width, short height) {
+    grid->width = width;
+    grid->height = height;
+    grid->row_words = (width + 63) / 64;
+    grid->epoch = 0;
+    grid->mapped = FALSE;
+    
+    grid->solid = calloc(grid->row_words * height, sizeof(uint64_t));
+    grid->near_wall = calloc(grid->row_words * height, sizeof(uint64_t));
+    grid->wall_count = calloc(width * height, sizeof(unsigned char));
+    grid->clearance = malloc(width * height);
+    memset(grid->clearance, GRID_MAX_CLEARANCE, width * height);
+    grid->changes = malloc(sizeof(int) * GRID_CHANGE_LOG);
+}
+
+void grid_copy(Grid *dest, const Grid *src) {
+    memcpy(dest->solid, src->solid, src->row_words * src->height * sizeof(uint64_t));
+    memcpy(dest->near_wall, src->near_wall, src->row_words * src->height * sizeof(uint64_t));
+    memcpy(dest->wall_count, src->wall_count, src->width * src->height);
+    memcpy(dest->clearance, src->clearance, src->width * src->height);
+    memcpy(dest->changes, src->changes, sizeof(int) * GRID_CHANGE_LOG);
+    dest->epoch = src->epoch;
+}
+
+void grid_free(Grid *grid) {
+    if (!grid->mapped) {
+        free(grid->solid);
+        free(grid->near_wall);
+        free(grid->wall_count);
+        free(grid->clearance);
+    }
+    
+    free(grid->changes);
+    grid->solid = NULL;
+    grid->near_wall = NULL;
+    grid->wall_count = NULL;
+    grid->clearance = NULL;
+    grid->changes = NULL;
+}
+
+int grid_memory_usage(Grid *grid) {
+    return 2 * grid->row_words * grid->height * sizeof(uint64_t) + 2 * grid->width * grid->height + sizeof(int) * GRID_CHANGE_LOG;
+}
+
+BOOL grid_set_solid(Grid *grid, short x, short y, BOOL solid) {
+    int i;
+    
+    if (grid_is_solid(grid, x, y) == !!solid) return FALSE;
+    
+    ++grid->epoch;
+    grid->changes[grid->epoch % GRID_CHANGE_LOG] = y * grid->width + x;
     
     if (solid) {
-        for (i = 0; i < 8; ++i) {
-            short nx = x + directions[i].x;
-            short ny = y + directions[i].y;
-            
-            if (grid_is_valid(grid, nx, ny))
-                grid_get_node(grid, nx, ny)->near_wall = TRUE;
+        set_bit(grid, grid->solid, x, y);
+        add_clearance(grid, x, y);
+    } else {
+        clear_bit(grid, grid->solid, x, y);
+        repair_clearance(grid, x, y);
+    }
+    
+    // Count the walls around each neighbor so removing one wall doesn't clear the
+    // near wall state of a tile that's still next to another wall.
+    for (i = 0; i < 8; ++i) {
+        short nx = x + directions[i].x;
+        short ny = y + directions[i].y;
+        unsigned char *count;
+        
+        if (!grid_is_valid(grid, nx, ny)) continue;
+        
+        count = &grid->wall_count[ny * grid->width + nx];
+        
+        if (solid) {
+            if ((*count)++ == 0)
+                set_bit(grid, grid->near_wall, nx, ny);
+        } else {
+            if (--(*count) == 0)
+                clear_bit(grid, grid->near_wall, nx, ny);
         }
     }
+    
+    return TRUE;
 }
 
-// Gets only the valid/open neighbors.
-NodeNeighbors grid_get_neighbors(Grid *grid, Node *node) {
-    NodeNeighbors neighbors;
+// Gets only the valid neighbors that have enough clearance.
+GridNeighbors grid_get_neighbors(const Grid *grid, short x, short y, int clearance) {
+    GridNeighbors neighbors;
     int i;
     
     neighbors.count = 0;
     
     for (i = 0; i < 8; ++i) {
-        int nx = node->x + directions[i].x;
-        int ny = node->y + directions[i].y;
+        short nx = x + directions[i].x;
+        short ny = y + directions[i].y;
         
-        neighbors.neighbors[i] = NULL;
-        
-        if (grid_is_open(grid, nx, ny))
-            neighbors.neighbors[neighbors.count++] = grid_get_node(grid, nx, ny);
+        if (grid_is_clear(grid, nx, ny, clearance)) {
+            neighbors.neighbors[neighbors.count].x = nx;
+            neighbors.neighbors[neighbors.count].y = ny;
+            ++neighbors.count;
+        }
     }
     
     return neighbors;
@@ -1,6 +1,8 @@
 #ifndef GRID_H_
 #define GRID_H_
 
+#include <stdint.h>
+
 #ifndef BOOL
 #define BOOL int
 #endif
@@ -13,7 +15,21 @@
 #define FALSE 0
 #endif
 
-/** Represents a tile in the level graph. */
+/** The number of tile changes that a grid remembers. */
+#define GRID_CHANGE_LOG 1024
+
+/** The clearance of a tile that grid_is_open accepts: no solid tile next to it. */
+#define GRID_OPEN_CLEARANCE 2
+
+/** The most clearance a tile is given. Tiles farther from every wall are stored as this. */
+#define GRID_MAX_CLEARANCE 8
+
+/** The most threads that grid_build splits rows between. */
+#define GRID_MAX_BUILD_THREADS 16
+
+/** Pathing state for a tile.
+ * These are kept separate from the grid so the grid only holds static map data.
+ */
 typedef struct Node {
     /** The x tile in the level. */
     short x;
@@ -21,9 +37,6 @@ typedef struct Node {
     /** The y tile in the level. */
     short y;
     
-    /** TRUE if solid, FALSE otherwise. */
-    BOOL solid;
-    
     /** Parent node. Used during pathfinding. */
     struct Node *parent;
     
@@ -33,20 +46,58 @@ typedef struct Node {
     /** TRUE if this node was closed during pathing, FALSE otherwise. */
     BOOL closed;
     
-    /** TRUE if this node is near a wall, FALSE otherwise. */
-    BOOL near_wall;
-    
     /** The cost of getting to this node from the starting node. */
     int g;
     
     /** The heuristic value for reaching the goal node from this node. */
     int h;
+    
+    /** The index of this node in its search. Used as its index in the open set. */
+    int index;
 } Node;
 
-/** A grid of nodes for pathing. */
+/** A tile position in the grid. */
+typedef struct GridPosition {
+    /** The x tile in the level. */
+    short x;
+    
+    /** The y tile in the level. */
+    short y;
+} GridPosition;
+
+/** The walkability data of a level.
+ * Each plane stores one bit per tile in rows of 64-bit words.
+ */
 typedef struct Grid {
-    /** The list of nodes. (width * height) */
-    Node *nodes;
+    /** Bit plane of solid tiles. */
+    uint64_t *solid;
+    
+    /** Bit plane of tiles that are next to a solid tile. */
+    uint64_t *near_wall;
+    
+    /** The number of solid tiles around each tile. (width * height)
+     * The near_wall bit of a tile is set while its count is above 0, so walls can be removed again.
+     */
+    unsigned char *wall_count;
+    
+    /** The distance from each tile to the nearest solid tile, up to GRID_MAX_CLEARANCE. (width * height)
+     * Distances are in tiles and count diagonal steps as 1, so solid tiles are 0 and the tiles next to them are 1.
+     */
+    unsigned char *clearance;
+    
+    /** TRUE if the planes, wall counts and clearance point into a mapped cache file instead of being allocated. */
+    BOOL mapped;
+    
+    /** The tiles that changed most recently, as y * width + x. (GRID_CHANGE_LOG)
+     * The tile that changed to move the grid to epoch E is at E % GRID_CHANGE_LOG.
+     */
+    int *changes;
+    
+    /** The number of words in each row of a plane. */
+    int row_words;
+    
+    /** Incremented every time a tile changes. Used to invalidate data built from the grid or to repair it with grid_get_change. */
+    unsigned int epoch;
     
     /** The width of the grid. (1024) */
     short width;
@@ -55,50 +106,80 @@ typedef struct Grid {
     short height;
 } Grid;
 
-/** A structure for storing node neighbors. */
+/** A structure for storing tile neighbors. */
 typedef struct {
     /** A buffer to store the list of neighbors. */
-    Node* neighbors[8];
+    GridPosition neighbors[8];
     
     /** The number of neighbors. */
     int count;
-} NodeNeighbors;
+} GridNeighbors;
 
-/** Initialize the grid. 
+/** Initialize the grid.
  * @param grid The grid to initialize.
  * @param width The width of the grid. (1024)
  * @param height The height of the grid. (1024)
  */
 void grid_initialize(Grid *grid, short width, short height);
 
-/** Free the node memory that the grid is using. 
- * @param grid The grid whose nodes should be freed.
+/** Fills an empty grid from the tile types of a whole map at once.
+ * Much faster than setting each solid tile: tiles are classified 64 at a time and the near wall
+ * state, wall counts and clearance are computed a row at a time, with the rows split between threads.
+ * The grid ends up at epoch 1 with nothing in its change log.
+ * @param grid The grid. Must be initialized and empty.
+ * @param tiles The tile type of every tile, row by row. (width * height)
+ * @param solid_types Non-zero for each tile type that's solid. (256)
+ * @param threads The number of threads to build with, up to GRID_MAX_BUILD_THREADS. 1 builds on the calling thread.
+ */
+void grid_build(Grid *grid, const unsigned char *tiles, const unsigned char *solid_types, int threads);
+
+/** Free the plane memory that the grid is using. Mapped planes are left for the cache to unmap.
+ * @param grid The grid whose planes should be freed.
  */
 void grid_free(Grid *grid);
 
-/** Returns a node.
+/** Copies the tiles of a grid into another grid of the same size.
+ * @param dest The grid to copy into. Must be initialized.
+ * @param src The grid to copy
+ */
+void grid_copy(Grid *dest, const Grid *src);
+
+/** Returns the number of bytes used by the grid planes.
+ * @param grid The grid
+ * @return the size of the planes, wall counts, clearance and change log in bytes.
+ */
+int grid_memory_usage(Grid *grid);
+
+/** Return whether or not the position is inside of the grid.
  * @param grid The grid
  * @param x The x position
  * @param y The y position
- * @return the node that was specified.
+ * @return TRUE if the grid is valid, FALSE otherwise.
  */
-Node* grid_get_node(Grid *grid, short x, short y);
+static inline BOOL grid_is_valid(const Grid *grid, int x, int y) {
+    return (unsigned)x < (unsigned)grid->width && (unsigned)y < (unsigned)grid->height;
+}
 
-/** Return whether or not the grid is a solid tile.
+/** Return the bit of a plane for a position. The position must be valid.
  * @param grid The grid
+ * @param plane The plane to read
  * @param x The x position
  * @param y The y position
- * @return TRUE if the grid is solid, FALSE otherwise.
+ * @return TRUE if the bit is set, FALSE otherwise.
  */
-BOOL grid_is_solid(Grid *grid, short x, short y);
+static inline BOOL grid_test_bit(const Grid *grid, const uint64_t *plane, int x, int y) {
+    return (plane[y * grid->row_words + (x >> 6)] >> (x & 63)) & 1;
+}
 
-/** Return whether or not the grid is valid.
+/** Return whether or not the grid is a solid tile.
  * @param grid The grid
  * @param x The x position
  * @param y The y position
- * @return TRUE if the grid is valid, FALSE otherwise.
+ * @return TRUE if the grid is solid, FALSE otherwise.
  */
-BOOL grid_is_valid(Grid *grid, short x, short y);
+static inline BOOL grid_is_solid(const Grid *grid, int x, int y) {
+    return grid_test_bit(grid, grid->solid, x, y);
+}
 
 /** Return whether or not that grid is an open space (not near wall)
  * @param grid The grid
@@ -106,21 +187,76 @@ BOOL grid_is_valid(Grid *grid, short x, short y);
  * @param y The y position
  * @return TRUE if the grid is open, FALSE otherwise.
  */
-BOOL grid_is_open(Grid *grid, short x, short y);
+static inline BOOL grid_is_open(const Grid *grid, int x, int y) {
+    int index, shift;
+
+    if (!grid_is_valid(grid, x, y)) return FALSE;
+    
+    index = y * grid->row_words + (x >> 6);
+    shift = x & 63;
+    
+    return !(((grid->solid[index] | grid->near_wall[index]) >> shift) & 1);
+}
+
+/** Return whether or not a ship that needs some room from walls fits on a tile.
+ * @param grid The grid
+ * @param x The x position
+ * @param y The y position
+ * @param clearance The distance in tiles that the ship needs from every solid tile.
+ *        GRID_OPEN_CLEARANCE or less is the same as grid_is_open.
+ * @return TRUE if the tile is far enough from every wall, FALSE otherwise.
+ */
+static inline BOOL grid_is_clear(const Grid *grid, int x, int y, int clearance) {
+    if (clearance <= GRID_OPEN_CLEARANCE) return grid_is_open(grid, x, y);
+    if (!grid_is_valid(grid, x, y)) return FALSE;
+    
+    return grid->clearance[y * grid->width + x] >= clearance;
+}
 
-/** Sets the solid state of a node.
+/** Returns the clearance that a ship needs to fly over tiles without touching walls.
+ * Paths go through tile centers, so a wall that's d tiles away is (d - 0.5) * 16 pixels from the ship.
+ * Ships never get less room than open tiles give them.
+ * @param radius The radius of the ship in pixels
+ * @return the clearance to search with, from GRID_OPEN_CLEARANCE to GRID_MAX_CLEARANCE.
+ */
+static inline int grid_clearance_for_radius(int radius) {
+    int clearance = (radius + 8) / 16 + 1;
+    
+    if (clearance < GRID_OPEN_CLEARANCE) return GRID_OPEN_CLEARANCE;
+    if (clearance > GRID_MAX_CLEARANCE) return GRID_MAX_CLEARANCE;
+    
+    return clearance;
+}
+
+/** Sets the solid state of a tile and updates the near wall state and clearance of the tiles around it.
+ * The epoch is incremented if the tile changed.
  * @param grid The grid
  * @param x The x position
  * @param y The y position
- * @param solid The solid state of the node
+ * @param solid The solid state of the tile
+ * @return TRUE if the tile changed, FALSE if it already had that state.
+ */
+BOOL grid_set_solid(Grid *grid, short x, short y, BOOL solid);
+
+/** Returns the tile whose change moved the grid to an epoch.
+ * Data built from an older epoch can walk the epochs up to the current one to find every tile that changed.
+ * @param grid The grid
+ * @param epoch The epoch. Must be after the first epoch and no later than the current one.
+ * @return the tile as y * width + x, or -1 if the change is too old to be remembered.
  */
-void grid_set_solid(Grid *grid, short x, short y, BOOL solid);
+static inline int grid_get_change(const Grid *grid, unsigned int epoch) {
+    if (epoch == 0 || epoch > grid->epoch || grid->epoch - epoch >= GRID_CHANGE_LOG) return -1;
+    
+    return grid->changes[epoch % GRID_CHANGE_LOG];
+}
 
-/** Returns all of the neighbors of a node.
+/** Returns all of the neighbors of a tile that a ship fits on.
  * @param grid The grid
- * @param node The node whose neighbors should be found
- * @return the node's neighbors.
+ * @param x The x position of the tile
+ * @param y The y position of the tile
+ * @param clearance The clearance that the ship needs. See grid_is_clear.
+ * @return the tile's neighbors.
  */
-NodeNeighbors grid_get_neighbors(Grid *grid, Node *node);
+GridNeighbors grid_get_neighbors(const Grid *grid, short x, short y, int clearance);
 
 #endif
@@ -0,0 +1,298 @@
+#include "grid_cache.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The sections that a file can have besides the grid.
+#define SECTION_JUMP_TABLE 1
+#define SECTION_COMPONENTS 2
+#define SECTION_HIERARCHY 4
+
+static const char magic[4] = { 'M', 'P', 'G', 'C' };
+
+// The start of every file. The sections follow in a fixed order, each padded to 8 bytes.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t checksum;
+    uint32_t epoch;
+    int16_t width;
+    int16_t height;
+    uint32_t sections;
+    int32_t component_count;
+    int32_t cluster_size;
+    int32_t node_count;
+    int32_t edge_count;
+    uint64_t size;
+} CacheHeader;
+
+// Where each section starts in a file. 0 if the file doesn't have it.
+typedef struct {
+    size_t solid, near_wall, wall_count, clearance;
+    size_t labels;
+    size_t distances;
+    size_t cluster_first, cluster_nodes, nodes, edges;
+    size_t size;
+} CacheLayout;
+
+static size_t padded(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+static int cluster_count(int width, int height, int cluster_size) {
+    return ((width + cluster_size - 1) / cluster_size) * ((height + cluster_size - 1) / cluster_size);
+}
+
+static void get_layout(const CacheHeader *header, CacheLayout *layout) {
+    size_t tiles = (size_t)header->width * header->height;
+    size_t plane = sizeof(uint64_t) * ((header->width + 63) / 64) * header->height;
+    size_t offset = sizeof(CacheHeader);
+    
+    memset(layout, 0, sizeof(CacheLayout));
+    
+    layout->solid = offset;
+    offset += padded(plane);
+    layout->near_wall = offset;
+    offset += padded(plane);
+    layout->wall_count = offset;
+    offset += padded(tiles);
+    layout->clearance = offset;
+    offset += padded(tiles);
+    
+    if (header->sections & SECTION_COMPONENTS) {
+        layout->labels = offset;
+        offset += padded(sizeof(int) * tiles);
+    }
+    
+    if (header->sections & SECTION_JUMP_TABLE) {
+        layout->distances = offset;
+        offset += padded(sizeof(short) * tiles * 8);
+    }
+    
+    if (header->sections & SECTION_HIERARCHY) {
+        layout->cluster_first = offset;
+        offset += padded(sizeof(int) * (cluster_count(header->width, header->height, header->cluster_size) + 1));
+        layout->cluster_nodes = offset;
+        offset += padded(sizeof(int) * header->node_count);
+        layout->nodes = offset;
+        offset += padded(sizeof(HierarchyNode) * header->node_count);
+        layout->edges = offset;
+        offset += padded(sizeof(HierarchyEdge) * header->edge_count);
+    }
+    
+    layout->size = offset;
+}
+
+// FNV-1a over every byte of the file.
+uint32_t grid_cache_checksum(const char *filename) {
+    unsigned char buffer[4096];
+    uint32_t hash = 2166136261u;
+    FILE *file = fopen(filename, "rb");
+    size_t count, i;
+    
+    if (!file) return 0;
+    
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        for (i = 0; i < count; ++i) {
+            hash ^= buffer[i];
+            hash *= 16777619u;
+        }
+    }
+    
+    fclose(file);
+    
+    // 0 means there's no checksum.
+    return hash ? hash : 1;
+}
+
+BOOL grid_cache_load(GridCache *cache, const char *filename, uint32_t checksum, Grid *grid,
+    JumpTable *table, ComponentMap *components, Hierarchy *hierarchy, int cluster_size) {
+    const CacheHeader *header;
+    CacheLayout layout;
+    struct stat st;
+    char *data;
+    int fd, i;
+    
+    cache->data = NULL;
+    cache->size = 0;
+    
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) return FALSE;
+    
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return FALSE;
+    }
+    
+    // Private so tiles can change in memory. Pages are only copied once they're written.
+    data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    
+    if (data == MAP_FAILED) return FALSE;
+    
+    header = (const CacheHeader *)data;
+    
+    if (memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != GRID_CACHE_VERSION ||
+        header->checksum != checksum || header->width <= 0 || header->height <= 0 ||
+        ((header->sections & SECTION_HIERARCHY) && header->cluster_size <= 0)) {
+        munmap(data, st.st_size);
+        return FALSE;
+    }
+    
+    get_layout(header, &layout);
+    
+    if (header->size != (uint64_t)st.st_size || layout.size != (size_t)st.st_size) {
+        munmap(data, st.st_size);
+        return FALSE;
+    }
+    
+    cache->data = data;
+    cache->size = st.st_size;
+    
+    grid->width = header->width;
+    grid->height = header->height;
+    grid->row_words = (header->width + 63) / 64;
+    grid->epoch = header->epoch;
+    grid->solid = (uint64_t *)(data + layout.solid);
+    grid->near_wall = (uint64_t *)(data + layout.near_wall);
+    grid->wall_count = (unsigned char *)(data + layout.wall_count);
+    grid->clearance = (unsigned char *)(data + layout.clearance);
+    grid->changes = malloc(sizeof(int) * GRID_CHANGE_LOG);
+    grid->mapped = TRUE;
+    
+    if (table && layout.distances) {
+        table->distances = (short *)(data + layout.distances);
+        table->width = grid->width;
+        table->height = grid->height;
+        table->epoch = grid->epoch;
+        table->mapped = TRUE;
+    }
+    
+    if (components && layout.labels) {
+        // Every saved label is its own region, so only the labels are stored.
+        components->labels = (int *)(data + layout.labels);
+        components->count = header->component_count;
+        components->capacity = components->count + 1;
+        components->parents = malloc(sizeof(int) * components->capacity);
+        for (i = 0; i < components->capacity; ++i)
+            components->parents[i] = i;
+        components->width = grid->width;
+        components->height = grid->height;
+        components->epoch = grid->epoch;
+        components->mapped = TRUE;
+    }
+    
+    if (hierarchy && layout.nodes && header->cluster_size == cluster_size) {
+        memset(hierarchy, 0, sizeof(Hierarchy));
+        hierarchy->cluster_size = cluster_size;
+        hierarchy->clusters_x = (grid->width + cluster_size - 1) / cluster_size;
+        hierarchy->clusters_y = (grid->height + cluster_size - 1) / cluster_size;
+        hierarchy->cluster_first = (int *)(data + layout.cluster_first);
+        hierarchy->cluster_nodes = (int *)(data + layout.cluster_nodes);
+        hierarchy->nodes = (HierarchyNode *)(data + layout.nodes);
+        hierarchy->node_count = header->node_count;
+        hierarchy->edges = (HierarchyEdge *)(data + layout.edges);
+        hierarchy->edge_count = header->edge_count;
+        hierarchy->epoch = grid->epoch;
+        hierarchy->mapped = TRUE;
+    }
+    
+    return TRUE;
+}
+
+// Writes a section and pads it to 8 bytes.
+static BOOL write_section(FILE *file, const void *data, size_t size) {
+    static const char zeros[8] = { 0 };
+    size_t padding = padded(size) - size;
+    
+    if (size > 0 && fwrite(data, 1, size, file) != size) return FALSE;
+    
+    return padding == 0 || fwrite(zeros, 1, padding, file) == padding;
+}
+
+BOOL grid_cache_save(const char *filename, uint32_t checksum, const Grid *grid,
+    const JumpTable *table, const ComponentMap *components, const Hierarchy *hierarchy) {
+    size_t tiles = (size_t)grid->width * grid->height;
+    size_t plane = sizeof(uint64_t) * grid->row_words * grid->height;
+    CacheHeader header;
+    CacheLayout layout;
+    char temp[PATH_MAX];
+    int length;
+    FILE *file;
+    BOOL ok;
+    
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = GRID_CACHE_VERSION;
+    header.checksum = checksum;
+    header.epoch = grid->epoch;
+    header.width = grid->width;
+    header.height = grid->height;
+    
+    if (table && table->distances)
+        header.sections |= SECTION_JUMP_TABLE;
+    
+    if (components && components->labels) {
+        header.sections |= SECTION_COMPONENTS;
+        header.component_count = components->count;
+    }
+    
+    if (hierarchy && hierarchy->nodes) {
+        header.sections |= SECTION_HIERARCHY;
+        header.cluster_size = hierarchy->cluster_size;
+        header.node_count = hierarchy->node_count;
+        header.edge_count = hierarchy->edge_count;
+    }
+    
+    get_layout(&header, &layout);
+    header.size = layout.size;
+    
+    // A cut off name could overwrite another file.
+    length = snprintf(temp, sizeof(temp), "%s.tmp", filename);
+    if (length < 0 || length >= (int)sizeof(temp)) return FALSE;
+    
+    file = fopen(temp, "wb");
+    if (!file) return FALSE;
+    
+    ok = write_section(file, &header, sizeof(header)) &&
+         write_section(file, grid->solid, plane) &&
+         write_section(file, grid->near_wall, plane) &&
+         write_section(file, grid->wall_count, tiles) &&
+         write_section(file, grid->clearance, tiles);
+    
+    if (ok && layout.labels)
+        ok = write_section(file, components->labels, sizeof(int) * tiles);
+    
+    if (ok && layout.distances)
+        ok = write_section(file, table->distances, sizeof(short) * tiles * 8);
+    
+    if (ok && layout.nodes) {
+        int clusters = hierarchy->clusters_x * hierarchy->clusters_y;
+        
+        ok = write_section(file, hierarchy->cluster_first, sizeof(int) * (clusters + 1)) &&
+             write_section(file, hierarchy->cluster_nodes, sizeof(int) * hierarchy->node_count) &&
+             write_section(file, hierarchy->nodes, sizeof(HierarchyNode) * hierarchy->node_count) &&
+             write_section(file, hierarchy->edges, sizeof(HierarchyEdge) * hierarchy->edge_count);
+    }
+    
+    if (fclose(file) != 0) ok = FALSE;
+    
+    if (ok && rename(temp, filename) != 0) ok = FALSE;
+    
+    if (!ok) remove(temp);
+    
+    return ok;
+}
+
+void grid_cache_close(GridCache *cache) {
+    if (cache->data)
+        munmap(cache->data, cache->size);
+    
+    cache->data = NULL;
+    cache->size = 0;
+}
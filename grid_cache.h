@@ -0,0 +1,68 @@
+#ifndef GRID_CACHE_H_
+#define GRID_CACHE_H_
+
+#include "components.h"
+#include "grid.h"
+#include "hierarchy.h"
+#include "jumptable.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/** Increment when the layout of the file or of anything stored in it changes. */
+#define GRID_CACHE_VERSION 2
+
+/** A cache file of a map's grid and the tables built from it, mapped into memory.
+ * The file is mapped privately, so the grid and regions can still be changed in memory
+ * without touching the file. Anything loaded from it points into the mapping and is
+ * marked as mapped, so the mapping must outlive it.
+ */
+typedef struct GridCache {
+    /** The start of the mapping. NULL if nothing is mapped. */
+    void *data;
+    
+    /** The size of the mapping in bytes. */
+    size_t size;
+} GridCache;
+
+/** Returns a checksum of a map file's contents, for naming and checking cache files.
+ * @param filename The map file
+ * @return the checksum, or 0 if the file couldn't be read.
+ */
+uint32_t grid_cache_checksum(const char *filename);
+
+/** Maps a cache file and points the grid and tables into it.
+ * Only the tables that are passed in are loaded. A table that isn't in the file is left
+ * empty, so the caller can build it and save the file again.
+ * @param cache The cache to map the file into
+ * @param filename The file to load
+ * @param checksum The checksum of the map. The file is ignored if it was saved for another map.
+ * @param grid The grid to load. Must not be initialized.
+ * @param table The jump table to load. NULL to skip it.
+ * @param components The regions to load. NULL to skip them.
+ * @param hierarchy The hierarchy to load. NULL to skip it.
+ * @param cluster_size The cluster size of the hierarchy. A hierarchy with other clusters isn't loaded.
+ * @return TRUE if the grid was loaded, FALSE if the file is missing, out of date or for another map.
+ */
+BOOL grid_cache_load(GridCache *cache, const char *filename, uint32_t checksum, Grid *grid,
+    JumpTable *table, ComponentMap *components, Hierarchy *hierarchy, int cluster_size);
+
+/** Writes a cache file of a grid and the tables built from it.
+ * The file is written next to its final name and then renamed over it, so a mapping of the
+ * old file is never changed underneath and a crash never leaves half of a file.
+ * @param filename The file to write
+ * @param checksum The checksum of the map
+ * @param grid The grid. Must not have changed since the map was loaded.
+ * @param table The jump table. NULL or empty to leave it out.
+ * @param components The regions. Must not have been updated since they were built. NULL to leave them out.
+ * @param hierarchy The hierarchy. NULL to leave it out.
+ * @return TRUE if the file was written, FALSE otherwise.
+ */
+BOOL grid_cache_save(const char *filename, uint32_t checksum, const Grid *grid,
+    const JumpTable *table, const ComponentMap *components, const Hierarchy *hierarchy);
+
+/** Unmaps a cache file. Anything that was loaded from it must be freed first.
+ * @param cache The cache
+ */
+void grid_cache_close(GridCache *cache);
+
+#endif
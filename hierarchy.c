@@ -0,0 +1,715 @@
+#include "hierarchy.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Entrances wider than this get a node at each end instead of one in the middle.
+#define MAX_ENTRANCE_WIDTH 6
+
+// Used as offsets for cluster searches.
+static GridPosition directions[8] = {
+    { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 },
+    { -1, -1 }, { 1, -1 }, { -1, 1 }, { 1, 1 }
+};
+
+// An edge that is collected while building.
+typedef struct {
+    int from;
+    int to;
+    int cost;
+} BuildEdge;
+
+typedef struct {
+    BuildEdge *edges;
+    int count;
+    int capacity;
+} BuildEdges;
+
+// A binary heap of (key, value) pairs stored next to each other in an int array.
+static void heap_push(int **heap, int *count, int *capacity, int key, int value) {
+    int *b;
+    int n = (*count)++;
+    
+    if (*count > *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *heap = realloc(*heap, sizeof(int) * 2 * *capacity);
+    }
+    
+    b = *heap;
+    
+    while (n > 0) {
+        int m = (n - 1) / 2;
+        if (b[m * 2] <= key) break;
+        b[n * 2] = b[m * 2];
+        b[n * 2 + 1] = b[m * 2 + 1];
+        n = m;
+    }
+    
+    b[n * 2] = key;
+    b[n * 2 + 1] = value;
+}
+
+// Removes the pair with the lowest key and returns its value.
+static int heap_pop(int *heap, int *count, int *key) {
+    int value = heap[1];
+    int last_key, last_value;
+    int n = 0, m;
+    
+    *key = heap[0];
+    
+    --*count;
+    last_key = heap[*count * 2];
+    last_value = heap[*count * 2 + 1];
+    
+    while ((m = n * 2 + 1) < *count) {
+        if (m + 1 < *count && heap[(m + 1) * 2] < heap[m * 2]) ++m;
+        if (last_key <= heap[m * 2]) break;
+        heap[n * 2] = heap[m * 2];
+        heap[n * 2 + 1] = heap[m * 2 + 1];
+        n = m;
+    }
+    
+    heap[n * 2] = last_key;
+    heap[n * 2 + 1] = last_value;
+    
+    return value;
+}
+
+// The octile distance between two tiles.
+static int octile_distance(int x0, int y0, int x1, int y1) {
+    int dx = abs(x1 - x0);
+    int dy = abs(y1 - y0);
+    int low = dx < dy ? dx : dy;
+    int high = dx < dy ? dy : dx;
+    
+    return low * HIERARCHY_DIAGONAL_COST + (high - low) * HIERARCHY_STRAIGHT_COST;
+}
+
+static int cluster_of(const Hierarchy *hierarchy, int x, int y) {
+    return (y / hierarchy->cluster_size) * hierarchy->clusters_x + x / hierarchy->cluster_size;
+}
+
+// Runs Dijkstra from a tile without leaving its cluster.
+// cost receives the cost to each tile of the cluster, or -1 if it can't be reached.
+// The source tile is always passable so searches can start and end next to walls.
+static void search_cluster(const Hierarchy *hierarchy, const Grid *grid, int cluster, int sx, int sy, int *cost, int **heap, int *heap_capacity) {
+    int size = hierarchy->cluster_size;
+    int left = (cluster % hierarchy->clusters_x) * size;
+    int top = (cluster / hierarchy->clusters_x) * size;
+    int width = left + size > grid->width ? grid->width - left : size;
+    int height = top + size > grid->height ? grid->height - top : size;
+    int count = 0;
+    int i;
+    
+    for (i = 0; i < size * size; ++i)
+        cost[i] = -1;
+    
+    cost[(sy - top) * size + (sx - left)] = 0;
+    heap_push(heap, &count, heap_capacity, 0, (sy - top) * size + (sx - left));
+    
+    while (count > 0) {
+        int current_cost;
+        int index = heap_pop(*heap, &count, &current_cost);
+        int x = left + index % size;
+        int y = top + index / size;
+        
+        if (current_cost > cost[index]) continue;
+        
+        for (i = 0; i < 8; ++i) {
+            int dx = directions[i].x;
+            int dy = directions[i].y;
+            int nx = x + dx;
+            int ny = y + dy;
+            int step = HIERARCHY_STRAIGHT_COST;
+            int next;
+            
+            if (nx < left || nx >= left + width || ny < top || ny >= top + height) continue;
+            if (!grid_is_open(grid, nx, ny)) continue;
+            
+            if (dx != 0 && dy != 0) {
+                // Same rule as jump point search: one of the sides must be open.
+                if (!grid_is_open(grid, x + dx, y) && !grid_is_open(grid, x, y + dy)) continue;
+                step = HIERARCHY_DIAGONAL_COST;
+            }
+            
+            next = (ny - top) * size + (nx - left);
+            
+            if (cost[next] == -1 || current_cost + step < cost[next]) {
+                cost[next] = current_cost + step;
+                heap_push(heap, &count, heap_capacity, cost[next], next);
+            }
+        }
+    }
+}
+
+static void add_edge(BuildEdges *edges, int from, int to, int cost) {
+    if (edges->count >= edges->capacity) {
+        edges->capacity = edges->capacity ? edges->capacity * 2 : 1024;
+        edges->edges = realloc(edges->edges, sizeof(BuildEdge) * edges->capacity);
+    }
+    
+    edges->edges[edges->count].from = from;
+    edges->edges[edges->count].to = to;
+    edges->edges[edges->count].cost = cost;
+    ++edges->count;
+}
+
+// Returns the node at a tile, creating it if it doesn't exist yet.
+static int get_or_add_node(Hierarchy *hierarchy, int *tile_nodes, int *node_capacity, const Grid *grid, int x, int y) {
+    int *node = &tile_nodes[y * grid->width + x];
+    
+    if (*node != -1) return *node;
+    
+    if (hierarchy->node_count >= *node_capacity) {
+        *node_capacity = *node_capacity ? *node_capacity * 2 : 1024;
+        hierarchy->nodes = realloc(hierarchy->nodes, sizeof(HierarchyNode) * *node_capacity);
+    }
+    
+    *node = hierarchy->node_count++;
+    
+    hierarchy->nodes[*node].x = x;
+    hierarchy->nodes[*node].y = y;
+    hierarchy->nodes[*node].cluster = cluster_of(hierarchy, x, y);
+    hierarchy->nodes[*node].first_edge = 0;
+    hierarchy->nodes[*node].edge_count = 0;
+    
+    return *node;
+}
+
+// Adds the entrances of a segment of open tiles along a cluster border.
+// The segment is on the tiles (x, y) + i * (step_x, step_y) and the other side is offset by (cross_x, cross_y).
+static void add_entrances(Hierarchy *hierarchy, BuildEdges *edges, int *tile_nodes, int *node_capacity, const Grid *grid,
+                          int x, int y, int step_x, int step_y, int cross_x, int cross_y, int length) {
+    int offsets[2];
+    int count = 0;
+    int i;
+    
+    if (length <= 0) return;
+    
+    if (length < MAX_ENTRANCE_WIDTH) {
+        offsets[count++] = length / 2;
+    } else {
+        offsets[count++] = 0;
+        offsets[count++] = length - 1;
+    }
+    
+    for (i = 0; i < count; ++i) {
+        int ax = x + step_x * offsets[i];
+        int ay = y + step_y * offsets[i];
+        int a = get_or_add_node(hierarchy, tile_nodes, node_capacity, grid, ax, ay);
+        int b = get_or_add_node(hierarchy, tile_nodes, node_capacity, grid, ax + cross_x, ay + cross_y);
+        
+        add_edge(edges, a, b, HIERARCHY_STRAIGHT_COST);
+        add_edge(edges, b, a, HIERARCHY_STRAIGHT_COST);
+    }
+}
+
+// Finds the entrances along the border between a cluster and the cluster to its right or below it.
+static void build_border(Hierarchy *hierarchy, BuildEdges *edges, int *tile_nodes, int *node_capacity, const Grid *grid,
+                         int cluster_x, int cluster_y, BOOL vertical) {
+    int size = hierarchy->cluster_size;
+    int step_x = vertical ? 0 : 1;
+    int step_y = vertical ? 1 : 0;
+    int cross_x = vertical ? 1 : 0;
+    int cross_y = vertical ? 0 : 1;
+    int x = vertical ? (cluster_x + 1) * size - 1 : cluster_x * size;
+    int y = vertical ? cluster_y * size : (cluster_y + 1) * size - 1;
+    int length = vertical ? grid->height - y : grid->width - x;
+    int start = -1;
+    int i;
+    
+    if (length > size) length = size;
+    
+    for (i = 0; i <= length; ++i) {
+        int tx = x + step_x * i;
+        int ty = y + step_y * i;
+        BOOL open = i < length && grid_is_open(grid, tx, ty) && grid_is_open(grid, tx + cross_x, ty + cross_y);
+        
+        if (open && start == -1) {
+            start = i;
+        } else if (!open && start != -1) {
+            add_entrances(hierarchy, edges, tile_nodes, node_capacity, grid,
+                          x + step_x * start, y + step_y * start, step_x, step_y, cross_x, cross_y, i - start);
+            start = -1;
+        }
+    }
+}
+
+static int compare_edges(const void *lhs, const void *rhs) {
+    const BuildEdge *first = lhs;
+    const BuildEdge *second = rhs;
+    
+    return first->from - second->from;
+}
+
+void hierarchy_build(Hierarchy *hierarchy, const Grid *grid, int cluster_size) {
+    BuildEdges edges = { NULL, 0, 0 };
+    int node_capacity = 0;
+    int clusters;
+    int *tile_nodes;
+    int *cost;
+    int *heap = NULL;
+    int heap_capacity = 0;
+    int cx, cy, i, j;
+    
+    memset(hierarchy, 0, sizeof(Hierarchy));
+    
+    hierarchy->cluster_size = cluster_size;
+    hierarchy->epoch = grid->epoch;
+    hierarchy->clusters_x = (grid->width + cluster_size - 1) / cluster_size;
+    hierarchy->clusters_y = (grid->height + cluster_size - 1) / cluster_size;
+    clusters = hierarchy->clusters_x * hierarchy->clusters_y;
+    
+    tile_nodes = malloc(sizeof(int) * grid->width * grid->height);
+    memset(tile_nodes, -1, sizeof(int) * grid->width * grid->height);
+    
+    // Find the entrances between neighboring clusters
+    for (cy = 0; cy < hierarchy->clusters_y; ++cy) {
+        for (cx = 0; cx < hierarchy->clusters_x; ++cx) {
+            if (cx + 1 < hierarchy->clusters_x)
+                build_border(hierarchy, &edges, tile_nodes, &node_capacity, grid, cx, cy, TRUE);
+            if (cy + 1 < hierarchy->clusters_y)
+                build_border(hierarchy, &edges, tile_nodes, &node_capacity, grid, cx, cy, FALSE);
+        }
+    }
+    
+    free(tile_nodes);
+    
+    // Group the nodes by cluster
+    hierarchy->cluster_first = calloc(clusters + 1, sizeof(int));
+    hierarchy->cluster_nodes = malloc(sizeof(int) * (hierarchy->node_count + 1));
+    
+    for (i = 0; i < hierarchy->node_count; ++i)
+        ++hierarchy->cluster_first[hierarchy->nodes[i].cluster + 1];
+    for (i = 0; i < clusters; ++i)
+        hierarchy->cluster_first[i + 1] += hierarchy->cluster_first[i];
+    {
+        int *fill = malloc(sizeof(int) * (clusters + 1));
+        memcpy(fill, hierarchy->cluster_first, sizeof(int) * (clusters + 1));
+        for (i = 0; i < hierarchy->node_count; ++i)
+            hierarchy->cluster_nodes[fill[hierarchy->nodes[i].cluster]++] = i;
+        free(fill);
+    }
+    
+    // Connect the nodes inside of each cluster
+    cost = malloc(sizeof(int) * cluster_size * cluster_size);
+    
+    for (i = 0; i < clusters; ++i) {
+        int left = (i % hierarchy->clusters_x) * cluster_size;
+        int top = (i / hierarchy->clusters_x) * cluster_size;
+        
+        for (j = hierarchy->cluster_first[i]; j < hierarchy->cluster_first[i + 1]; ++j) {
+            HierarchyNode *from = &hierarchy->nodes[hierarchy->cluster_nodes[j]];
+            int k;
+            
+            search_cluster(hierarchy, grid, i, from->x, from->y, cost, &heap, &heap_capacity);
+            
+            for (k = hierarchy->cluster_first[i]; k < hierarchy->cluster_first[i + 1]; ++k) {
+                HierarchyNode *to = &hierarchy->nodes[hierarchy->cluster_nodes[k]];
+                int c = cost[(to->y - top) * cluster_size + (to->x - left)];
+                
+                if (k != j && c > 0)
+                    add_edge(&edges, hierarchy->cluster_nodes[j], hierarchy->cluster_nodes[k], c);
+            }
+        }
+    }
+    
+    free(cost);
+    free(heap);
+    
+    // Store the edges grouped by their starting node
+    qsort(edges.edges, edges.count, sizeof(BuildEdge), compare_edges);
+    
+    hierarchy->edge_count = edges.count;
+    hierarchy->edges = malloc(sizeof(HierarchyEdge) * (edges.count + 1));
+    
+    for (i = 0; i < edges.count; ++i) {
+        HierarchyNode *from = &hierarchy->nodes[edges.edges[i].from];
+        
+        if (from->edge_count == 0)
+            from->first_edge = i;
+        ++from->edge_count;
+        
+        hierarchy->edges[i].target = edges.edges[i].to;
+        hierarchy->edges[i].cost = edges.edges[i].cost;
+    }
+    
+    free(edges.edges);
+}
+
+void hierarchy_free(Hierarchy *hierarchy) {
+    if (!hierarchy->mapped) {
+        free(hierarchy->nodes);
+        free(hierarchy->edges);
+        free(hierarchy->cluster_first);
+        free(hierarchy->cluster_nodes);
+    }
+    
+    memset(hierarchy, 0, sizeof(Hierarchy));
+}
+
+int hierarchy_memory_usage(const Hierarchy *hierarchy) {
+    int clusters = hierarchy->clusters_x * hierarchy->clusters_y;
+    
+    return sizeof(HierarchyNode) * hierarchy->node_count +
+           sizeof(HierarchyEdge) * hierarchy->edge_count +
+           sizeof(int) * (clusters + 1) +
+           sizeof(int) * hierarchy->node_count;
+}
+
+void hierarchy_search_init(HierarchySearch *search) {
+    memset(search, 0, sizeof(HierarchySearch));
+}
+
+void hierarchy_search_free(HierarchySearch *search) {
+    free(search->g);
+    free(search->parent);
+    free(search->generation);
+    free(search->closed);
+    free(search->heap);
+    free(search->goal_cost);
+    free(search->cluster_cost);
+    free(search->cluster_parent);
+    free(search->cluster_tiles);
+    free(search->cluster_heap);
+    free(search->abstract);
+    free(search->path);
+    memset(search, 0, sizeof(HierarchySearch));
+}
+
+// Makes sure the scratch memory is big enough for the hierarchy.
+static void prepare_search(const Hierarchy *hierarchy, HierarchySearch *search) {
+    int capacity = hierarchy->node_count + 2;
+    int size = hierarchy->cluster_size;
+    
+    if (search->capacity < capacity) {
+        search->g = realloc(search->g, sizeof(int) * capacity);
+        search->parent = realloc(search->parent, sizeof(int) * capacity);
+        search->generation = realloc(search->generation, sizeof(unsigned int) * capacity);
+        search->closed = realloc(search->closed, capacity);
+        search->goal_cost = realloc(search->goal_cost, sizeof(int) * capacity);
+        search->capacity = capacity;
+        search->current = 0;
+        
+        memset(search->generation, 0, sizeof(unsigned int) * capacity);
+        memset(search->goal_cost, -1, sizeof(int) * capacity);
+        
+        free(search->cluster_cost);
+        free(search->cluster_parent);
+        free(search->cluster_tiles);
+        search->cluster_cost = malloc(sizeof(int) * size * size);
+        search->cluster_parent = malloc(size * size);
+        search->cluster_tiles = malloc(sizeof(GridPosition) * size * size);
+    }
+    
+    if (++search->current == 0) {
+        memset(search->generation, 0, sizeof(unsigned int) * search->capacity);
+        search->current = 1;
+    }
+    
+    search->heap_count = 0;
+}
+
+// Resets a node's search state if the current search hasn't touched it yet.
+static void visit_node(HierarchySearch *search, int node) {
+    if (search->generation[node] != search->current) {
+        search->generation[node] = search->current;
+        search->g[node] = -1;
+        search->parent[node] = -1;
+        search->closed[node] = FALSE;
+    }
+}
+
+// Relaxes the edge from a node and adds the target to the open set if it got cheaper.
+static void relax(HierarchySearch *search, const Hierarchy *hierarchy, int from, int to, int cost, short endX, short endY, int goal) {
+    int g = search->g[from] + cost;
+    int h;
+    
+    visit_node(search, to);
+    
+    if (search->closed[to]) return;
+    if (search->g[to] != -1 && search->g[to] <= g) return;
+    
+    search->g[to] = g;
+    search->parent[to] = from;
+    
+    if (to == goal)
+        h = 0;
+    else
+        h = octile_distance(hierarchy->nodes[to].x, hierarchy->nodes[to].y, endX, endY);
+    
+    heap_push(&search->heap, &search->heap_count, &search->heap_capacity, g + h, to);
+}
+
+// Adds a tile to the end of the path.
+// The last point is moved instead if the path keeps going in the same direction.
+static void add_point(HierarchySearch *search, short x, short y) {
+    int count = search->path_count;
+    
+    if (count >= 2) {
+        GridPosition *prev = &search->path[count - 2];
+        GridPosition *last = &search->path[count - 1];
+        int dx = (last->x > prev->x) - (last->x < prev->x);
+        int dy = (last->y > prev->y) - (last->y < prev->y);
+        
+        if (x - last->x == dx && y - last->y == dy) {
+            last->x = x;
+            last->y = y;
+            return;
+        }
+    }
+    
+    if (count >= search->path_capacity) {
+        search->path_capacity = search->path_capacity ? search->path_capacity * 2 : 64;
+        search->path = realloc(search->path, sizeof(GridPosition) * search->path_capacity);
+    }
+    
+    search->path[count].x = x;
+    search->path[count].y = y;
+    ++search->path_count;
+}
+
+// Tries to connect two tiles with a diagonal run followed by a straight run.
+// This is always a shortest path, so most steps through open space don't need a search.
+static BOOL add_direct(const Grid *grid, HierarchySearch *search, GridPosition from, GridPosition to) {
+    int dx = (to.x > from.x) - (to.x < from.x);
+    int dy = (to.y > from.y) - (to.y < from.y);
+    int x = from.x;
+    int y = from.y;
+    
+    while (x != to.x || y != to.y) {
+        int sx = x != to.x ? dx : 0;
+        int sy = y != to.y ? dy : 0;
+        
+        if (!grid_is_open(grid, x + sx, y + sy) && (x + sx != to.x || y + sy != to.y)) break;
+        if (sx != 0 && sy != 0 && !grid_is_open(grid, x + sx, y) && !grid_is_open(grid, x, y + sy)) break;
+        
+        x += sx;
+        y += sy;
+    }
+    
+    if (x != to.x || y != to.y) return FALSE;
+    
+    // The run only changes direction once, so the points can be added at the end.
+    if (abs(to.x - from.x) != abs(to.y - from.y) && to.x != from.x && to.y != from.y) {
+        int diagonal = abs(to.x - from.x) < abs(to.y - from.y) ? abs(to.x - from.x) : abs(to.y - from.y);
+        add_point(search, from.x + dx * diagonal, from.y + dy * diagonal);
+    }
+    
+    add_point(search, to.x, to.y);
+    
+    return TRUE;
+}
+
+// Runs A* between two tiles of the same cluster and adds the tiles after the first one to the path.
+// Uses the same movement rules as search_cluster, so a step of the abstract path can always be refined.
+static BOOL refine_segment(const Hierarchy *hierarchy, const Grid *grid, HierarchySearch *search, GridPosition from, GridPosition to) {
+    int size = hierarchy->cluster_size;
+    int cluster = cluster_of(hierarchy, from.x, from.y);
+    int left = (cluster % hierarchy->clusters_x) * size;
+    int top = (cluster / hierarchy->clusters_x) * size;
+    int width = left + size > grid->width ? grid->width - left : size;
+    int height = top + size > grid->height ? grid->height - top : size;
+    int target = (to.y - top) * size + (to.x - left);
+    int *cost = search->cluster_cost;
+    int count = 0;
+    int found = FALSE;
+    int i, index;
+    
+    for (i = 0; i < size * size; ++i)
+        cost[i] = -1;
+    
+    index = (from.y - top) * size + (from.x - left);
+    cost[index] = 0;
+    heap_push(&search->cluster_heap, &count, &search->cluster_heap_capacity, octile_distance(from.x, from.y, to.x, to.y), index);
+    
+    while (count > 0) {
+        int f;
+        int x, y;
+        
+        index = heap_pop(search->cluster_heap, &count, &f);
+        x = left + index % size;
+        y = top + index / size;
+        
+        if (f > cost[index] + octile_distance(x, y, to.x, to.y)) continue;
+        
+        if (index == target) {
+            found = TRUE;
+            break;
+        }
+        
+        for (i = 0; i < 8; ++i) {
+            int dx = directions[i].x;
+            int dy = directions[i].y;
+            int nx = x + dx;
+            int ny = y + dy;
+            int step = HIERARCHY_STRAIGHT_COST;
+            int next;
+            
+            if (nx < left || nx >= left + width || ny < top || ny >= top + height) continue;
+            if (!grid_is_open(grid, nx, ny) && (nx != to.x || ny != to.y)) continue;
+            
+            if (dx != 0 && dy != 0) {
+                if (!grid_is_open(grid, x + dx, y) && !grid_is_open(grid, x, y + dy)) continue;
+                step = HIERARCHY_DIAGONAL_COST;
+            }
+            
+            next = (ny - top) * size + (nx - left);
+            
+            if (cost[next] == -1 || cost[index] + step < cost[next]) {
+                cost[next] = cost[index] + step;
+                search->cluster_parent[next] = i;
+                heap_push(&search->cluster_heap, &count, &search->cluster_heap_capacity,
+                          cost[next] + octile_distance(nx, ny, to.x, to.y), next);
+            }
+        }
+    }
+    
+    if (!found) return FALSE;
+    
+    // Walk back from the target then add the tiles in order
+    count = 0;
+    for (index = target; index != (from.y - top) * size + (from.x - left); ) {
+        GridPosition *step = &directions[search->cluster_parent[index]];
+        int x = left + index % size;
+        int y = top + index / size;
+        
+        search->cluster_tiles[count].x = x;
+        search->cluster_tiles[count].y = y;
+        ++count;
+        
+        index = (y - step->y - top) * size + (x - step->x - left);
+    }
+    
+    while (count > 0) {
+        --count;
+        add_point(search, search->cluster_tiles[count].x, search->cluster_tiles[count].y);
+    }
+    
+    return TRUE;
+}
+
+int hierarchy_find_path(const Hierarchy *hierarchy, const Grid *grid, HierarchySearch *search,
+                        short startX, short startY, short endX, short endY) {
+    int size = hierarchy->cluster_size;
+    int start = hierarchy->node_count;
+    int goal = hierarchy->node_count + 1;
+    int start_cluster = cluster_of(hierarchy, startX, startY);
+    int goal_cluster = cluster_of(hierarchy, endX, endY);
+    int found = FALSE;
+    int count, node, i;
+    
+    if (hierarchy->node_count == 0) return 0;
+    
+    prepare_search(hierarchy, search);
+    
+    // Find the cost from the goal to each entrance of its cluster
+    search_cluster(hierarchy, grid, goal_cluster, endX, endY, search->cluster_cost, &search->cluster_heap, &search->cluster_heap_capacity);
+    for (i = hierarchy->cluster_first[goal_cluster]; i < hierarchy->cluster_first[goal_cluster + 1]; ++i) {
+        const HierarchyNode *n = &hierarchy->nodes[hierarchy->cluster_nodes[i]];
+        int left = (goal_cluster % hierarchy->clusters_x) * size;
+        int top = (goal_cluster / hierarchy->clusters_x) * size;
+        
+        search->goal_cost[hierarchy->cluster_nodes[i]] = search->cluster_cost[(n->y - top) * size + (n->x - left)];
+    }
+    
+    // Connect the start to each entrance of its cluster
+    visit_node(search, start);
+    search->g[start] = 0;
+    
+    search_cluster(hierarchy, grid, start_cluster, startX, startY, search->cluster_cost, &search->cluster_heap, &search->cluster_heap_capacity);
+    search->closed[start] = TRUE;
+    
+    for (i = hierarchy->cluster_first[start_cluster]; i < hierarchy->cluster_first[start_cluster + 1]; ++i) {
+        int target = hierarchy->cluster_nodes[i];
+        const HierarchyNode *n = &hierarchy->nodes[target];
+        int left = (start_cluster % hierarchy->clusters_x) * size;
+        int top = (start_cluster / hierarchy->clusters_x) * size;
+        int c = search->cluster_cost[(n->y - top) * size + (n->x - left)];
+        
+        if (c >= 0)
+            relax(search, hierarchy, start, target, c, endX, endY, goal);
+    }
+    
+    // The goal can also be reached without leaving the start cluster
+    if (start_cluster == goal_cluster) {
+        int left = (start_cluster % hierarchy->clusters_x) * size;
+        int top = (start_cluster / hierarchy->clusters_x) * size;
+        int c = search->cluster_cost[(endY - top) * size + (endX - left)];
+        
+        if (c >= 0)
+            relax(search, hierarchy, start, goal, c, endX, endY, goal);
+    }
+    
+    while (search->heap_count > 0) {
+        int f;
+        
+        node = heap_pop(search->heap, &search->heap_count, &f);
+        
+        if (search->closed[node]) continue;
+        search->closed[node] = TRUE;
+        
+        if (node == goal) {
+            found = TRUE;
+            break;
+        }
+        
+        for (i = 0; i < hierarchy->nodes[node].edge_count; ++i) {
+            const HierarchyEdge *edge = &hierarchy->edges[hierarchy->nodes[node].first_edge + i];
+            relax(search, hierarchy, node, edge->target, edge->cost, endX, endY, goal);
+        }
+        
+        if (hierarchy->nodes[node].cluster == goal_cluster && search->goal_cost[node] >= 0)
+            relax(search, hierarchy, node, goal, search->goal_cost[node], endX, endY, goal);
+    }
+    
+    // Reset the goal costs for the next search
+    for (i = hierarchy->cluster_first[goal_cluster]; i < hierarchy->cluster_first[goal_cluster + 1]; ++i)
+        search->goal_cost[hierarchy->cluster_nodes[i]] = -1;
+    
+    if (!found) return 0;
+    
+    // Count the points then write them out from the goal back to the start
+    count = 0;
+    for (node = goal; node != -1; node = search->parent[node])
+        ++count;
+    
+    if (search->abstract_capacity < count) {
+        search->abstract_capacity = count;
+        search->abstract = realloc(search->abstract, sizeof(GridPosition) * count);
+    }
+    
+    i = count;
+    for (node = goal; node != -1; node = search->parent[node]) {
+        --i;
+        if (node == start) {
+            search->abstract[i].x = startX;
+            search->abstract[i].y = startY;
+        } else if (node == goal) {
+            search->abstract[i].x = endX;
+            search->abstract[i].y = endY;
+        } else {
+            search->abstract[i].x = hierarchy->nodes[node].x;
+            search->abstract[i].y = hierarchy->nodes[node].y;
+        }
+    }
+    
+    // Refine each step of the abstract path
+    search->path_count = 0;
+    add_point(search, startX, startY);
+    
+    for (i = 0; i + 1 < count; ++i) {
+        GridPosition from = search->abstract[i];
+        GridPosition to = search->abstract[i + 1];
+        
+        if (from.x == to.x && from.y == to.y) continue;
+        
+        if (cluster_of(hierarchy, from.x, from.y) != cluster_of(hierarchy, to.x, to.y)) {
+            // Entrances across a border are next to each other.
+            add_point(search, to.x, to.y);
+        } else if (!add_direct(grid, search, from, to) && !refine_segment(hierarchy, grid, search, from, to)) {
+            return 0;
+        }
+    }
+    
+    return search->path_count;
+}
@@ -0,0 +1,187 @@
+#ifndef HIERARCHY_H_
+#define HIERARCHY_H_
+
+#include "grid.h"
+
+/** The cost of moving one tile horizontally or vertically. */
+#define HIERARCHY_STRAIGHT_COST 10
+
+/** The cost of moving one tile diagonally. */
+#define HIERARCHY_DIAGONAL_COST 14
+
+/** An entrance tile on the border of a cluster. */
+typedef struct HierarchyNode {
+    /** The x tile in the level. */
+    short x;
+    
+    /** The y tile in the level. */
+    short y;
+    
+    /** The cluster that this node is in. */
+    int cluster;
+    
+    /** The index of the first edge of this node. */
+    int first_edge;
+    
+    /** The number of edges of this node. */
+    int edge_count;
+} HierarchyNode;
+
+/** A connection between two entrance nodes. */
+typedef struct HierarchyEdge {
+    /** The node that this edge goes to. */
+    int target;
+    
+    /** The cost of traveling along this edge. */
+    int cost;
+} HierarchyEdge;
+
+/** An abstract graph of the grid for hierarchical pathfinding (HPA*).
+ * The grid is split into square clusters. Entrances connect neighboring clusters
+ * and every pair of entrances in a cluster is connected with their travel cost.
+ */
+typedef struct Hierarchy {
+    /** The width and height of a cluster in tiles. */
+    int cluster_size;
+    
+    /** The number of clusters horizontally. */
+    int clusters_x;
+    
+    /** The number of clusters vertically. */
+    int clusters_y;
+    
+    /** The entrance nodes. (node_count) */
+    HierarchyNode *nodes;
+    
+    /** The number of entrance nodes. */
+    int node_count;
+    
+    /** The edges of every node. (edge_count) */
+    HierarchyEdge *edges;
+    
+    /** The number of edges. */
+    int edge_count;
+    
+    /** The index in cluster_nodes of the first node of each cluster. (clusters + 1) */
+    int *cluster_first;
+    
+    /** The nodes of each cluster. (node_count) */
+    int *cluster_nodes;
+    
+    /** The grid epoch the hierarchy was built with. The hierarchy can't be used once the grid changes. */
+    unsigned int epoch;
+    
+    /** TRUE if the arrays point into a mapped cache file. They're never written or freed then. */
+    BOOL mapped;
+} Hierarchy;
+
+/** Scratch memory for searching a hierarchy.
+ * Each search needs its own, so searches can run in parallel.
+ */
+typedef struct HierarchySearch {
+    /** The cost from the start to each node. Includes the start and goal nodes. */
+    int *g;
+    
+    /** The node that each node was reached from. */
+    int *parent;
+    
+    /** The search that last touched each node. */
+    unsigned int *generation;
+    
+    /** TRUE if the node was expanded. */
+    unsigned char *closed;
+    
+    /** The generation of the current search. */
+    unsigned int current;
+    
+    /** The number of nodes the arrays were allocated for. */
+    int capacity;
+    
+    /** The open set. Pairs of (f, node). */
+    int *heap;
+    
+    /** The number of items in the open set. */
+    int heap_count;
+    
+    /** The allocated size of the open set in pairs. */
+    int heap_capacity;
+    
+    /** The cost from the goal to each node in the goal's cluster. -1 if not reachable. */
+    int *goal_cost;
+    
+    /** Cluster-sized scratch for searches inside of a cluster. */
+    int *cluster_cost;
+    
+    /** Cluster-sized scratch for the direction that each tile was reached from. */
+    unsigned char *cluster_parent;
+    
+    /** Cluster-sized scratch for the tiles of a refined segment. */
+    GridPosition *cluster_tiles;
+    
+    /** Scratch heap for searches inside of a cluster. Pairs of (cost, tile). */
+    int *cluster_heap;
+    
+    /** The allocated size of the cluster heap in pairs. */
+    int cluster_heap_capacity;
+    
+    /** The path through the entrance nodes. */
+    GridPosition *abstract;
+    
+    /** The allocated size of the abstract path. */
+    int abstract_capacity;
+    
+    /** The resulting path. */
+    GridPosition *path;
+    
+    /** The number of points in the resulting path. */
+    int path_count;
+    
+    /** The allocated size of the path. */
+    int path_capacity;
+} HierarchySearch;
+
+/** Builds the hierarchy of a grid.
+ * @param hierarchy The hierarchy to build.
+ * @param grid The grid
+ * @param cluster_size The width and height of a cluster in tiles.
+ */
+void hierarchy_build(Hierarchy *hierarchy, const Grid *grid, int cluster_size);
+
+/** Frees the memory used by the hierarchy.
+ * @param hierarchy The hierarchy
+ */
+void hierarchy_free(Hierarchy *hierarchy);
+
+/** Returns the number of bytes used by the hierarchy.
+ * @param hierarchy The hierarchy
+ * @return the size of the hierarchy in bytes.
+ */
+int hierarchy_memory_usage(const Hierarchy *hierarchy);
+
+/** Initializes scratch memory for searching.
+ * @param search The search memory
+ */
+void hierarchy_search_init(HierarchySearch *search);
+
+/** Frees scratch memory for searching.
+ * @param search The search memory
+ */
+void hierarchy_search_free(HierarchySearch *search);
+
+/** Finds a path by searching the entrance nodes of the hierarchy and then
+ * refining each step with a search that stays inside of one cluster.
+ * The resulting points are stored in search->path and include the start and the goal.
+ * Consecutive points are connected by a straight horizontal, vertical or diagonal line.
+ * @param hierarchy The hierarchy
+ * @param grid The grid that the hierarchy was built from
+ * @param search The scratch memory to use
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param endX The ending x position.
+ * @param endY The ending y position.
+ * @return the number of points in the path, or 0 if there is no path.
+ */
+int hierarchy_find_path(const Hierarchy *hierarchy, const Grid *grid, HierarchySearch *search,
+                        short startX, short startY, short endX, short endY);
+
+#endif
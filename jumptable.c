@@ -0,0 +1,160 @@
+#include "jumptable.h"
+#include <stdlib.h>
+
+// Used as offsets for jump directions. The straight directions come first.
+static GridPosition directions[8] = {
+    { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 },
+    { -1, -1 }, { 1, -1 }, { -1, 1 }, { 1, 1 }
+};
+
+// The direction index of each (dy + 1, dx + 1).
+static const int direction_index[3][3] = {
+    { 4, 0, 5 },
+    { 3, -1, 1 },
+    { 6, 2, 7 }
+};
+
+int jump_table_direction(int dx, int dy) {
+    return direction_index[dy + 1][dx + 1];
+}
+
+static short *get_distance(const JumpTable *table, int x, int y, int direction) {
+    return &table->distances[(y * table->width + x) * 8 + direction];
+}
+
+// Checks a tile for forced neighbors when it's reached moving in a direction.
+static BOOL has_forced_neighbor(const Grid *grid, int x, int y, int dx, int dy) {
+    if (dx != 0 && dy != 0) {
+        return (grid_is_open(grid, x - dx, y + dy) && !grid_is_open(grid, x - dx, y)) ||
+               (grid_is_open(grid, x + dx, y - dy) && !grid_is_open(grid, x, y - dy));
+    }
+    
+    if (dx != 0) {
+        return (grid_is_open(grid, x + dx, y + 1) && !grid_is_open(grid, x, y + 1)) ||
+               (grid_is_open(grid, x + dx, y - 1) && !grid_is_open(grid, x, y - 1));
+    }
+    
+    return (grid_is_open(grid, x + 1, y + dy) && !grid_is_open(grid, x + 1, y)) ||
+           (grid_is_open(grid, x - 1, y + dy) && !grid_is_open(grid, x - 1, y));
+}
+
+// Fills in one direction for every tile.
+// The tiles are visited against the direction so the next tile is always done first.
+static void build_direction(JumpTable *table, const Grid *grid, int direction) {
+    int dx = directions[direction].x;
+    int dy = directions[direction].y;
+    int horizontal = jump_table_direction(dx, 0);
+    int vertical = jump_table_direction(0, dy);
+    int i, j;
+    
+    for (j = 0; j < table->height; ++j) {
+        int y = dy > 0 ? table->height - 1 - j : j;
+        
+        for (i = 0; i < table->width; ++i) {
+            int x = dx > 0 ? table->width - 1 - i : i;
+            int nx = x + dx;
+            int ny = y + dy;
+            short *distance = get_distance(table, x, y, direction);
+            BOOL stop;
+            
+            if (!grid_is_open(grid, nx, ny)) {
+                *distance = -1;
+                continue;
+            }
+            
+            stop = has_forced_neighbor(grid, nx, ny, dx, dy);
+            
+            // A diagonal jump also stops where one of its straight jumps finds a jump point.
+            if (!stop && dx != 0 && dy != 0)
+                stop = *get_distance(table, nx, ny, horizontal) > 0 || *get_distance(table, nx, ny, vertical) > 0;
+            
+            if (stop) {
+                *distance = 1;
+            } else {
+                short next = *get_distance(table, nx, ny, direction);
+                *distance = next > 0 ? next + 1 : next - 1;
+            }
+        }
+    }
+}
+
+void jump_table_build(JumpTable *table, const Grid *grid) {
+    int direction;
+    
+    if (!table->distances || table->mapped || table->width != grid->width || table->height != grid->height) {
+        if (!table->mapped) free(table->distances);
+        table->distances = malloc(sizeof(short) * grid->width * grid->height * 8);
+        table->mapped = FALSE;
+    }
+    
+    table->width = grid->width;
+    table->height = grid->height;
+    table->epoch = grid->epoch;
+    
+    // The diagonal directions need the straight ones.
+    for (direction = 0; direction < 8; ++direction)
+        build_direction(table, grid, direction);
+}
+
+void jump_table_free(JumpTable *table) {
+    if (!table->mapped) free(table->distances);
+    table->mapped = FALSE;
+    table->distances = NULL;
+    table->width = table->height = 0;
+}
+
+int jump_table_memory_usage(const JumpTable *table) {
+    return sizeof(short) * table->width * table->height * 8;
+}
+
+// Returns TRUE if a straight jump from a tile would reach the goal before it stops.
+static BOOL reaches_goal(const JumpTable *table, GridPosition goal, int x, int y, int dx, int dy) {
+    int remaining;
+    
+    if (dx != 0) {
+        if (goal.y != y) return FALSE;
+        remaining = (goal.x - x) * dx;
+    } else {
+        if (goal.x != x) return FALSE;
+        remaining = (goal.y - y) * dy;
+    }
+    
+    return remaining > 0 && remaining <= abs(*get_distance(table, x, y, jump_table_direction(dx, dy)));
+}
+
+BOOL jump_table_jump(const JumpTable *table, GridPosition goal, int x, int y, int direction, GridPosition *jump_point) {
+    int dx = directions[direction].x;
+    int dy = directions[direction].y;
+    int distance = *get_distance(table, x, y, direction);
+    int reach = abs(distance);
+    int steps = distance > 0 ? distance : 0;
+    int gx = (goal.x - x) * dx;
+    int gy = (goal.y - y) * dy;
+    
+    if (dx == 0 || dy == 0) {
+        // The goal is on the way
+        if (dx != 0 ? (goal.y == y && gx > 0 && gx <= reach) : (goal.x == x && gy > 0 && gy <= reach)) {
+            *jump_point = goal;
+            return TRUE;
+        }
+    } else {
+        // The goal is on the way
+        if (gx > 0 && gx == gy && gx <= reach) {
+            *jump_point = goal;
+            return TRUE;
+        }
+        
+        // A straight jump from one of the diagonal tiles on the way can reach the goal.
+        // Only the tiles that line up with the goal need to be checked.
+        if (gy > 0 && gy < reach && (steps == 0 || gy < steps) && reaches_goal(table, goal, x + dx * gy, y + dy * gy, dx, 0))
+            steps = gy;
+        if (gx > 0 && gx < reach && (steps == 0 || gx < steps) && reaches_goal(table, goal, x + dx * gx, y + dy * gx, 0, dy))
+            steps = gx;
+    }
+    
+    if (steps == 0) return FALSE;
+    
+    jump_point->x = x + dx * steps;
+    jump_point->y = y + dy * steps;
+    return TRUE;
+}
@@ -0,0 +1,67 @@
+#ifndef JUMPTABLE_H_
+#define JUMPTABLE_H_
+
+#include "grid.h"
+
+/** Precomputed jump distances for jump point search (JPS+).
+ * For every tile and each of the 8 directions, stores how far a jump goes before it
+ * reaches a jump point or a tile that isn't open. Searches then jump with lookups
+ * instead of scanning tiles.
+ */
+typedef struct JumpTable {
+    /** The jump distance of each tile in each direction. (width * height * 8)
+     * A positive distance ends on a jump point. A negative distance ends on a tile that isn't open.
+     */
+    short *distances;
+    
+    /** The width of the grid the table was built for. */
+    short width;
+    
+    /** The height of the grid the table was built for. */
+    short height;
+    
+    /** The grid epoch the table was built with. The table can't be used once the grid changes. */
+    unsigned int epoch;
+    
+    /** TRUE if the distances point into a mapped cache file. They're never written or freed then. */
+    BOOL mapped;
+} JumpTable;
+
+/** Builds the jump table of a grid.
+ * Uses the same rules as the scanning jump in monkey_pathing.c, so both find the same jump points.
+ * @param table The table to build. Any old table memory is reused.
+ * @param grid The grid
+ */
+void jump_table_build(JumpTable *table, const Grid *grid);
+
+/** Frees the memory used by the table.
+ * @param table The table
+ */
+void jump_table_free(JumpTable *table);
+
+/** Returns the number of bytes used by the table.
+ * @param table The table
+ * @return the size of the distances in bytes.
+ */
+int jump_table_memory_usage(const JumpTable *table);
+
+/** Returns the index of a direction in the table.
+ * @param dx The x direction. (-1, 0 or 1)
+ * @param dy The y direction. (-1, 0 or 1)
+ * @return the direction index.
+ */
+int jump_table_direction(int dx, int dy);
+
+/** Jumps from a tile in a direction using the table.
+ * The goal is checked for on the way, so the jump stops early if it can reach the goal.
+ * @param table The table
+ * @param goal The goal tile
+ * @param x The x tile to jump from
+ * @param y The y tile to jump from
+ * @param direction The direction index to jump in
+ * @param jump_point Set to the jump point if one was found.
+ * @return TRUE if a jump point was found, FALSE otherwise.
+ */
+BOOL jump_table_jump(const JumpTable *table, GridPosition goal, int x, int y, int direction, GridPosition *jump_point);
+
+#endif
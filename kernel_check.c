@@ -0,0 +1,212 @@
+/* Checks that the fast paths give the same results as the simple code they replace.
+ *   - weapon_move_avx2 against weapon_move_scalar on random weapon pools, including weapons on tile
+ *     edges, off of the map, at their expiry tick, flagged to be destroyed and in danger cells.
+ *   - grid_build against setting each solid tile with grid_set_solid on random maps.
+ * Not part of the module. Build it by hand and run it after changing either:
+ *     gcc -O2 -o kernel_check kernel_check.c weapon_move.c grid.c -lm -lpthread
+ * Exits with 1 if anything differs.
+ */
+#include "grid.h"
+#include "weapon_move.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_ROUNDS 20000
+#define MAX_POOL_SIZE 64
+#define PROX_TYPE 4
+#define MAP_SIZE 256
+
+typedef struct {
+    double x[MAX_POOL_SIZE];
+    double y[MAX_POOL_SIZE];
+    double vx[MAX_POOL_SIZE];
+    double vy[MAX_POOL_SIZE];
+    int expires[MAX_POOL_SIZE];
+    unsigned char type[MAX_POOL_SIZE];
+    unsigned char flags[MAX_POOL_SIZE];
+} Pool;
+
+static int danger[DANGER_CELLS * DANGER_CELLS];
+static unsigned int rng;
+
+static int rnd(int n) {
+    rng = rng * 1103515245 + 12345;
+    return (rng >> 8) % n;
+}
+
+// A position that's often on a tile edge or off of the map, since those are where the kernels could disagree.
+static double random_position(void) {
+    switch (rnd(4)) {
+        case 0: return rnd(DANGER_CELLS * DANGER_CELL_SIZE / 16) * 16.0;
+        case 1: return -64 + rnd(DANGER_CELLS * DANGER_CELL_SIZE + 128);
+        default: return rnd(DANGER_CELLS * DANGER_CELL_SIZE * 64) / 64.0;
+    }
+}
+
+// A velocity that's often 0, lands exactly on the next tile edge or crosses more than a tile.
+static double random_velocity(double position) {
+    switch (rnd(5)) {
+        case 0: return 0;
+        case 1: return (rnd(2) ? 16.0 : 0.0) + 16.0 * (int)(position / 16.0) - position;
+        case 2: return (rnd(80) - 40) / 2.0;
+        default: return (rnd(2000) - 1000) / 256.0;
+    }
+}
+
+static void fill_pool(Pool *pool, int count, int ticks) {
+    int i;
+    
+    for (i = 0; i < count; ++i) {
+        pool->x[i] = random_position();
+        pool->y[i] = random_position();
+        pool->vx[i] = random_velocity(pool->x[i]);
+        pool->vy[i] = random_velocity(pool->y[i]);
+        pool->expires[i] = ticks - 2 + rnd(5);
+        pool->type[i] = rnd(9);
+        pool->flags[i] = rnd(8);
+    }
+    
+    for (i = 0; i < DANGER_CELLS * DANGER_CELLS; ++i)
+        danger[i] = rnd(4) == 0 ? rnd(4) : 0;
+}
+
+static int move_pool(WeaponMoveFunc move, Pool *pool, int start, int count, int ticks, int *slow) {
+    WeaponMotion motion;
+    
+    motion.x = pool->x;
+    motion.y = pool->y;
+    motion.vx = pool->vx;
+    motion.vy = pool->vy;
+    motion.expires = pool->expires;
+    motion.type = pool->type;
+    motion.flags = pool->flags;
+    motion.prox_type = PROX_TYPE;
+    
+    return move(&motion, start, count, ticks, danger, slow);
+}
+
+static int check_weapon_move(void) {
+    static Pool scalar, vector;
+    int scalar_slow[MAX_POOL_SIZE], vector_slow[MAX_POOL_SIZE];
+    int mismatches = 0, moved = 0, total = 0;
+    int round;
+
+#ifdef WEAPON_MOVE_AVX2
+    if (weapon_move_select() != weapon_move_avx2) {
+        printf("weapon_move: this CPU has no AVX2, skipped\n");
+        return 0;
+    }
+    
+    rng = 1;
+    for (round = 0; round < POOL_ROUNDS; ++round) {
+        int count = 1 + rnd(MAX_POOL_SIZE);
+        int start = rnd(count);
+        int ticks = rnd(1 << 30);
+        int scalar_count, vector_count;
+        
+        fill_pool(&scalar, count, ticks);
+        vector = scalar;
+        
+        scalar_count = move_pool(weapon_move_scalar, &scalar, start, count, ticks, scalar_slow);
+        vector_count = move_pool(weapon_move_avx2, &vector, start, count, ticks, vector_slow);
+        
+        total += count - start;
+        moved += count - start - scalar_count;
+        
+        if (scalar_count != vector_count || memcmp(scalar_slow, vector_slow, sizeof(int) * scalar_count) != 0 ||
+            memcmp(scalar.x, vector.x, sizeof(double) * count) != 0 || memcmp(scalar.y, vector.y, sizeof(double) * count) != 0) {
+            if (mismatches++ < 5)
+                printf("weapon_move: pool %d (%d weapons from %d) differs\n", round, count, start);
+        }
+    }
+    
+    printf("weapon_move: %d pools, %d of %d weapons moved, %d mismatches\n", POOL_ROUNDS, moved, total, mismatches);
+#else
+    (void)scalar; (void)vector; (void)scalar_slow; (void)vector_slow; (void)moved; (void)total; (void)round;
+    printf("weapon_move: built without the AVX2 kernel, skipped\n");
+#endif
+
+    return mismatches;
+}
+
+// Compares two grids plane by plane. Returns the number of planes that differ.
+static int compare_grids(const Grid *a, const Grid *b, const char *name) {
+    size_t plane = sizeof(uint64_t) * a->row_words * a->height;
+    size_t tiles = (size_t)a->width * a->height;
+    int differ = 0;
+    
+    if (memcmp(a->solid, b->solid, plane) != 0) { printf("grid_build: %s: solid differs\n", name); ++differ; }
+    if (memcmp(a->near_wall, b->near_wall, plane) != 0) { printf("grid_build: %s: near_wall differs\n", name); ++differ; }
+    if (memcmp(a->wall_count, b->wall_count, tiles) != 0) { printf("grid_build: %s: wall_count differs\n", name); ++differ; }
+    if (memcmp(a->clearance, b->clearance, tiles) != 0) { printf("grid_build: %s: clearance differs\n", name); ++differ; }
+    
+    return differ;
+}
+
+static int check_grid_build(void) {
+    static unsigned char tiles[MAP_SIZE * MAP_SIZE];
+    unsigned char solid_types[256];
+    int mismatches = 0, solid = 0;
+    int map, i, x, y;
+    
+    rng = 7;
+    for (map = 0; map < 8; ++map) {
+        // Sparse walls, dense walls, and rectangles of walls like a real map.
+        int density = map % 2 == 0 ? 10 : 45;
+        Grid set, built, threaded;
+        
+        for (i = 0; i < 256; ++i)
+            solid_types[i] = i != 0 && rnd(2);
+        
+        memset(tiles, 0, sizeof(tiles));
+        
+        if (map < 4) {
+            for (i = 0; i < MAP_SIZE * MAP_SIZE; ++i)
+                tiles[i] = rnd(100) < density ? rnd(256) : 0;
+        } else {
+            for (i = 0; i < 60; ++i) {
+                int left = rnd(MAP_SIZE), top = rnd(MAP_SIZE), width = 1 + rnd(40), height = 1 + rnd(40);
+                
+                for (y = top; y < top + height && y < MAP_SIZE; ++y)
+                    for (x = left; x < left + width && x < MAP_SIZE; ++x)
+                        tiles[y * MAP_SIZE + x] = 1 + rnd(255);
+            }
+        }
+        
+        grid_initialize(&set, MAP_SIZE, MAP_SIZE);
+        grid_initialize(&built, MAP_SIZE, MAP_SIZE);
+        grid_initialize(&threaded, MAP_SIZE, MAP_SIZE);
+        
+        for (y = 0; y < MAP_SIZE; ++y) {
+            for (x = 0; x < MAP_SIZE; ++x) {
+                if (solid_types[tiles[y * MAP_SIZE + x]]) {
+                    grid_set_solid(&set, x, y, TRUE);
+                    ++solid;
+                }
+            }
+        }
+        
+        grid_build(&built, tiles, solid_types, 1);
+        grid_build(&threaded, tiles, solid_types, 4);
+        
+        mismatches += compare_grids(&set, &built, "1 thread");
+        mismatches += compare_grids(&set, &threaded, "4 threads");
+        
+        grid_free(&set);
+        grid_free(&built);
+        grid_free(&threaded);
+    }
+    
+    printf("grid_build: 8 maps, %d solid tiles, %d mismatches\n", solid, mismatches);
+    
+    return mismatches;
+}
+
+int main(void) {
+    int mismatches = check_weapon_move();
+    
+    mismatches += check_grid_build();
+    
+    return mismatches > 0;
+}
@@ -27,6 +27,9 @@ local Ipathing *path;
 #define MODULE_NAME "monkey_ai"
 #define UPDATE_FREQUENCY 25
 
+/** The most nodes that a replanner expands for one ai player each update. Bigger searches go on over later updates. */
+#define REPLAN_BUDGET 1000
+
 local const char *ShipNames[] = { "Warbird", "Javelin", "Spider", "Leviathan",
                                   "Terrier", "Weasel", "Lancaster", "Shark" };
 
@@ -233,8 +236,16 @@ local AIPlayer *CreateAI(Arena *arena, const char *name, int freq, int ship) {
     int x, y;
     GetSpawnPoint(arena, freq, &x, &y);
     
-    aip->path = LLAlloc();
+    path_init(&aip->path);
     aip->last_pathing = 0;
+    aip->path_pending = 0;
+    aip->path_epoch = 0;
+    aip->replanner = NULL;
+    aip->replan_pending = 0;
+    aip->replan_aborted = 0;
+    aip->flow = NULL;
+    aip->flow_player = NULL;
+    aip->flow_valid = 0;
     aip->ship = ship;
     aip->x = x * 16;
     aip->y = y * 16;
@@ -333,8 +344,12 @@ local void GetSpawnPoint(Arena *arena, int freq, int *spawnx, int *spawny) {
  * @param aip The AI player that should be destroyed.
  */
 local void DestroyAIPlayer(LinkedList *players, AIPlayer *aip) {
+    path->CancelPathRequests(aip->player->arena, aip);
+    path->ReleaseFlowField(aip->player->arena, aip->flow);
+    path->FreeReplanner(aip->player->arena, aip->replanner);
     fake->EndFaked(aip->player);
     LLRemove(players, aip);
+    path_free(&aip->path);
     afree(aip);
 }
 
@@ -515,7 +530,10 @@ local void DoTick(Arena *arena) {
         if (aip->target.type != TargetNone) {
             int tarx, tary;
             
-            if (aip->target.type == TargetPlayer) {
+            if (aip->target.type == TargetPlayer && aip->flow_valid) {
+                tarx = aip->flow_x;
+                tary = aip->flow_y;
+            } else if (aip->target.type == TargetPlayer) {
                 tarx = aip->target.player->position.x;
                 tary = aip->target.player->position.y;
             } else {
@@ -595,6 +613,68 @@ local int NearOther(int x, int y, int x2, int y2, int r) {
     return sqrt(dx * dx + dy * dy) <= r;
 }
 
+/** Called from the main loop when a requested path is found.
+ * The ai player keeps following its old path until this happens.
+ * @param arena The arena the path was requested in.
+ * @param result The new path.
+ * @param param The AI player that requested the path.
+ */
+local void OnPathFound(Arena *arena, SharedPath *result, void *param) {
+    AIPlayer *aip = param;
+    
+    Lock(arena);
+    
+    // Copy the points so the shared path can be given back right away.
+    path_copy(&aip->path, result->points, result->count);
+    path->ReleasePath(result);
+    aip->path_pending = 0;
+    
+    Unlock(arena);
+}
+
+/** Follows the flow field toward the targeted player.
+ * Every ai player chasing the same player shares one field.
+ * @param arena The arena
+ * @param aip The AI player
+ * @param target The player being chased. NULL if the ai player isn't chasing anyone.
+ */
+local void UpdateFlow(Arena *arena, AIPlayer *aip, Player *target) {
+    const int Lookahead = 4;
+    
+    aip->flow_valid = 0;
+    
+    if (target != aip->flow_player) {
+        path->ReleaseFlowField(arena, aip->flow);
+        aip->flow = NULL;
+        aip->flow_player = target;
+        
+        if (target)
+            aip->flow = path->AcquireFlowField(arena, target, target->position.x / 16, target->position.y / 16);
+    }
+    
+    if (!target) return;
+    
+    path->MoveFlowField(arena, aip->flow, target->position.x / 16, target->position.y / 16);
+    
+    // Steer a few tiles ahead so the ai player doesn't turn at every tile.
+    short x = aip->x / 16;
+    short y = aip->y / 16;
+    
+    for (int i = 0; i < Lookahead; ++i) {
+        short nx, ny;
+        
+        if (!path->GetFlowStep(arena, aip->flow, x, y, &nx, &ny)) break;
+        if (nx == x && ny == y) break;
+        
+        x = nx;
+        y = ny;
+        aip->flow_valid = 1;
+    }
+    
+    aip->flow_x = x * 16 + 8;
+    aip->flow_y = y * 16 + 8;
+}
+
 /*****************************/
 
 /** Timer to update the bots.
@@ -656,32 +736,66 @@ local int UpdateTimer(void *param) {
             continue;
         }
         
-        if (aip->target.type != TargetPlayer && current_ticks() > aip->last_pathing + 100) {
-            if (aip->path)
-                LLFree(aip->path);
-            aip->path = path->FindPath(arena, aip->x / 16, aip->y / 16, 545, 535);
-            aip->last_pathing = current_ticks();
+        if (aip->target.type != TargetPlayer && !aip->path_pending) {
+            unsigned int epoch = path->GetGrid(arena)->epoch;
+            
+            // Doors and bricks can block the old path, so don't wait to look again.
+            if (epoch != aip->path_epoch || aip->replan_pending || current_ticks() > aip->last_pathing + 100) {
+                // Keep big ships far enough from walls that they don't bounce off them.
+                int clearance = grid_clearance_for_radius(ad->config.radius[aip->ship]);
+                
+                // Once the map changes under an ai player, it keeps a replanner so later changes
+                // only repair the tiles around them instead of searching again on a worker.
+                // Replanners only keep the usual distance from walls.
+                if (epoch != aip->path_epoch && aip->path_epoch != 0 && !aip->replanner &&
+                    !aip->replan_aborted && clearance == GRID_OPEN_CLEARANCE)
+                    aip->replanner = path->CreateReplanner(arena, 545, 535);
+                
+                if (aip->replanner) {
+                    // The old path is followed until the replanner is done.
+                    PathSearchStatus status = path->Replan(arena, aip->replanner, aip->x / 16, aip->y / 16, REPLAN_BUDGET, &aip->path);
+                    
+                    aip->replan_pending = status == PATH_SEARCH_PARTIAL;
+                    
+                    // The search got too big to keep, so search on a worker instead.
+                    if (status == PATH_SEARCH_ABORTED) {
+                        path->FreeReplanner(arena, aip->replanner);
+                        aip->replanner = NULL;
+                        aip->replan_aborted = 1;
+                    }
+                }
+                
+                if (!aip->replanner) {
+                    aip->path_pending = 1;
+                    path->RequestPath(arena, aip->x / 16, aip->y / 16, 545, 535, clearance, OnPathFound, aip);
+                }
+                
+                aip->path_epoch = epoch;
+                aip->last_pathing = current_ticks();
+            }
         }
         
         Player *tar = GetTargetPlayer(aip);
+        UpdateFlow(arena, aip, tar);
+        
         if (tar) {
             aip->target.type = TargetPlayer;
             aip->target.player = tar;
         } else {
-            if (!LLIsEmpty(aip->path)) {
-                Node *head = LLGetHead(aip->path)->data;
+            PathPoint *head = path_peek(&aip->path);
+            
+            if (head) {
                 aip->target.type = TargetPosition;
                 if (NearOther(aip->x / 16, aip->y / 16, head->x, head->y, 4)) {
-                    LLRemoveFirst(aip->path);
-                    if (LLIsEmpty(aip->path)) {
+                    head = path_pop(&aip->path);
+                    if (!head) {
                         aip->target.type = TargetNone;
                         continue;
                     }
-                    head = LLGetHead(aip->path)->data;
                 }
                 aip->target.position.x = head->x * 16;
                 aip->target.position.y = head->y * 16;
-                //lm->Log(L_INFO, "Target: %d, %d (%d)", head->x, head->y, LLCount(aip->path));
+                //lm->Log(L_INFO, "Target: %d, %d (%d)", head->x, head->y, path_remaining(&aip->path));
             } else {
                 aip->target.type = TargetNone;
             }
@@ -981,7 +1095,11 @@ EXPORT int MM_ai(int action, Imodman *mm_, Arena* arena) {
 
             AIPlayer* aip = LLRemoveFirst(&ad->players);
             while (aip) {
+                path->CancelPathRequests(arena, aip);
+                path->ReleaseFlowField(arena, aip->flow);
+                path->FreeReplanner(arena, aip->replanner);
                 fake->EndFaked(aip->player);
+                path_free(&aip->path);
                 afree(aip);
                 aip = LLRemoveFirst(&ad->players);
             }
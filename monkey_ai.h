@@ -3,6 +3,7 @@
 
 #include "asss.h"
 #include "monkey_weapons.h"
+#include "monkey_pathing.h"
 
 struct AIPlayer;
 
@@ -50,9 +51,42 @@ typedef struct AIPlayer {
     /** The player's target, either a position of an asss player. */
     AITarget target;
     
-    LinkedList *path;
+    /** The path that this ai player is following. The next point is the one to fly to. */
+    Path path;
     
     int last_pathing;
+    
+    /** 1 if a path was requested and hasn't arrived yet. */
+    int path_pending;
+    
+    /** The grid epoch when the path was requested. The path is requested again once the grid changes. */
+    unsigned int path_epoch;
+    
+    /** Repairs the path when the map changes. NULL until the map first changes while following a path. */
+    Replanner *replanner;
+    
+    /** 1 if the replanner ran out of budget and goes on with its search on the next update. */
+    int replan_pending;
+    
+    /** 1 if a replanner went over Pathing:ReplanMemory. A new one would grow just as big on the way to the
+     * same goal, so paths are requested from the workers instead.
+     */
+    int replan_aborted;
+    
+    /** The flow field that leads to the targeted player. NULL if not chasing anyone. */
+    SharedFlowField *flow;
+    
+    /** The player that the flow field leads to. */
+    Player *flow_player;
+    
+    /** 1 if the ai player should steer toward the flow position instead of straight at its target. */
+    int flow_valid;
+    
+    /** The x position in pixels to steer toward while chasing a player. */
+    int flow_x;
+    
+    /** The y position in pixels to steer toward while chasing a player. */
+    int flow_y;
 
     /** The x position in pixels. */
     double x;
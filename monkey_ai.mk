@@ -1,4 +1,4 @@
-monkey_ai_mods = monkey_ai monkey_zombies grid pqueue monkey_pathing monkey_weapons
+monkey_ai_mods = monkey_ai monkey_zombies grid path pqueue components jumptable hierarchy flowfield dstar grid_cache monkey_pathing weapon_move monkey_weapons
 
 $(eval $(call dl_template,monkey_ai))
 
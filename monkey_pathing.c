@@ -1,63 +1,678 @@
 #include "monkey_pathing.h"
 
 #include "asss.h"
+#include "components.h"
+#include "dstar.h"
+#include "flowfield.h"
+#include "grid_cache.h"
+#include "hierarchy.h"
+#include "jumptable.h"
 #include "pqueue.h"
+#include <limits.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 local Imodman *mm;
 local Ilogman *lm;
 local Iarenaman *aman;
 local Ichat *chat;
 local Icmdman *cmd;
+local Imainloop *ml;
 local Igame *game;
 local Iplayerdata *pd;
 local Iconfig *config;
 local Imapdata *map;
 
+/** The data structure used for the open set of a search. */
+typedef enum OpenListType {
+    /** An indexed 4-ary heap. */
+    OPEN_LIST_HEAP,
+    
+    /** A bucket queue indexed by f. */
+    OPEN_LIST_BUCKETS
+} OpenListType;
+
+/** The number of nodes in each block of a search context. */
+#define NODE_BLOCK_SIZE 4096
+
+/** A released context that grew past this many nodes frees the rest. */
+#define CONTEXT_KEEP_NODES (16 * NODE_BLOCK_SIZE)
+
+/** The most unused contexts that an arena keeps. Extra ones are freed when they're released. */
+#define MAX_POOLED_CONTEXTS 8
+
+/** The state of a single path search.
+ * A context is only used by one search at a time, so searches with
+ * different contexts can run at the same time on the same grid.
+ * Only the tiles that the current search touches have nodes, so a context stays small
+ * unless a search covers a large part of the map.
+ */
+struct PathSearchContext {
+    /** The nodes of the current search, in blocks of NODE_BLOCK_SIZE so they never move. (block_count) */
+    Node **blocks;
+    
+    /** The number of blocks allocated. */
+    int block_count;
+    
+    /** The number of nodes the current search has touched. */
+    int node_count;
+    
+    /** An open addressing table from tiles to node indices. Only the slots stamped with the
+     * current generation are in use. (table_size)
+     */
+    int *table;
+    
+    /** The generation that each slot of the table was filled in. (table_size) */
+    unsigned int *stamps;
+    
+    /** The number of slots in the table. Always a power of 2. */
+    int table_size;
+    
+    /** The width of the grid this context was made for. */
+    short width;
+    
+    /** The height of the grid this context was made for. */
+    short height;
+    
+    /** The generation of the current search. Starting a search empties the table by changing it. */
+    unsigned int generation;
+    
+    /** Which open set this context uses. */
+    OpenListType open_list;
+    
+    /** The open set when using a heap. Keyed by f and indexed by node index. Reused between searches. */
+    IndexedPriorityQueue open_heap;
+    
+    /** The open set when using buckets. Keyed by f and indexed by node index. Reused between searches. */
+    BucketPriorityQueue open_buckets;
+    
+    /** Scratch memory for searching the arena's hierarchy. */
+    HierarchySearch hierarchy_search;
+    
+    /** Scratch path for searches whose result gets copied somewhere else. */
+    Path path;
+    
+    /** The goal of the current jump point search. */
+    Node *goal;
+    
+    /** The closed node closest to the goal. The end of partial paths. */
+    Node *best;
+    
+    /** The number of nodes the current search has expanded. */
+    int expansions;
+    
+    /** The grid epoch that the current search started with. */
+    unsigned int epoch;
+    
+    /** The clearance that the current search needs. Tiles with less are treated as walls. */
+    int clearance;
+    
+    /** The state of the current search. */
+    PathSearchStatus status;
+};
+
+/** A cached path. */
+typedef struct PathCacheEntry {
+    /** The start region and goal tile of the path. */
+    uint64_t key;
+    
+    /** The cached path. The cache holds one reference. */
+    SharedPath *path;
+    
+    /** The x tile that the path was searched from. */
+    short start_x;
+    
+    /** The y tile that the path was searched from. */
+    short start_y;
+    
+    /** The previous entry in the LRU list. -1 if this is the most recently used. */
+    int prev;
+    
+    /** The next entry in the LRU list. -1 if this is the least recently used. */
+    int next;
+    
+    /** The next entry in the same hash bucket. -1 if this is the last one. */
+    int bucket_next;
+} PathCacheEntry;
+
+/** A least recently used cache of paths for an arena. */
+typedef struct PathCache {
+    /** The entries. (capacity) */
+    PathCacheEntry *entries;
+    
+    /** The first entry of each hash bucket. -1 if empty. (bucket_mask + 1) */
+    int *buckets;
+    
+    /** The number of buckets - 1. */
+    int bucket_mask;
+    
+    /** The maximum number of entries. */
+    int capacity;
+    
+    /** The number of entries in use. */
+    int count;
+    
+    /** The most recently used entry. */
+    int head;
+    
+    /** The least recently used entry. */
+    int tail;
+    
+    /** The width and height of a start region in tiles. */
+    int region_size;
+    
+    /** The grid epoch that the cached paths were found with. */
+    unsigned int epoch;
+    
+    /** The number of lookups that returned a cached path. */
+    unsigned int hits;
+    
+    /** The number of lookups that had to search. */
+    unsigned int misses;
+    
+    /** The number of bytes used by the cached paths. */
+    int path_bytes;
+    
+    /** The mutex to lock when accessing the cache. */
+    pthread_mutex_t mutex;
+} PathCache;
+
+/** A flow field and the target it was built for. */
+struct SharedFlowField {
+    /** Identifies the target. */
+    const void *key;
+    
+    /** The number of references. Protected by the arena's flow_mutex. */
+    int refcount;
+    
+    /** The grid epoch that the field was built with. */
+    unsigned int epoch;
+    
+    /** When the field was last built. */
+    ticks_t built;
+    
+    /** The directions toward the target. */
+    FlowField field;
+};
+
+/** A search to one goal that gets repaired when tiles change. */
+struct Replanner {
+    /** The search tree, rooted at the goal. */
+    DStar search;
+    
+    /** The path being searched for. Copied to the caller once the search is done, so they keep their old path until then. */
+    Path path;
+};
+
+/** A grid and the tables built from it, shared by every arena that runs the same map with
+ * the same settings. Nothing in it changes once it's shared. An arena that gets tile changes
+ * takes its own copy first.
+ */
+typedef struct SharedGrid {
+    /** The checksum of the map file. */
+    uint32_t map_checksum;
+    
+    /** The Pathing:JumpTable setting that the tables were built with. */
+    BOOL use_jump_table;
+    
+    /** The cluster size that the hierarchy was built with. 0 if there's no hierarchy. */
+    int cluster_size;
+    
+    /** The number of arenas using it. Protected by shared_grid_mutex. */
+    int refcount;
+    
+    /** The walkability data of the level. */
+    Grid grid;
+    
+    /** Precomputed jump distances of the grid. distances is NULL if disabled. */
+    JumpTable jump_table;
+    
+    /** The connected regions of the grid. */
+    ComponentMap components;
+    
+    /** The cluster graph of the grid. NULL if disabled. */
+    Hierarchy *hierarchy;
+    
+    /** The cache file that the grid and tables were mapped from. Empty if they weren't. */
+    GridCache cache;
+} SharedGrid;
+
 typedef struct {
+    /** The walkability data of the level. Always the same pointer, but its planes point into
+     * shared while the grid is shared.
+     */
     Grid *grid;
+    
+    /** The grid and tables that this arena uses with other arenas on the same map.
+     * The arena's grid, jump table, regions and hierarchy all point into it. NULL once the arena
+     * has its own copy.
+     */
+    SharedGrid *shared;
+    
+    /** The cache file that the grid and its tables were mapped from. Empty if they weren't,
+     * or if the mapping belongs to shared.
+     */
+    GridCache grid_cache;
+    
+    /** The cache file of the arena's map. Empty if the map can't be cached. */
+    char grid_cache_file[PATH_MAX];
+    
+    /** The checksum of the arena's map file. */
+    uint32_t map_checksum;
+    
+    /** Held for reading while the grid or anything built from it is used, and for writing while tiles change. */
+    pthread_rwlock_t grid_lock;
+    
+    /** Precomputed jump distances of the grid. distances is NULL if disabled. */
+    JumpTable jump_table;
+    
+    /** TRUE if Pathing:JumpTable is enabled. */
+    BOOL use_jump_table;
+    
+    /** The connected regions of the grid. Used to reject searches that can't reach their goal. */
+    ComponentMap components;
+    
+    /** The farthest SnapGoal looks for a reachable tile. */
+    int snap_radius;
+    
+    /** The cluster graph of the grid for long searches. NULL if disabled. */
+    Hierarchy *hierarchy;
+    
+    /** Searches at least this far apart (in manhattan distance) go through the hierarchy. */
+    int hierarchy_distance;
+    
+    /** The cluster size of the hierarchy. 0 if disabled. */
+    int cluster_size;
+    
+    /** The last time tiles changed. */
+    ticks_t last_update;
+    
+    /** How long the tiles have to stay the same before out of date data gets rebuilt. */
+    int rebuild_delay;
+    
+    /** TRUE while a thread is rebuilding the data built from the grid. Protected by mutex. */
+    BOOL rebuilding;
+    
+    /** TRUE if rebuild_thread was started and hasn't been joined. */
+    BOOL rebuild_started;
+    
+    /** The thread that rebuilds the data built from the grid. */
+    pthread_t rebuild_thread;
+    
+    /** Searches that expand more nodes than this are aborted. 0 for no limit. */
+    int max_expansions;
+    
+    /** Replanners that use more bytes than this are aborted. 0 for no limit. */
+    int replan_memory;
+    
+    /** The open set that new search contexts use. */
+    OpenListType open_list;
+    
+    /** TRUE if found paths skip the waypoints that can be flown past in a straight line. */
+    BOOL smooth_paths;
+    
+    /** Search contexts that aren't being used by anyone. */
+    LinkedList free_contexts;
+    
+    /** Every search context that was created for this arena. */
+    LinkedList contexts;
+    
+    /** The mutex to lock when accessing the context pool. */
+    pthread_mutex_t mutex;
+    
+    /** The number of requests for this arena that a worker is searching. Protected by request_mutex. */
+    int running_requests;
+    
+    /** Recently found paths. */
+    PathCache cache;
+    
+    /** Every flow field in use. */
+    LinkedList flow_fields;
+    
+    /** The mutex to lock when accessing the flow fields. */
+    pthread_mutex_t flow_mutex;
+    
+    /** The number of tiles a flow field reaches out from its target. */
+    int flow_radius;
+    
+    /** How far a target can move before its flow field is rebuilt. */
+    int flow_move_distance;
+    
+    /** The minimum number of ticks between rebuilds of a flow field. */
+    int flow_delay;
 } PathingArenaData;
 local int adkey;
 
-/** The function to be used in the priority queue for comparing nodes.
- * Uses the node cost and the heuristic value to determine the best node.
- * @param lhs The first node to be compared.
- * @param rhs The second node to be compared.
- * @return TRUE if the first node is better than the second node.
+/** A path request that is searched on a worker thread. */
+typedef struct PathRequest {
+    /** The arena to search in. */
+    Arena *arena;
+    
+    /** The starting x position. */
+    short startX;
+    
+    /** The starting y position. */
+    short startY;
+    
+    /** The ending x position. */
+    short endX;
+    
+    /** The ending y position. */
+    short endY;
+    
+    /** The clearance that the path needs. */
+    int clearance;
+    
+    /** The function to call on the main thread with the result. */
+    PathResultFunc callback;
+    
+    /** The userdata to pass to the callback. */
+    void *userdata;
+    
+    /** The resulting path. Set by the worker. */
+    SharedPath *path;
+    
+    /** 1 if the result should be thrown away instead of delivered. */
+    int cancelled;
+} PathRequest;
+
+/** Protects the request lists and the running request counts. */
+local pthread_mutex_t request_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Signaled when a request is added or the workers should quit. */
+local pthread_cond_t request_added = PTHREAD_COND_INITIALIZER;
+
+/** Signaled when a worker finishes searching a request. */
+local pthread_cond_t request_finished = PTHREAD_COND_INITIALIZER;
+
+/** Requests waiting for a worker. */
+local LinkedList pending_requests;
+
+/** Every request that hasn't been delivered yet. */
+local LinkedList outstanding_requests;
+
+/** The worker threads. */
+local pthread_t *workers;
+local int worker_count;
+
+/** Every shared grid that another arena can still join. */
+local LinkedList shared_grids;
+
+/** Protects shared_grids and the shared grid refcounts. */
+local pthread_mutex_t shared_grid_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** The number of threads that grids are built with. Set by Pathing:GridBuildThreads. */
+local int build_threads;
+
+/** The directory that grid cache files are kept in. Empty if Pathing:GridCacheDir disables the cache. */
+local char grid_cache_dir[PATH_MAX];
+
+/** Set to 1 when the workers should exit. */
+local int workers_quit;
+
+/** Returns the octile distance between two tiles with the hierarchy costs.
+ * It's never more than the real cost, so the jump point search stays optimal.
+ * @param x0 The first x tile
+ * @param y0 The first y tile
+ * @param x1 The second x tile
+ * @param y1 The second y tile
+ * @return the cost of the shortest move between the tiles if nothing is in the way.
  */
-int NodeComparator(const void *lhs, const void *rhs) {
-    Node *first = (Node*)lhs;
-    Node *second = (Node*)rhs;
-    return first->g + first->h < second->g + second->h;
+local int OctileDistance(int x0, int y0, int x1, int y1) {
+    int dx = abs(x1 - x0);
+    int dy = abs(y1 - y0);
+    int diagonal = dx < dy ? dx : dy;
+    
+    return diagonal * HIERARCHY_DIAGONAL_COST + (dx + dy - 2 * diagonal) * HIERARCHY_STRAIGHT_COST;
 }
 
-/** Uses manhattan distance to calculate a heuristic for finding the most optimal node.
- * Used in the jump point search algorithm.
- * @param first The first node
- * @param second The second node
- * @return The estimated cost of traveling from the first node to the second node.
+/** Returns the node at an index of a search context.
+ * @param context The search context
+ * @param index The index of the node
+ * @return the node.
  */
-int ManhattanHeuristic(Node *first, Node *second) {
-    return abs(first->x - second->x) + abs(first->y - second->y);
+local Node *NodeAt(PathSearchContext *context, int index) {
+    return &context->blocks[index / NODE_BLOCK_SIZE][index % NODE_BLOCK_SIZE];
 }
 
-/** Sets default values on each node in the grid.
- * This is different from grid_initialize because it sets the pathing values.
- * @param grid The grid to reset.
+/** Returns the table slot to start looking for a tile in.
+ * @param context The search context
+ * @param tile The tile as y * width + x
+ * @return the slot.
  */
-void ResetGrid(Grid *grid) {
-    int width = grid->width;
-    int height = grid->height;
+local int HashSlot(PathSearchContext *context, int tile) {
+    unsigned int hash = (unsigned int)tile * 2654435761u;
     
-    for (short y = 0; y < height; ++y) {
-        for (short x = 0; x < width; ++x) {
-            grid_get_node(grid, x, y)->closed = FALSE;
-            grid_get_node(grid, x, y)->opened = FALSE;
-            grid_get_node(grid, x, y)->parent = NULL;
-            grid_get_node(grid, x, y)->g = 0;
-            grid_get_node(grid, x, y)->h = 0;
-        }
+    return (int)((hash ^ (hash >> 16)) & (unsigned int)(context->table_size - 1));
+}
+
+/** Puts a node of the current search into the table.
+ * @param context The search context
+ * @param index The index of the node
+ */
+local void InsertNode(PathSearchContext *context, int index) {
+    Node *node = NodeAt(context, index);
+    int slot = HashSlot(context, node->y * context->width + node->x);
+    
+    while (context->stamps[slot] == context->generation)
+        slot = (slot + 1) & (context->table_size - 1);
+    
+    context->table[slot] = index;
+    context->stamps[slot] = context->generation;
+}
+
+/** Sets the size of the table and empties it. Stamp 0 is never a generation.
+ * @param context The search context
+ * @param size The number of slots. Must be a power of 2.
+ */
+local void ResizeTable(PathSearchContext *context, int size) {
+    context->table = arealloc(context->table, sizeof(int) * size);
+    context->stamps = arealloc(context->stamps, sizeof(unsigned int) * size);
+    context->table_size = size;
+    
+    memset(context->stamps, 0, sizeof(unsigned int) * size);
+}
+
+/** Makes room for the open set to hold the indices of every node that's allocated.
+ * @param context The search context
+ */
+local void ReserveOpenList(PathSearchContext *context) {
+    int count = context->block_count * NODE_BLOCK_SIZE;
+    
+    if (context->open_list == OPEN_LIST_BUCKETS)
+        bpq_reserve(&context->open_buckets, count);
+    else
+        ipq_reserve(&context->open_heap, count);
+}
+
+/** Returns the pathing state of a tile.
+ * A tile that wasn't touched by the current search gets a new node with its pathing values reset.
+ * @param context The search context
+ * @param x The x tile
+ * @param y The y tile
+ * @return the node of the tile.
+ */
+local Node *GetNode(PathSearchContext *context, int x, int y) {
+    int slot = HashSlot(context, y * context->width + x);
+    
+    while (context->stamps[slot] == context->generation) {
+        Node *node = NodeAt(context, context->table[slot]);
+        
+        if (node->x == x && node->y == y) return node;
+        
+        slot = (slot + 1) & (context->table_size - 1);
+    }
+    
+    int index = context->node_count++;
+    
+    if (index == context->block_count * NODE_BLOCK_SIZE) {
+        context->blocks = arealloc(context->blocks, sizeof(Node *) * (context->block_count + 1));
+        context->blocks[context->block_count++] = amalloc(sizeof(Node) * NODE_BLOCK_SIZE);
+        ReserveOpenList(context);
+    }
+    
+    Node *node = NodeAt(context, index);
+    
+    node->x = x;
+    node->y = y;
+    node->index = index;
+    node->closed = FALSE;
+    node->opened = FALSE;
+    node->parent = NULL;
+    node->g = 0;
+    node->h = 0;
+    
+    // Keep the table at most half full so probes stay short.
+    if (context->node_count * 2 > context->table_size) {
+        ResizeTable(context, context->table_size * 2);
+        
+        for (int i = 0; i < context->node_count; ++i)
+            InsertNode(context, i);
+    } else {
+        context->table[slot] = index;
+        context->stamps[slot] = context->generation;
+    }
+    
+    return node;
+}
+
+/** Allocates a search context for a grid.
+ * @param grid The grid that the context will search
+ * @param open_list The open set to use
+ * @return the new search context.
+ */
+local PathSearchContext *CreateContext(Grid *grid, OpenListType open_list) {
+    PathSearchContext *context = amalloc(sizeof(PathSearchContext));
+    
+    context->width = grid->width;
+    context->height = grid->height;
+    context->generation = 1;
+    context->open_list = open_list;
+    
+    if (open_list == OPEN_LIST_BUCKETS)
+        bpq_init(&context->open_buckets, NODE_BLOCK_SIZE, 4096);
+    else
+        ipq_init(&context->open_heap, NODE_BLOCK_SIZE, 64);
+    
+    ResizeTable(context, NODE_BLOCK_SIZE);
+    hierarchy_search_init(&context->hierarchy_search);
+    path_init(&context->path);
+    context->goal = context->best = NULL;
+    context->status = PATH_SEARCH_NOT_FOUND;
+    
+    return context;
+}
+
+/** Frees the nodes and table space of a context past what CONTEXT_KEEP_NODES needs.
+ * The current search is lost, so its result must have been copied out already.
+ * @param context The search context
+ */
+local void TrimContext(PathSearchContext *context) {
+    int keep = CONTEXT_KEEP_NODES / NODE_BLOCK_SIZE;
+    
+    if (context->block_count <= keep && context->table_size <= CONTEXT_KEEP_NODES * 2) return;
+    
+    for (int i = keep; i < context->block_count; ++i)
+        afree(context->blocks[i]);
+    
+    if (context->block_count > keep)
+        context->block_count = keep;
+    
+    // The open set can't shrink, so it starts over at the new size.
+    if (context->open_list == OPEN_LIST_BUCKETS) {
+        bpq_free(&context->open_buckets);
+        bpq_init(&context->open_buckets, context->block_count * NODE_BLOCK_SIZE, 4096);
+    } else {
+        ipq_free(&context->open_heap);
+        ipq_init(&context->open_heap, context->block_count * NODE_BLOCK_SIZE, 64);
+    }
+    
+    if (context->table_size > CONTEXT_KEEP_NODES * 2)
+        ResizeTable(context, CONTEXT_KEEP_NODES * 2);
+    
+    context->node_count = 0;
+    context->goal = context->best = NULL;
+    context->status = PATH_SEARCH_NOT_FOUND;
+    
+    if (++context->generation == 0) {
+        memset(context->stamps, 0, sizeof(unsigned int) * context->table_size);
+        context->generation = 1;
+    }
+}
+
+/** Frees a search context and its nodes.
+ * @param context The search context to free
+ */
+local void FreeContext(PathSearchContext *context) {
+    if (context->open_list == OPEN_LIST_BUCKETS)
+        bpq_free(&context->open_buckets);
+    else
+        ipq_free(&context->open_heap);
+    
+    hierarchy_search_free(&context->hierarchy_search);
+    path_free(&context->path);
+    
+    for (int i = 0; i < context->block_count; ++i)
+        afree(context->blocks[i]);
+    
+    afree(context->blocks);
+    afree(context->table);
+    afree(context->stamps);
+    afree(context);
+}
+
+/** Adds a node to the open set, or lowers its key if it's already open.
+ * @param context The search context
+ * @param key The f value of the node
+ * @param index The index of the node in its search (Node.index)
+ */
+local void OpenPush(PathSearchContext *context, int key, int index) {
+    if (context->open_list == OPEN_LIST_BUCKETS)
+        bpq_push(&context->open_buckets, key, index);
+    else
+        ipq_push(&context->open_heap, key, index);
+}
+
+/** Removes the node with the lowest f from the open set.
+ * @param context The search context
+ * @return the index of the node in its search. See NodeAt.
+ */
+local int OpenPop(PathSearchContext *context) {
+    if (context->open_list == OPEN_LIST_BUCKETS)
+        return bpq_pop(&context->open_buckets);
+    
+    return ipq_pop(&context->open_heap);
+}
+
+/** Returns whether or not the open set is empty.
+ * @param context The search context
+ * @return TRUE if there are no open nodes.
+ */
+local BOOL OpenEmpty(PathSearchContext *context) {
+    if (context->open_list == OPEN_LIST_BUCKETS)
+        return bpq_empty(&context->open_buckets);
+    
+    return ipq_empty(&context->open_heap);
+}
+
+/** Starts a new search so every tile counts as unvisited.
+ * Only sweeps the table when the generation counter wraps around.
+ * @param context The search context
+ */
+local void BeginSearch(PathSearchContext *context) {
+    if (context->open_list == OPEN_LIST_BUCKETS)
+        bpq_clear(&context->open_buckets);
+    else
+        ipq_clear(&context->open_heap);
+    
+    context->node_count = 0;
+    
+    if (++context->generation == 0) {
+        memset(context->stamps, 0, sizeof(unsigned int) * context->table_size);
+        context->generation = 1;
     }
 }
 
@@ -76,90 +691,109 @@ int clamp(int a, int min, int max) {
 /** Iterative implementation of the jumping algorithm for jump point search.
  * https://harablog.wordpress.com/2011/09/07/jump-point-search/
  * @param grid The grid
- * @param goal The goal node
+ * @param clearance The clearance that the search needs
+ * @param goal The goal tile
  * @param nx The neighbor's x value
  * @param ny The neighbor's y value
  * @param cx The node's x value
  * @param cy The node's y value
- * @return a jump point successor, or NULL if none found
+ * @param jump_point Set to the jump point successor if one was found. Can be NULL.
+ * @return TRUE if a jump point successor was found, FALSE otherwise.
  */
-Node* Jump(Grid *grid, Node *goal, short nx, short ny, short cx, short cy) {
+BOOL Jump(const Grid *grid, int clearance, GridPosition goal, short nx, short ny, short cx, short cy, GridPosition *jump_point) {
     int dx = clamp(nx - cx, -1, 1);
     int dy = clamp(ny - cy, -1, 1);
     
-    if (grid_is_valid(grid, nx, ny) && grid_get_node(grid, nx, ny) == goal) 
-        return grid_get_node(grid, nx, ny);
-    if (!grid_is_open(grid, nx, ny)) return NULL;
-    
     int offsetX = nx;
     int offsetY = ny;
     
+    if (offsetX == goal.x && offsetY == goal.y) goto found;
+    if (!grid_is_clear(grid, offsetX, offsetY, clearance)) return FALSE;
+    
     if (dx != 0 && dy != 0) {
         while (1) {
             // Check diagonally for forced neighbors
-            if ((grid_is_open(grid, offsetX - dx, offsetY + dy) && !grid_is_open(grid, offsetX - dx, offsetY)) ||
-                (grid_is_open(grid, offsetX + dx, offsetY - dy) && !grid_is_open(grid, offsetX, offsetY - dy)))
+            if ((grid_is_clear(grid, offsetX - dx, offsetY + dy, clearance) && !grid_is_clear(grid, offsetX - dx, offsetY, clearance)) ||
+                (grid_is_clear(grid, offsetX + dx, offsetY - dy, clearance) && !grid_is_clear(grid, offsetX, offsetY - dy, clearance)))
             {
-                return grid_get_node(grid, offsetX, offsetY);
+                goto found;
             }
             
             // Expand horizontally and vertically
-            if (Jump(grid, goal, offsetX + dx, offsetY, offsetX, offsetY) || Jump(grid, goal, offsetX, offsetY + dy, offsetX, offsetY))
-                return grid_get_node(grid, offsetX, offsetY);
+            if (Jump(grid, clearance, goal, offsetX + dx, offsetY, offsetX, offsetY, NULL) || Jump(grid, clearance, goal, offsetX, offsetY + dy, offsetX, offsetY, NULL))
+                goto found;
             
             offsetX += dx;
             offsetY += dy;
             
-            if (grid_is_valid(grid, offsetX, offsetY) && grid_get_node(grid, offsetX, offsetY) == goal) return grid_get_node(grid, offsetX, offsetY);
-            if (!grid_is_open(grid, offsetX, offsetY)) return NULL;
+            if (offsetX == goal.x && offsetY == goal.y) goto found;
+            if (!grid_is_clear(grid, offsetX, offsetY, clearance)) return FALSE;
         }
     } else {
         if (dx != 0) {
             while (1) {
                 // Check horizontal forced neighbors
-                if ((grid_is_open(grid, offsetX + dx, offsetY + 1) && !grid_is_open(grid, offsetX, offsetY + 1)) ||
-                    (grid_is_open(grid, offsetX + dx, offsetY - 1) && !grid_is_open(grid, offsetX, offsetY - 1)))
+                if ((grid_is_clear(grid, offsetX + dx, offsetY + 1, clearance) && !grid_is_clear(grid, offsetX, offsetY + 1, clearance)) ||
+                    (grid_is_clear(grid, offsetX + dx, offsetY - 1, clearance) && !grid_is_clear(grid, offsetX, offsetY - 1, clearance)))
                 {
-                    return grid_get_node(grid, offsetX, offsetY);
+                    goto found;
                 }
                 
                 offsetX += dx;
                 
-                if (grid_is_valid(grid, offsetX, offsetY) && grid_get_node(grid, offsetX, offsetY) == goal) return grid_get_node(grid, offsetX, offsetY);
-                if (!grid_is_open(grid, offsetX, offsetY)) return NULL;
+                if (offsetX == goal.x && offsetY == goal.y) goto found;
+                if (!grid_is_clear(grid, offsetX, offsetY, clearance)) return FALSE;
             }
         } else {
             while (1) {
                 // Check vertical forced neighbors
-                if ((grid_is_open(grid, offsetX + 1, offsetY + dy) && !grid_is_open(grid, offsetX + 1, offsetY)) ||
-                    (grid_is_open(grid, offsetX - 1, offsetY + dy) && !grid_is_open(grid, offsetX - 1, offsetY)))
+                if ((grid_is_clear(grid, offsetX + 1, offsetY + dy, clearance) && !grid_is_clear(grid, offsetX + 1, offsetY, clearance)) ||
+                    (grid_is_clear(grid, offsetX - 1, offsetY + dy, clearance) && !grid_is_clear(grid, offsetX - 1, offsetY, clearance)))
                 {
-                    return grid_get_node(grid, offsetX, offsetY);
+                    goto found;
                 }
                 
                 offsetY += dy;
                 
-                if (grid_is_valid(grid, offsetX, offsetY) && grid_get_node(grid, offsetX, offsetY) == goal) return grid_get_node(grid, offsetX, offsetY);
-                if (!grid_is_open(grid, offsetX, offsetY)) return NULL;
+                if (offsetX == goal.x && offsetY == goal.y) goto found;
+                if (!grid_is_clear(grid, offsetX, offsetY, clearance)) return FALSE;
             }
         }
     }
-    return NULL;
+
+found:
+    if (jump_point) {
+        jump_point->x = offsetX;
+        jump_point->y = offsetY;
+    }
+    return TRUE;
+}
+
+/** Adds a tile to a neighbor list.
+ * @param neighbors The neighbor list
+ * @param x The x tile
+ * @param y The y tile
+ */
+local void AddNeighbor(GridNeighbors *neighbors, int x, int y) {
+    neighbors->neighbors[neighbors->count].x = x;
+    neighbors->neighbors[neighbors->count].y = y;
+    ++neighbors->count;
 }
 
 /** Gets a list of neighbors of a node that need to be visited
  * @param grid The grid
+ * @param clearance The clearance that the search needs
  * @param node The node whose neighbors need to be found
  * @return the neighbors that weren't pruned by the jump point search pruning algorithm.
  */
-NodeNeighbors FindNeighbors(Grid *grid, Node *node) {
-    NodeNeighbors neighbors;
+GridNeighbors FindNeighbors(const Grid *grid, int clearance, Node *node) {
+    GridNeighbors neighbors;
     
     neighbors.count = 0;
     
     if (!node) return neighbors;
     // Only prune if this node has a parent
-    if (!node->parent) return grid_get_neighbors(grid, node);
+    if (!node->parent) return grid_get_neighbors(grid, node->x, node->y, clearance);
     
     int x = node->x;
     int y = node->y;
@@ -170,36 +804,36 @@ NodeNeighbors FindNeighbors(Grid *grid, Node *node) {
     
     if (dx != 0 && dy != 0) {
         // Search diagonally
-        if (grid_is_open(grid, x, y + dy))
-            neighbors.neighbors[neighbors.count++] = grid_get_node(grid, x, y + dy);
-        if (grid_is_open(grid, x + dx, y))
-            neighbors.neighbors[neighbors.count++] = grid_get_node(grid, x + dx, y);
+        if (grid_is_clear(grid, x, y + dy, clearance))
+            AddNeighbor(&neighbors, x, y + dy);
+        if (grid_is_clear(grid, x + dx, y, clearance))
+            AddNeighbor(&neighbors, x + dx, y);
             
-        if (grid_is_open(grid, x, y + dy) || grid_is_open(grid, x + dx, y))
-            neighbors.neighbors[neighbors.count++] = grid_get_node(grid, x + dx, y + dy);
+        if (grid_is_clear(grid, x, y + dy, clearance) || grid_is_clear(grid, x + dx, y, clearance))
+            AddNeighbor(&neighbors, x + dx, y + dy);
         
-        if (!grid_is_open(grid, x - dx, y) && grid_is_open(grid, x, y + dy))
-            neighbors.neighbors[neighbors.count++] = grid_get_node(grid, x - dx, y + dy);
+        if (!grid_is_clear(grid, x - dx, y, clearance) && grid_is_clear(grid, x, y + dy, clearance))
+            AddNeighbor(&neighbors, x - dx, y + dy);
             
-        if (!grid_is_open(grid, x, y - dy) && grid_is_open(grid, x + dx, y))
-            neighbors.neighbors[neighbors.count++] = grid_get_node(grid, x + dx, y - dy);
+        if (!grid_is_clear(grid, x, y - dy, clearance) && grid_is_clear(grid, x + dx, y, clearance))
+            AddNeighbor(&neighbors, x + dx, y - dy);
     } else {
         // Search horizontally and vertically
         if (dx == 0) {
-            if (grid_is_open(grid, x, y + dy)) {
-                neighbors.neighbors[neighbors.count++] = grid_get_node(grid, x, y + dy);
-                if (!grid_is_open(grid, x + 1, y))
-                    neighbors.neighbors[neighbors.count++] = grid_get_node(grid, x + 1, y + dy);
-                if (!grid_is_open(grid, x - 1, y))
-                    neighbors.neighbors[neighbors.count++] = grid_get_node(grid, x - 1, y + dy);
+            if (grid_is_clear(grid, x, y + dy, clearance)) {
+                AddNeighbor(&neighbors, x, y + dy);
+                if (!grid_is_clear(grid, x + 1, y, clearance))
+                    AddNeighbor(&neighbors, x + 1, y + dy);
+                if (!grid_is_clear(grid, x - 1, y, clearance))
+                    AddNeighbor(&neighbors, x - 1, y + dy);
             }
         } else {
-            if (grid_is_open(grid, x + dx, y)) {
-                neighbors.neighbors[neighbors.count++] = grid_get_node(grid, x + dx, y);
-                if (!grid_is_open(grid, x, y + 1))
-                    neighbors.neighbors[neighbors.count++] = grid_get_node(grid, x + dx, y + 1);
-                if (!grid_is_open(grid, x, y - 1))
-                    neighbors.neighbors[neighbors.count++] = grid_get_node(grid, x + dx, y - 1);
+            if (grid_is_clear(grid, x + dx, y, clearance)) {
+                AddNeighbor(&neighbors, x + dx, y);
+                if (!grid_is_clear(grid, x, y + 1, clearance))
+                    AddNeighbor(&neighbors, x + dx, y + 1);
+                if (!grid_is_clear(grid, x, y - 1, clearance))
+                    AddNeighbor(&neighbors, x + dx, y - 1);
             }
         }
     }
@@ -208,132 +842,1869 @@ NodeNeighbors FindNeighbors(Grid *grid, Node *node) {
 
 /** Find possible successor nodes and adds them to the open set
  * @param grid The grid
- * @param pq The priority queue / open set
+ * @param table The jump table of the grid. NULL to scan the grid instead.
+ * @param context The search context which holds the open set
  * @param node The current node
  * @param goal The goal node
  */
-void IdentifySuccessors(Grid *grid, PQueue pq, Node *node, Node *goal) {
-    NodeNeighbors neighbors = FindNeighbors(grid, node);
+void IdentifySuccessors(const Grid *grid, const JumpTable *table, PathSearchContext *context, Node *node, Node *goal) {
+    GridNeighbors neighbors = FindNeighbors(grid, context->clearance, node);
+    GridPosition goal_pos = { goal->x, goal->y };
+    GridPosition jump_pos;
     
     int ng = 0;
     
     for (int i = 0; i < neighbors.count; ++i) {
-        Node *neighbor = neighbors.neighbors[i];
-        if (!neighbor) continue;
+        GridPosition *neighbor = &neighbors.neighbors[i];
         
-        Node *jump_point = Jump(grid, goal, neighbor->x, neighbor->y, node->x, node->y);
+        BOOL found;
         
-        if (jump_point) {
-            if (jump_point->closed) continue;
+        if (table) {
+            int direction = jump_table_direction(neighbor->x - node->x, neighbor->y - node->y);
+            found = jump_table_jump(table, goal_pos, node->x, node->y, direction, &jump_pos);
+        } else {
+            found = Jump(grid, context->clearance, goal_pos, neighbor->x, neighbor->y, node->x, node->y, &jump_pos);
+        }
+        
+        if (found) {
+            Node *jump_point = GetNode(context, jump_pos.x, jump_pos.y);
             
-            int dx = jump_point->x - node->x;
-            int dy = jump_point->y - node->y;
+            if (jump_point->closed) continue;
             
-            int dist = (int)sqrt(dx * dx + dy * dy);
-            ng = node->g + dist;
+            // Jumps are straight or diagonal, so this is the exact cost of the jump.
+            ng = node->g + OctileDistance(node->x, node->y, jump_point->x, jump_point->y);
             
             if (!jump_point->opened || ng < jump_point->g) {
                 jump_point->parent = node;
                 jump_point->g = ng;
-                jump_point->h = ManhattanHeuristic(jump_point, goal);
+                jump_point->h = OctileDistance(jump_point->x, jump_point->y, goal->x, goal->y);
                 
-                if (!jump_point->opened) {
-                    jump_point->opened = TRUE;
-                    pq_push(pq, jump_point);
-                }
+                // Pushing a node that's already open lowers its key.
+                jump_point->opened = TRUE;
+                OpenPush(context, jump_point->g + jump_point->h, jump_point->index);
             }
         }
     }
 }
 
-/** Finds a path between two points using jump point search.
- * @param arena The arena to search in
+/** Starts a jump point search between two tiles.
+ * @param grid The grid
+ * @param context The search context to use
  * @param startX The starting x position.
  * @param startY The starting y position.
  * @param endX The ending x position.
  * @param endY The ending y position.
- * @return a LinkedList containing the path of nodes.
+ * @param clearance The clearance that the path needs. See grid_is_clear.
  */
-LinkedList* FindPath(Arena *arena, short startX, short startY, short endX, short endY) {
-    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
-    Grid *grid = ad->grid;
-    PQueue pq = pq_new(NodeComparator, 30);
+local void StartJPS(const Grid *grid, PathSearchContext *context, short startX, short startY, short endX, short endY, int clearance) {
+    BeginSearch(context);
     
-    ResetGrid(grid);
+    Node *start = GetNode(context, startX, startY);
     
-    Node *start = grid_get_node(grid, startX, startY);
-    Node *goal = grid_get_node(grid, endX, endY);
-    
-    if (!start || !goal) return LLAlloc();
+    context->goal = GetNode(context, endX, endY);
+    context->best = start;
+    context->expansions = 0;
+    context->epoch = grid->epoch;
+    context->clearance = clearance;
+    context->status = PATH_SEARCH_PARTIAL;
     
     start->opened = TRUE;
+    start->h = OctileDistance(start->x, start->y, context->goal->x, context->goal->y);
+    
+    OpenPush(context, start->g + start->h, start->index);
+}
+
+/** Continues a jump point search.
+ * @param grid The grid
+ * @param table The jump table of the grid. NULL to scan the grid instead.
+ * @param context The search context that the search was started with
+ * @param budget The most nodes to expand. 0 for no limit.
+ * @param max_expansions The most nodes the whole search can expand. 0 for no limit.
+ * @return the state of the search. context->goal is the end of the path if it was found.
+ */
+local PathSearchStatus RunJPS(const Grid *grid, const JumpTable *table, PathSearchContext *context, int budget, int max_expansions) {
+    if (context->status != PATH_SEARCH_PARTIAL) return context->status;
     
-    pq_push(pq, start);
+    if (context->epoch != grid->epoch)
+        return context->status = PATH_SEARCH_ABORTED;
     
-    LinkedList *path = LLAlloc();
+    int expanded = 0;
     
-    while (!pq_empty(pq)) {
-        Node *current = pq_pop(pq);
-        if (!current) continue;
+    while (!OpenEmpty(context)) {
+        if (budget > 0 && expanded >= budget) return PATH_SEARCH_PARTIAL;
+        if (max_expansions > 0 && context->expansions >= max_expansions)
+            return context->status = PATH_SEARCH_ABORTED;
+        
+        Node *current = NodeAt(context, OpenPop(context));
         
         current->closed = TRUE;
+        ++context->expansions;
+        ++expanded;
         
-        if (current == goal) {
-            while (current) {
-                LLAddFirst(path, current);
-                current = current->parent;
-            }
-            return path;
-        }
+        if (current == context->goal)
+            return context->status = PATH_SEARCH_FOUND;
+        
+        if (current->h < context->best->h || (current->h == context->best->h && current->g < context->best->g))
+            context->best = current;
         
-        IdentifySuccessors(grid, pq, current, goal);
+        IdentifySuccessors(grid, table, context, current, context->goal);
     }
-    return path;
+    
+    return context->status = PATH_SEARCH_NOT_FOUND;
 }
 
-/** Interface function for getting the arena grid.
- * @param arena The arena
- * @return the grid of the arena level.
+/** Returns the jump table of an arena if it can be used.
+ * The table is built from open tiles, so searches that need more clearance can't use it.
+ * @param ad The arena data
+ * @param clearance The clearance of the search
+ * @return the table, or NULL if it's disabled, was built from old walls or doesn't fit the clearance.
  */
-Grid* GetGrid(Arena *arena) {
-    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+local const JumpTable *GetJumpTable(PathingArenaData *ad, int clearance) {
+    if (clearance <= GRID_OPEN_CLEARANCE && ad->jump_table.distances && ad->jump_table.epoch == ad->grid->epoch)
+        return &ad->jump_table;
     
-    return ad->grid;
+    return NULL;
 }
 
-/** Determines if a tile is solid
- * @param arena The arena
- * @param x The x tile
- * @param y The y tile
- * @return TRUE if the tile is solid, FALSE otherwise.
+/** Returns the connected regions of an arena if they can be used.
+ * @param ad The arena data
+ * @return the regions, or NULL if they were built from old walls.
  */
-local BOOL IsSolid(Arena *arena, int x, int y) {
-    enum map_tile_t type = map->GetTile(arena, x, y);
-
-    return !(type == TILE_NONE || 
-             type == TILE_SAFE ||
-             type == TILE_TURF_FLAG ||
-             type == TILE_GOAL ||
-             type == 241 ||
-             type >= 252 ||
-            (type >= TILE_OVER_START && type <= TILE_UNDER_END + 1));
+local const ComponentMap *GetComponents(PathingArenaData *ad) {
+    if (ad->components.labels && ad->components.epoch == ad->grid->epoch)
+        return &ad->components;
+    
+    return NULL;
 }
 
-/** Allocates memory for the level grid.
- * @param arena The arena
+/** Determines if a straight line between two tiles only crosses tiles with enough clearance.
+ * @param grid The grid
+ * @param clearance The clearance that the line needs
+ * @param x0 The starting x tile
+ * @param y0 The starting y tile
+ * @param x1 The ending x tile
+ * @param y1 The ending y tile
+ * @return TRUE if every tile on the line is open, FALSE otherwise.
  */
-local void CreateGrid(Arena *arena) {
-    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
-    
-    ad->grid = amalloc(sizeof(Grid));
-    grid_initialize(ad->grid, 1024, 1024);
+local BOOL IsLineOpen(const Grid *grid, int clearance, int x0, int y0, int x1, int y1) {
+    int dx = abs(x1 - x0);
+    int dy = -abs(y1 - y0);
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
     
-    for (int y = 0; y < 1024; ++y) {
-        for (int x = 0; x < 1024; ++x) {
-            if (IsSolid(arena, x, y))
-                grid_set_solid(ad->grid, x, y, TRUE);
+    while (1) {
+        if (!grid_is_clear(grid, x0, y0, clearance)) return FALSE;
+        if (x0 == x1 && y0 == y1) return TRUE;
+        
+        int e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+/** Removes the waypoints that can be skipped by flying straight to a later one.
+ * A waypoint is only kept when the one after it can't be seen from the last kept waypoint.
+ * Line of sight uses the search's clearance, so the shortcuts keep the same distance from walls as the search.
+ * @param grid The grid
+ * @param clearance The clearance that the path was searched with
+ * @param path The path to smooth in place
+ */
+local void SmoothPath(const Grid *grid, int clearance, Path *path) {
+    PathPoint *points = path->points;
+    int count = 1;
+    
+    if (path->count < 3) return;
+    
+    for (int i = 2; i < path->count; ++i) {
+        PathPoint *anchor = &points[count - 1];
+        
+        if (!IsLineOpen(grid, clearance, anchor->x, anchor->y, points[i].x, points[i].y))
+            points[count++] = points[i - 1];
+    }
+    
+    points[count++] = points[path->count - 1];
+    path->count = count;
+}
+
+/** Finds a long path through the hierarchy.
+ * Only the abstract graph and the clusters along the path get searched.
+ * @param grid The grid
+ * @param hierarchy The hierarchy of the grid
+ * @param context The search context to use
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param endX The ending x position.
+ * @param endY The ending y position.
+ * @param path Filled with the points of the path.
+ * @return TRUE if a path was found, FALSE otherwise.
+ */
+local BOOL SearchHierarchy(const Grid *grid, const Hierarchy *hierarchy, PathSearchContext *context, short startX, short startY, short endX, short endY, Path *path) {
+    HierarchySearch *search = &context->hierarchy_search;
+    int count = hierarchy_find_path(hierarchy, grid, search, startX, startY, endX, endY);
+    
+    if (count == 0) return FALSE;
+    
+    PathPoint *points = path_resize(path, count);
+    
+    for (int i = 0; i < count; ++i) {
+        points[i].x = search->path[i].x;
+        points[i].y = search->path[i].y;
+    }
+    
+    return TRUE;
+}
+
+/** Copies the path that leads to a node out of the search context.
+ * @param end The last node of the path. Can be NULL.
+ * @param path Filled with the points from the start to the node.
+ */
+local void BuildPath(Node *end, Path *path) {
+    int count = 0;
+    
+    for (Node *current = end; current; current = current->parent)
+        ++count;
+    
+    PathPoint *points = path_resize(path, count);
+    
+    // The parents lead backward, so fill the points from the end.
+    for (Node *current = end; current; current = current->parent) {
+        --count;
+        points[count].x = current->x;
+        points[count].y = current->y;
+    }
+}
+
+/** Finds a path between two points using jump point search.
+ * Searches that are far apart go through the arena's hierarchy first.
+ * The caller must hold the grid lock.
+ * @param ad The arena data
+ * @param context The search context to use
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param endX The ending x position.
+ * @param endY The ending y position.
+ * @param clearance The clearance that the path needs. See grid_is_clear.
+ * @param path Filled with the points of the path. Emptied if no path was found.
+ * @return TRUE if a path was found, FALSE otherwise.
+ */
+local BOOL SearchPath(PathingArenaData *ad, PathSearchContext *context, short startX, short startY, short endX, short endY, int clearance, Path *path) {
+    Grid *grid = ad->grid;
+    
+    path_clear(path);
+    
+    if (!grid_is_valid(grid, startX, startY) || !grid_is_valid(grid, endX, endY))
+        return FALSE;
+    
+    // Tiles in different regions can't reach each other. Without this the search would flood
+    // every tile that the start can reach before giving up. Searches with more clearance only
+    // reach some of the tiles in a region, so they can still be rejected by it.
+    const ComponentMap *components = GetComponents(ad);
+    if (components && !components_connected(components, startX, startY, endX, endY))
+        return FALSE;
+    
+    BOOL found = FALSE;
+    
+    // The hierarchy is skipped while it's being rebuilt after tiles changed. It's built from
+    // open tiles, so searches that need more clearance skip it too.
+    if (clearance <= GRID_OPEN_CLEARANCE && ad->hierarchy && ad->hierarchy->epoch == grid->epoch &&
+        abs(endX - startX) + abs(endY - startY) >= ad->hierarchy_distance)
+        found = SearchHierarchy(grid, ad->hierarchy, context, startX, startY, endX, endY, path);
+    
+    if (!found) {
+        // Either the search is short or the hierarchy couldn't find a path, so search the whole grid.
+        StartJPS(grid, context, startX, startY, endX, endY, clearance);
+        
+        if (RunJPS(grid, GetJumpTable(ad, clearance), context, 0, ad->max_expansions) != PATH_SEARCH_FOUND)
+            return FALSE;
+        
+        BuildPath(context->goal, path);
+    }
+    
+    if (ad->smooth_paths)
+        SmoothPath(grid, clearance, path);
+    
+    return TRUE;
+}
+
+/** Finds a path between two points.
+ * Searches with different contexts can run at the same time on any thread.
+ * @param arena The arena to search in
+ * @param context The search context to use
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param endX The ending x position.
+ * @param endY The ending y position.
+ * @param clearance The clearance that the path needs. See grid_is_clear.
+ * @param path Filled with the points of the path. Emptied if no path was found.
+ * @return TRUE if a path was found, FALSE otherwise.
+ */
+BOOL FindPathContext(Arena *arena, PathSearchContext *context, short startX, short startY, short endX, short endY, int clearance, Path *path) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    pthread_rwlock_rdlock(&ad->grid_lock);
+    BOOL found = SearchPath(ad, context, startX, startY, endX, endY, clearance, path);
+    pthread_rwlock_unlock(&ad->grid_lock);
+    
+    return found;
+}
+
+/** Starts an incremental search. Only uses jump point search, so the amount of work
+ * can be limited by the expansion budget.
+ * @param arena The arena to search in
+ * @param context The search context to use
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param endX The ending x position.
+ * @param endY The ending y position.
+ * @param clearance The clearance that the path needs. See grid_is_clear.
+ */
+void BeginPathSearch(Arena *arena, PathSearchContext *context, short startX, short startY, short endX, short endY, int clearance) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    Grid *grid = ad->grid;
+    
+    if (!grid_is_valid(grid, startX, startY) || !grid_is_valid(grid, endX, endY)) {
+        context->goal = context->best = NULL;
+        context->status = PATH_SEARCH_NOT_FOUND;
+        return;
+    }
+    
+    pthread_rwlock_rdlock(&ad->grid_lock);
+    StartJPS(grid, context, startX, startY, endX, endY, clearance);
+    pthread_rwlock_unlock(&ad->grid_lock);
+}
+
+/** Continues an incremental search.
+ * @param arena The arena that the search was started in
+ * @param context The search context that the search was started with
+ * @param budget The most nodes to expand during this call. 0 for no limit besides Pathing:MaxExpansions.
+ * @param path Emptied and then filled with the best path so far.
+ * @return the state of the search.
+ */
+PathSearchStatus ContinuePathSearch(Arena *arena, PathSearchContext *context, int budget, Path *path) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    PathSearchStatus status = context->status;
+    
+    path_clear(path);
+    
+    if (!context->best) return status;
+    
+    pthread_rwlock_rdlock(&ad->grid_lock);
+    
+    // A search that was started before tiles changed is aborted here.
+    if (status == PATH_SEARCH_PARTIAL)
+        status = RunJPS(ad->grid, GetJumpTable(ad, context->clearance), context, budget, ad->max_expansions);
+    
+    BuildPath(status == PATH_SEARCH_FOUND ? context->goal : context->best, path);
+    
+    if (ad->smooth_paths)
+        SmoothPath(ad->grid, context->clearance, path);
+    
+    pthread_rwlock_unlock(&ad->grid_lock);
+    
+    return status;
+}
+
+/** Borrows a search context from the arena's pool.
+ * A new context is created if every pooled context is in use. Only MAX_POOLED_CONTEXTS are
+ * kept once they're released.
+ * @param arena The arena
+ * @return a search context for the arena's grid.
+ */
+PathSearchContext* AcquireContext(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    PathSearchContext *context;
+    
+    pthread_mutex_lock(&ad->mutex);
+    
+    context = LLRemoveFirst(&ad->free_contexts);
+    if (!context) {
+        context = CreateContext(ad->grid, ad->open_list);
+        LLAdd(&ad->contexts, context);
+    }
+    
+    pthread_mutex_unlock(&ad->mutex);
+    
+    return context;
+}
+
+/** Returns a search context to the arena's pool.
+ * @param arena The arena
+ * @param context The context that was acquired from the arena
+ */
+void ReleaseContext(Arena *arena, PathSearchContext *context) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    pthread_mutex_lock(&ad->mutex);
+    
+    if (LLCount(&ad->free_contexts) < MAX_POOLED_CONTEXTS) {
+        TrimContext(context);
+        LLAddFirst(&ad->free_contexts, context);
+    } else {
+        LLRemove(&ad->contexts, context);
+        FreeContext(context);
+    }
+    
+    pthread_mutex_unlock(&ad->mutex);
+}
+
+/** Finds a path between two points with a context from the arena's pool.
+ * @param arena The arena to search in
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param endX The ending x position.
+ * @param endY The ending y position.
+ * @param clearance The clearance that the path needs. See grid_is_clear.
+ * @param path Filled with the points of the path. Emptied if no path was found.
+ * @return TRUE if a path was found, FALSE otherwise.
+ */
+BOOL FindPath(Arena *arena, short startX, short startY, short endX, short endY, int clearance, Path *path) {
+    PathSearchContext *context = AcquireContext(arena);
+    BOOL found = FindPathContext(arena, context, startX, startY, endX, endY, clearance, path);
+    
+    ReleaseContext(arena, context);
+    
+    return found;
+}
+
+/** Moves a goal to the closest open tile that can be reached from a start.
+ * @param arena The arena
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param goalX The goal x position. Set to the reachable tile.
+ * @param goalY The goal y position. Set to the reachable tile.
+ * @return TRUE if the goal can be reached, FALSE if no tile within Pathing:SnapRadius can be.
+ */
+BOOL SnapGoal(Arena *arena, short startX, short startY, short *goalX, short *goalY) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    BOOL result = FALSE;
+    
+    pthread_rwlock_rdlock(&ad->grid_lock);
+    
+    const ComponentMap *components = GetComponents(ad);
+    
+    if (!components) {
+        result = grid_is_valid(ad->grid, *goalX, *goalY);
+    } else {
+        int label = components_label_near(components, startX, startY);
+        
+        if (label != COMPONENT_NONE)
+            result = components_nearest(components, label, goalX, goalY, ad->snap_radius);
+    }
+    
+    pthread_rwlock_unlock(&ad->grid_lock);
+    
+    return result;
+}
+
+/** Allocates a shared path with one reference.
+ * @param count The number of points in the path
+ * @return the new path.
+ */
+local SharedPath *CreateSharedPath(int count) {
+    SharedPath *path = amalloc(sizeof(SharedPath) + sizeof(PathPoint) * count);
+    
+    path->refcount = 1;
+    path->count = count;
+    
+    return path;
+}
+
+/** Adds a reference to a shared path.
+ * @param path The path
+ * @return the path.
+ */
+local SharedPath *RetainPath(SharedPath *path) {
+    __sync_fetch_and_add(&path->refcount, 1);
+    return path;
+}
+
+/** Gives back a reference to a shared path. The path is freed with the last reference.
+ * @param path The path. Can be NULL.
+ */
+void ReleasePath(SharedPath *path) {
+    if (path && __sync_sub_and_fetch(&path->refcount, 1) == 0)
+        afree(path);
+}
+
+/** Allocates the path cache.
+ * The size is set by Pathing:CacheSize and the start region by Pathing:CacheRegion in the arena conf.
+ * @param arena The arena
+ * @param cache The cache to initialize
+ */
+local void InitPathCache(Arena *arena, PathCache *cache) {
+    int buckets = 1;
+    
+    cache->capacity = config->GetInt(arena->cfg, "Pathing", "CacheSize", 256);
+    cache->region_size = config->GetInt(arena->cfg, "Pathing", "CacheRegion", 4);
+    
+    if (cache->capacity < 0) cache->capacity = 0;
+    if (cache->region_size < 1) cache->region_size = 1;
+    
+    while (buckets < cache->capacity * 2)
+        buckets *= 2;
+    
+    cache->entries = amalloc(sizeof(PathCacheEntry) * (cache->capacity + 1));
+    cache->buckets = amalloc(sizeof(int) * buckets);
+    cache->bucket_mask = buckets - 1;
+    cache->count = 0;
+    cache->head = cache->tail = -1;
+    cache->epoch = 0;
+    cache->hits = cache->misses = 0;
+    cache->path_bytes = 0;
+    
+    for (int i = 0; i < buckets; ++i)
+        cache->buckets[i] = -1;
+    
+    pthread_mutex_init(&cache->mutex, NULL);
+}
+
+/** Removes every path from the cache. The cache mutex must be locked.
+ * @param cache The cache
+ */
+local void ClearPathCache(PathCache *cache) {
+    for (int i = 0; i < cache->count; ++i)
+        ReleasePath(cache->entries[i].path);
+    
+    for (int i = 0; i <= cache->bucket_mask; ++i)
+        cache->buckets[i] = -1;
+    
+    cache->count = 0;
+    cache->head = cache->tail = -1;
+    cache->path_bytes = 0;
+}
+
+/** Frees the path cache.
+ * @param cache The cache
+ */
+local void FreePathCache(PathCache *cache) {
+    ClearPathCache(cache);
+    afree(cache->entries);
+    afree(cache->buckets);
+    pthread_mutex_destroy(&cache->mutex);
+}
+
+/** Returns the hash bucket for a key.
+ * @param cache The cache
+ * @param key The key
+ * @return the bucket index.
+ */
+local int CacheBucket(PathCache *cache, uint64_t key) {
+    return (int)((key * 0x9E3779B97F4A7C15ULL) >> 40) & cache->bucket_mask;
+}
+
+/** Moves an entry to the front of the LRU list. The cache mutex must be locked.
+ * @param cache The cache
+ * @param index The entry to move
+ */
+local void TouchCacheEntry(PathCache *cache, int index) {
+    PathCacheEntry *entry = &cache->entries[index];
+    
+    if (cache->head == index) return;
+    
+    // Unlink
+    if (entry->prev != -1) cache->entries[entry->prev].next = entry->next;
+    if (entry->next != -1) cache->entries[entry->next].prev = entry->prev;
+    if (cache->tail == index) cache->tail = entry->prev;
+    
+    // Link at the front
+    entry->prev = -1;
+    entry->next = cache->head;
+    if (cache->head != -1) cache->entries[cache->head].prev = index;
+    cache->head = index;
+    if (cache->tail == -1) cache->tail = index;
+}
+
+/** Removes an entry from its hash bucket. The cache mutex must be locked.
+ * @param cache The cache
+ * @param index The entry to remove
+ */
+local void UnlinkCacheBucket(PathCache *cache, int index) {
+    int *link = &cache->buckets[CacheBucket(cache, cache->entries[index].key)];
+    
+    while (*link != -1) {
+        if (*link == index) {
+            *link = cache->entries[index].bucket_next;
+            return;
+        }
+        link = &cache->entries[*link].bucket_next;
+    }
+}
+
+/** Creates the cache key for a search.
+ * @param cache The cache
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param endX The ending x position.
+ * @param endY The ending y position.
+ * @param clearance The clearance of the search.
+ * @return the key.
+ */
+local uint64_t CacheKey(PathCache *cache, short startX, short startY, short endX, short endY, int clearance) {
+    uint64_t region_x = (uint16_t)(startX / cache->region_size);
+    uint64_t region_y = (uint16_t)(startY / cache->region_size);
+    
+    // Start regions never need more than 12 bits, so the clearance goes in the top 4.
+    return ((uint64_t)clearance << 60) | (region_x << 48) | (region_y << 32) |
+        ((uint64_t)(uint16_t)endX << 16) | (uint64_t)(uint16_t)endY;
+}
+
+/** Looks up a cached path.
+ * A path found from another tile in the start region is only used if the start can
+ * fly straight to the path's second point.
+ * @param grid The grid
+ * @param cache The cache
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param endX The ending x position.
+ * @param endY The ending y position.
+ * @param clearance The clearance of the search.
+ * @return a new reference to the cached path, or NULL if there wasn't a usable one.
+ */
+local SharedPath *LookupPathCache(Grid *grid, PathCache *cache, short startX, short startY, short endX, short endY, int clearance) {
+    uint64_t key = CacheKey(cache, startX, startY, endX, endY, clearance);
+    SharedPath *result = NULL;
+    
+    pthread_mutex_lock(&cache->mutex);
+    
+    if (cache->epoch != grid->epoch) {
+        ClearPathCache(cache);
+        cache->epoch = grid->epoch;
+    }
+    
+    for (int index = cache->buckets[CacheBucket(cache, key)]; index != -1; index = cache->entries[index].bucket_next) {
+        PathCacheEntry *entry = &cache->entries[index];
+        SharedPath *path = entry->path;
+        
+        if (entry->key != key) continue;
+        
+        if (path->count == 0) {
+            // Another tile in the region can be cut off by a wall, so an empty path is only reused from its own tile.
+            if (entry->start_x != startX || entry->start_y != startY)
+                break;
+        } else if (path->points[0].x != startX || path->points[0].y != startY) {
+            // The cached path started from another tile in the region.
+            if (path->count < 2 || !IsLineOpen(grid, clearance, startX, startY, path->points[1].x, path->points[1].y))
+                break;
+        }
+        
+        TouchCacheEntry(cache, index);
+        result = RetainPath(path);
+        break;
+    }
+    
+    if (result)
+        ++cache->hits;
+    else
+        ++cache->misses;
+    
+    pthread_mutex_unlock(&cache->mutex);
+    
+    return result;
+}
+
+/** Adds a path to the cache, replacing any path with the same key.
+ * The least recently used path is evicted when the cache is full.
+ * @param grid The grid
+ * @param cache The cache
+ * @param epoch The grid epoch that the path was found with
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param endX The ending x position.
+ * @param endY The ending y position.
+ * @param clearance The clearance of the search.
+ * @param path The path. The cache takes a new reference.
+ */
+local void InsertPathCache(Grid *grid, PathCache *cache, unsigned int epoch, short startX, short startY, short endX, short endY, int clearance, SharedPath *path) {
+    uint64_t key = CacheKey(cache, startX, startY, endX, endY, clearance);
+    int bucket = CacheBucket(cache, key);
+    int index;
+    
+    if (cache->capacity == 0) return;
+    
+    pthread_mutex_lock(&cache->mutex);
+    
+    // The grid changed while searching.
+    if (epoch != grid->epoch || cache->epoch != epoch) {
+        pthread_mutex_unlock(&cache->mutex);
+        return;
+    }
+    
+    for (index = cache->buckets[bucket]; index != -1; index = cache->entries[index].bucket_next) {
+        if (cache->entries[index].key == key) break;
+    }
+    
+    if (index != -1) {
+        // Replace the old path for this key
+        cache->path_bytes -= sizeof(PathPoint) * cache->entries[index].path->count;
+        ReleasePath(cache->entries[index].path);
+    } else {
+        if (cache->count < cache->capacity) {
+            index = cache->count++;
+            cache->entries[index].prev = -1;
+            cache->entries[index].next = -1;
+            if (cache->tail == -1) cache->tail = index;
+            else {
+                cache->entries[index].next = cache->head;
+                cache->entries[cache->head].prev = index;
+            }
+            cache->head = index;
+        } else {
+            index = cache->tail;
+            UnlinkCacheBucket(cache, index);
+            cache->path_bytes -= sizeof(PathPoint) * cache->entries[index].path->count;
+            ReleasePath(cache->entries[index].path);
+        }
+        
+        cache->entries[index].key = key;
+        cache->entries[index].bucket_next = cache->buckets[bucket];
+        cache->buckets[bucket] = index;
+    }
+    
+    cache->entries[index].path = RetainPath(path);
+    cache->entries[index].start_x = startX;
+    cache->entries[index].start_y = startY;
+    cache->path_bytes += sizeof(PathPoint) * path->count;
+    TouchCacheEntry(cache, index);
+    
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Finds a path using the arena's path cache.
+ * @param arena The arena to search in
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param endX The ending x position.
+ * @param endY The ending y position.
+ * @param clearance The clearance that the path needs. See grid_is_clear.
+ * @return a reference to the path.
+ */
+SharedPath* FindSharedPath(Arena *arena, short startX, short startY, short endX, short endY, int clearance) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    pthread_rwlock_rdlock(&ad->grid_lock);
+    
+    unsigned int epoch = ad->grid->epoch;
+    SharedPath *path = LookupPathCache(ad->grid, &ad->cache, startX, startY, endX, endY, clearance);
+    
+    if (!path) {
+        // Search into the context's scratch path so only the shared path gets allocated.
+        PathSearchContext *context = AcquireContext(arena);
+        Path *found = &context->path;
+        
+        SearchPath(ad, context, startX, startY, endX, endY, clearance, found);
+        
+        path = CreateSharedPath(found->count);
+        if (found->count > 0)
+            memcpy(path->points, found->points, sizeof(PathPoint) * found->count);
+        
+        ReleaseContext(arena, context);
+        
+        InsertPathCache(ad->grid, &ad->cache, epoch, startX, startY, endX, endY, clearance, path);
+    } else if (path->count > 0 && (path->points[0].x != startX || path->points[0].y != startY)) {
+        // The cached path started from another tile in the region, which may not be in sight.
+        // The lookup checked the line to the second point, so the copy goes there from this start instead.
+        SharedPath *copy = CreateSharedPath(path->count);
+        
+        memcpy(copy->points, path->points, sizeof(PathPoint) * path->count);
+        copy->points[0].x = startX;
+        copy->points[0].y = startY;
+        
+        ReleasePath(path);
+        path = copy;
+    }
+    
+    pthread_rwlock_unlock(&ad->grid_lock);
+    
+    return path;
+}
+
+/** Gets a reference to the flow field for a target, building it if nobody else is using one.
+ * @param arena The arena
+ * @param key Identifies the target
+ * @param targetX The x tile of the target.
+ * @param targetY The y tile of the target.
+ * @return a reference to the field.
+ */
+SharedFlowField* AcquireFlowField(Arena *arena, const void *key, short targetX, short targetY) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    SharedFlowField *field;
+    Link *link;
+    
+    pthread_mutex_lock(&ad->flow_mutex);
+    
+    FOR_EACH(&ad->flow_fields, field, link) {
+        if (field->key == key) {
+            ++field->refcount;
+            pthread_mutex_unlock(&ad->flow_mutex);
+            return field;
+        }
+    }
+    
+    field = amalloc(sizeof(SharedFlowField));
+    field->key = key;
+    field->refcount = 1;
+    field->epoch = ad->grid->epoch;
+    field->built = current_ticks();
+    
+    flowfield_initialize(&field->field, ad->flow_radius);
+    
+    pthread_rwlock_rdlock(&ad->grid_lock);
+    flowfield_build(&field->field, ad->grid, targetX, targetY);
+    pthread_rwlock_unlock(&ad->grid_lock);
+    
+    LLAdd(&ad->flow_fields, field);
+    
+    pthread_mutex_unlock(&ad->flow_mutex);
+    
+    return field;
+}
+
+/** Gives back a reference to a flow field. The field is freed with the last reference.
+ * @param arena The arena of the field
+ * @param field The field. Can be NULL.
+ */
+void ReleaseFlowField(Arena *arena, SharedFlowField *field) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    if (!field) return;
+    
+    pthread_mutex_lock(&ad->flow_mutex);
+    
+    if (--field->refcount == 0) {
+        LLRemove(&ad->flow_fields, field);
+        flowfield_free(&field->field);
+        afree(field);
+    }
+    
+    pthread_mutex_unlock(&ad->flow_mutex);
+}
+
+/** Moves the target of a flow field. The field is only rebuilt when the target
+ * moved far enough and it wasn't rebuilt recently, or when the grid changed.
+ * @param arena The arena of the field
+ * @param field The field
+ * @param targetX The x tile of the target.
+ * @param targetY The y tile of the target.
+ */
+void MoveFlowField(Arena *arena, SharedFlowField *field, short targetX, short targetY) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    ticks_t now = current_ticks();
+    
+    pthread_mutex_lock(&ad->flow_mutex);
+    
+    int dx = abs(targetX - field->field.target_x);
+    int dy = abs(targetY - field->field.target_y);
+    
+    if (field->epoch != ad->grid->epoch ||
+        ((dx > ad->flow_move_distance || dy > ad->flow_move_distance) && TICK_DIFF(now, field->built) >= ad->flow_delay))
+    {
+        field->epoch = ad->grid->epoch;
+        field->built = now;
+        
+        pthread_rwlock_rdlock(&ad->grid_lock);
+        flowfield_build(&field->field, ad->grid, targetX, targetY);
+        pthread_rwlock_unlock(&ad->grid_lock);
+    }
+    
+    pthread_mutex_unlock(&ad->flow_mutex);
+}
+
+/** Gets the next tile toward the target of a flow field.
+ * @param arena The arena of the field
+ * @param field The field
+ * @param x The x tile
+ * @param y The y tile
+ * @param nextX Set to the x tile to move to.
+ * @param nextY Set to the y tile to move to.
+ * @return TRUE if the tile can reach the target through the field, FALSE otherwise.
+ */
+BOOL GetFlowStep(Arena *arena, SharedFlowField *field, short x, short y, short *nextX, short *nextY) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    GridPosition next;
+    BOOL result;
+    
+    pthread_mutex_lock(&ad->flow_mutex);
+    result = flowfield_next(&field->field, x, y, &next);
+    pthread_mutex_unlock(&ad->flow_mutex);
+    
+    if (result) {
+        *nextX = next.x;
+        *nextY = next.y;
+    }
+    
+    return result;
+}
+
+/** Creates a replanner that finds paths to one goal.
+ * @param arena The arena
+ * @param goalX The goal x position.
+ * @param goalY The goal y position.
+ * @return the replanner. Free it with FreeReplanner.
+ */
+Replanner *CreateReplanner(Arena *arena, short goalX, short goalY) {
+    Replanner *replanner = amalloc(sizeof(Replanner));
+    
+    dstar_init(&replanner->search, goalX, goalY);
+    path_init(&replanner->path);
+    
+    return replanner;
+}
+
+/** Frees a replanner.
+ * @param arena The arena of the replanner
+ * @param replanner The replanner. Can be NULL.
+ */
+void FreeReplanner(Arena *arena, Replanner *replanner) {
+    if (!replanner) return;
+    
+    dstar_free(&replanner->search);
+    path_free(&replanner->path);
+    afree(replanner);
+}
+
+/** Finds a path from a start to the goal of a replanner, repairing what changed since the last call.
+ * @param arena The arena
+ * @param replanner The replanner
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param budget The most nodes to expand during this call. 0 for no limit.
+ * @param path Replaced with the path if it was found, emptied if the goal can't be reached and left alone otherwise.
+ * @return the state of the search. PATH_SEARCH_ABORTED if the replanner went over Pathing:ReplanMemory.
+ */
+PathSearchStatus Replan(Arena *arena, Replanner *replanner, short startX, short startY, int budget, Path *path) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    DStar *search = &replanner->search;
+    PathSearchStatus status;
+    
+    pthread_rwlock_rdlock(&ad->grid_lock);
+    
+    const ComponentMap *components = GetComponents(ad);
+    
+    // The search tree is kept even when the goal can't be reached right now, so it can be repaired once it can.
+    if (components && !components_connected(components, startX, startY, search->goal_x, search->goal_y)) {
+        path_clear(path);
+        pthread_rwlock_unlock(&ad->grid_lock);
+        return PATH_SEARCH_NOT_FOUND;
+    }
+    
+    BOOL found = dstar_find_path(search, ad->grid, startX, startY, budget, &replanner->path);
+    
+    // Searches toward a goal that's far away can grow until they cover the map.
+    if (ad->replan_memory > 0 && dstar_memory_usage(search) > ad->replan_memory) {
+        short goalX = search->goal_x;
+        short goalY = search->goal_y;
+        
+        dstar_free(search);
+        dstar_init(search, goalX, goalY);
+        status = PATH_SEARCH_ABORTED;
+    } else if (found) {
+        if (ad->smooth_paths)
+            SmoothPath(ad->grid, GRID_OPEN_CLEARANCE, &replanner->path);
+        
+        path_copy(path, replanner->path.points, replanner->path.count);
+        status = PATH_SEARCH_FOUND;
+    } else if (!search->complete) {
+        status = PATH_SEARCH_PARTIAL;
+    } else {
+        path_clear(path);
+        status = PATH_SEARCH_NOT_FOUND;
+    }
+    
+    pthread_rwlock_unlock(&ad->grid_lock);
+    
+    return status;
+}
+
+/** Reads the flow field settings from the arena conf.
+ * @param arena The arena
+ */
+local void InitFlowFields(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    LLInit(&ad->flow_fields);
+    pthread_mutex_init(&ad->flow_mutex, NULL);
+    
+    ad->flow_radius = config->GetInt(arena->cfg, "Pathing", "FlowFieldRadius", 128);
+    ad->flow_move_distance = config->GetInt(arena->cfg, "Pathing", "FlowFieldMoveDistance", 3);
+    ad->flow_delay = config->GetInt(arena->cfg, "Pathing", "FlowFieldDelay", 25);
+    
+    if (ad->flow_radius < 1) ad->flow_radius = 1;
+    if (ad->flow_move_distance < 0) ad->flow_move_distance = 0;
+}
+
+/** Frees every flow field of the arena, even if they still have references.
+ * @param arena The arena
+ */
+local void FreeFlowFields(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    SharedFlowField *field;
+    Link *link;
+    
+    FOR_EACH(&ad->flow_fields, field, link) {
+        flowfield_free(&field->field);
+        afree(field);
+    }
+    
+    LLEmpty(&ad->flow_fields);
+    pthread_mutex_destroy(&ad->flow_mutex);
+}
+
+/** Delivers a finished request. Runs on the main thread.
+ * @param param The request
+ */
+local void DeliverPath(void *param) {
+    PathRequest *request = param;
+    int cancelled;
+    
+    pthread_mutex_lock(&request_mutex);
+    LLRemove(&outstanding_requests, request);
+    cancelled = request->cancelled;
+    pthread_mutex_unlock(&request_mutex);
+    
+    if (cancelled)
+        ReleasePath(request->path);
+    else
+        request->callback(request->arena, request->path, request->userdata);
+    
+    afree(request);
+}
+
+/** Worker thread that searches pending requests.
+ * @param param Unused
+ * @return NULL
+ */
+local void *PathWorker(void *param) {
+    pthread_mutex_lock(&request_mutex);
+    
+    while (!workers_quit) {
+        PathRequest *request = LLRemoveFirst(&pending_requests);
+        
+        if (!request) {
+            pthread_cond_wait(&request_added, &request_mutex);
+            continue;
+        }
+        
+        PathingArenaData *ad = P_ARENA_DATA(request->arena, adkey);
+        ++ad->running_requests;
+        
+        pthread_mutex_unlock(&request_mutex);
+        
+        request->path = FindSharedPath(request->arena, request->startX, request->startY, request->endX, request->endY, request->clearance);
+        
+        pthread_mutex_lock(&request_mutex);
+        
+        --ad->running_requests;
+        pthread_cond_broadcast(&request_finished);
+        
+        ml->RunInMain(DeliverPath, request);
+    }
+    
+    pthread_mutex_unlock(&request_mutex);
+    return NULL;
+}
+
+/** Requests a path to be searched on a worker thread.
+ * The callback is called on the main thread once the path is found.
+ * @param arena The arena to search in
+ * @param startX The starting x position.
+ * @param startY The starting y position.
+ * @param endX The ending x position.
+ * @param endY The ending y position.
+ * @param clearance The clearance that the path needs. See grid_is_clear.
+ * @param callback The function to call with the path.
+ * @param userdata Passed to the callback.
+ */
+void RequestPath(Arena *arena, short startX, short startY, short endX, short endY, int clearance, PathResultFunc callback, void *userdata) {
+    PathRequest *request = amalloc(sizeof(PathRequest));
+    
+    request->arena = arena;
+    request->startX = startX;
+    request->startY = startY;
+    request->endX = endX;
+    request->endY = endY;
+    request->clearance = clearance;
+    request->callback = callback;
+    request->userdata = userdata;
+    request->path = NULL;
+    request->cancelled = 0;
+    
+    pthread_mutex_lock(&request_mutex);
+    
+    LLAdd(&outstanding_requests, request);
+    
+    if (worker_count > 0) {
+        LLAdd(&pending_requests, request);
+        pthread_cond_signal(&request_added);
+        pthread_mutex_unlock(&request_mutex);
+        return;
+    }
+    
+    pthread_mutex_unlock(&request_mutex);
+    
+    // No workers were configured so search now, but still deliver from the main loop.
+    request->path = FindSharedPath(arena, startX, startY, endX, endY, clearance);
+    ml->RunInMain(DeliverPath, request);
+}
+
+/** Cancels requests so their callbacks are never called.
+ * Requests that are already being searched are thrown away when they finish.
+ * @param arena The arena of the requests
+ * @param userdata Only cancel requests with this userdata. NULL cancels every request in the arena.
+ */
+void CancelPathRequests(Arena *arena, void *userdata) {
+    PathRequest *request;
+    Link *link;
+    
+    pthread_mutex_lock(&request_mutex);
+    
+    FOR_EACH(&outstanding_requests, request, link) {
+        if (request->arena != arena) continue;
+        if (userdata && request->userdata != userdata) continue;
+        
+        request->cancelled = 1;
+        
+        // Requests that a worker hasn't taken yet can be freed now.
+        if (LLRemove(&pending_requests, request)) {
+            LLRemove(&outstanding_requests, request);
+            afree(request);
+        }
+    }
+    
+    pthread_mutex_unlock(&request_mutex);
+}
+
+/** Starts the worker threads.
+ * The amount is set by Pathing:WorkerThreads in global.conf.
+ */
+local void StartWorkers(void) {
+    LLInit(&pending_requests);
+    LLInit(&outstanding_requests);
+    
+    workers_quit = 0;
+    worker_count = config->GetInt(GLOBAL, "Pathing", "WorkerThreads", 2);
+    if (worker_count < 0) worker_count = 0;
+    
+    workers = amalloc(sizeof(pthread_t) * (worker_count + 1));
+    
+    for (int i = 0; i < worker_count; ++i) {
+        if (pthread_create(&workers[i], NULL, PathWorker, NULL) != 0) {
+            lm->Log(L_ERROR, "<pathing> Failed to create pathing worker thread.");
+            worker_count = i;
+            break;
+        }
+    }
+}
+
+/** Stops the worker threads and waits for them to exit. */
+local void StopWorkers(void) {
+    pthread_mutex_lock(&request_mutex);
+    workers_quit = 1;
+    pthread_cond_broadcast(&request_added);
+    pthread_mutex_unlock(&request_mutex);
+    
+    for (int i = 0; i < worker_count; ++i)
+        pthread_join(workers[i], NULL);
+    
+    afree(workers);
+    workers = NULL;
+    worker_count = 0;
+    
+    LLEmpty(&pending_requests);
+}
+
+/** Interface function for getting the arena grid.
+ * @param arena The arena
+ * @return the grid of the arena level.
+ */
+Grid* GetGrid(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    return ad->grid;
+}
+
+/** Determines if a type of tile is solid
+ * @param type The tile type
+ * @return TRUE if tiles of the type are solid, FALSE otherwise.
+ */
+local BOOL IsSolidType(int type) {
+    return !(type == TILE_NONE ||
+             type == TILE_SAFE ||
+             type == TILE_TURF_FLAG ||
+             type == TILE_GOAL ||
+             type == 241 ||
+             type >= 252 ||
+            (type >= TILE_OVER_START && type <= TILE_UNDER_END + 1));
+}
+
+/** Determines if a tile is solid
+ * @param arena The arena
+ * @param x The x tile
+ * @param y The y tile
+ * @return TRUE if the tile is solid, FALSE otherwise.
+ */
+local BOOL IsSolid(Arena *arena, int x, int y) {
+    return IsSolidType(map->GetTile(arena, x, y));
+}
+
+/** Reads the settings of the tables that are built from the grid.
+ * The jump table is set by Pathing:JumpTable. The cluster size is set by Pathing:ClusterSize and the
+ * search distance that uses it by Pathing:HierarchyDistance. A cluster size of 0 disables the hierarchy.
+ * @param arena The arena
+ */
+local void ReadGridSettings(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    int cluster_size = config->GetInt(arena->cfg, "Pathing", "ClusterSize", 32);
+    
+    ad->use_jump_table = config->GetInt(arena->cfg, "Pathing", "JumpTable", 1);
+    ad->hierarchy_distance = config->GetInt(arena->cfg, "Pathing", "HierarchyDistance", 64);
+    ad->cluster_size = 0;
+    
+    if (cluster_size <= 0) return;
+    
+    // Searches shorter than two clusters are faster without the hierarchy.
+    if (cluster_size < 8) cluster_size = 8;
+    ad->cluster_size = cluster_size;
+    if (ad->hierarchy_distance < cluster_size * 2)
+        ad->hierarchy_distance = cluster_size * 2;
+}
+
+/** Maps the grid and the tables built from it from the cache file of the arena's map.
+ * The file is named by a checksum of the map file, so a changed map gets a new file.
+ * @param arena The arena
+ * @return TRUE if the grid was loaded. Tables that weren't in the file are left empty.
+ */
+local BOOL LoadGridCache(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    ad->grid_cache_file[0] = 0;
+    
+    if (!grid_cache_dir[0] || !ad->map_checksum) return FALSE;
+    
+    int length = snprintf(ad->grid_cache_file, sizeof(ad->grid_cache_file), "%s/pathing-%08x.grid", grid_cache_dir, ad->map_checksum);
+    
+    if (length < 0 || length >= (int)sizeof(ad->grid_cache_file)) {
+        // A cut off name could load or overwrite another file, so the map isn't cached.
+        lm->LogA(L_WARN, "pathing", arena, "Grid cache directory is too long. The grid won't be cached.");
+        ad->grid_cache_file[0] = 0;
+        return FALSE;
+    }
+    
+    ticks_t start = current_millis();
+    Hierarchy *hierarchy = amalloc(sizeof(Hierarchy));
+    
+    if (!grid_cache_load(&ad->grid_cache, ad->grid_cache_file, ad->map_checksum, ad->grid,
+            ad->use_jump_table ? &ad->jump_table : NULL, &ad->components,
+            ad->cluster_size > 0 ? hierarchy : NULL, ad->cluster_size)) {
+        afree(hierarchy);
+        return FALSE;
+    }
+    
+    if (hierarchy->nodes)
+        ad->hierarchy = hierarchy;
+    else
+        afree(hierarchy);
+    
+    lm->LogA(L_INFO, "pathing", arena, "Mapped grid cache %s (%d bytes) in %d ms.",
+        ad->grid_cache_file, (int)ad->grid_cache.size, (int)TICK_DIFF(current_millis(), start));
+    
+    return TRUE;
+}
+
+/** Writes the grid and the tables built from it to the cache file of the arena's map.
+ * Nothing is written if everything was mapped from the file already.
+ * @param arena The arena
+ */
+local void SaveGridCache(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    if (ad->shared || !ad->grid_cache_file[0]) return;
+    
+    if (ad->grid->mapped && ad->components.mapped &&
+        (!ad->use_jump_table || ad->jump_table.mapped) &&
+        (!ad->hierarchy || ad->hierarchy->mapped))
+        return;
+    
+    ticks_t start = current_millis();
+    
+    // The directory usually exists already.
+    mkdir(grid_cache_dir, 0755);
+    
+    if (grid_cache_save(ad->grid_cache_file, ad->map_checksum, ad->grid, &ad->jump_table, &ad->components, ad->hierarchy))
+        lm->LogA(L_INFO, "pathing", arena, "Saved grid cache %s in %d ms.",
+            ad->grid_cache_file, (int)TICK_DIFF(current_millis(), start));
+    else
+        lm->LogA(L_WARN, "pathing", arena, "Failed to save grid cache %s.", ad->grid_cache_file);
+}
+
+/** Returns the checksum of the arena's map file, which identifies the map for sharing and caching.
+ * @param arena The arena
+ * @return the checksum, or 0 if the map file couldn't be read.
+ */
+local uint32_t GetMapChecksum(Arena *arena) {
+    char mapname[256];
+    
+    if (!map->GetMapFilename(arena, mapname, sizeof(mapname), NULL)) return 0;
+    
+    return grid_cache_checksum(mapname);
+}
+
+/** Points the arena's grid and tables at those of another arena on the same map, if there is one.
+ * @param arena The arena
+ * @return TRUE if a shared grid was found.
+ */
+local BOOL AcquireSharedGrid(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    SharedGrid *shared;
+    Link *link;
+    int refcount = 0;
+    
+    if (!ad->map_checksum) return FALSE;
+    
+    pthread_mutex_lock(&shared_grid_mutex);
+    
+    FOR_EACH(&shared_grids, shared, link) {
+        if (shared->map_checksum == ad->map_checksum && shared->use_jump_table == ad->use_jump_table &&
+            shared->cluster_size == ad->cluster_size) {
+            refcount = ++shared->refcount;
+            
+            *ad->grid = shared->grid;
+            ad->jump_table = shared->jump_table;
+            ad->components = shared->components;
+            ad->hierarchy = shared->hierarchy;
+            ad->shared = shared;
+            break;
+        }
+    }
+    
+    pthread_mutex_unlock(&shared_grid_mutex);
+    
+    if (!ad->shared) return FALSE;
+    
+    lm->LogA(L_INFO, "pathing", arena, "Sharing the grid of map %08x with %d other arenas.", ad->map_checksum, refcount - 1);
+    
+    return TRUE;
+}
+
+/** Hands the arena's grid and tables over to a new shared grid, so later arenas on the same map can use them.
+ * The arena keeps pointing at them. Nothing happens if the map couldn't be identified.
+ * @param arena The arena
+ */
+local void ShareGrid(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    if (ad->shared || !ad->map_checksum) return;
+    
+    SharedGrid *shared = amalloc(sizeof(SharedGrid));
+    
+    shared->map_checksum = ad->map_checksum;
+    shared->use_jump_table = ad->use_jump_table;
+    shared->cluster_size = ad->cluster_size;
+    shared->refcount = 1;
+    shared->grid = *ad->grid;
+    shared->jump_table = ad->jump_table;
+    shared->components = ad->components;
+    shared->hierarchy = ad->hierarchy;
+    shared->cache = ad->grid_cache;
+    memset(&ad->grid_cache, 0, sizeof(GridCache));
+    ad->shared = shared;
+    
+    pthread_mutex_lock(&shared_grid_mutex);
+    LLAdd(&shared_grids, shared);
+    pthread_mutex_unlock(&shared_grid_mutex);
+}
+
+/** Frees a shared grid once the last arena using it is done with it.
+ * @param shared The shared grid
+ */
+local void ReleaseSharedGrid(SharedGrid *shared) {
+    pthread_mutex_lock(&shared_grid_mutex);
+    BOOL last = --shared->refcount == 0;
+    if (last)
+        LLRemove(&shared_grids, shared);
+    pthread_mutex_unlock(&shared_grid_mutex);
+    
+    if (!last) return;
+    
+    if (shared->hierarchy) {
+        hierarchy_free(shared->hierarchy);
+        afree(shared->hierarchy);
+    }
+    
+    jump_table_free(&shared->jump_table);
+    components_free(&shared->components);
+    grid_free(&shared->grid);
+    grid_cache_close(&shared->cache);
+    afree(shared);
+}
+
+/** Gives the arena its own copy of a shared grid before its tiles change.
+ * The grid and regions are copied. The jump table and hierarchy are dropped, since the
+ * tile change makes them out of date, and get rebuilt by RebuildTimer.
+ * An arena that is the only one using the grid takes it over instead of copying it.
+ * The caller must hold the grid lock for writing.
+ * @param arena The arena
+ */
+local void UnshareGrid(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    SharedGrid *shared = ad->shared;
+    
+    pthread_mutex_lock(&shared_grid_mutex);
+    BOOL only = shared->refcount == 1;
+    if (only)
+        LLRemove(&shared_grids, shared);
+    pthread_mutex_unlock(&shared_grid_mutex);
+    
+    ad->shared = NULL;
+    
+    if (only) {
+        // The arena already points at everything, so only the mapping needs to move.
+        ad->grid_cache = shared->cache;
+        afree(shared);
+        return;
+    }
+    
+    ticks_t start = current_millis();
+    
+    grid_initialize(ad->grid, shared->grid.width, shared->grid.height);
+    grid_copy(ad->grid, &shared->grid);
+    components_copy(&ad->components, &shared->components);
+    memset(&ad->jump_table, 0, sizeof(JumpTable));
+    ad->hierarchy = NULL;
+    
+    ReleaseSharedGrid(shared);
+    
+    lm->LogA(L_INFO, "pathing", arena, "Copied the shared grid in %d ms because tiles changed.",
+        (int)TICK_DIFF(current_millis(), start));
+}
+
+/** Builds the jump table of the arena's grid unless it was mapped from the cache.
+ * Disabled by setting Pathing:JumpTable to 0 in the arena conf.
+ * @param arena The arena
+ */
+local void BuildJumpTable(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    if (!ad->use_jump_table || ad->jump_table.distances) return;
+    
+    ticks_t start = current_millis();
+    
+    jump_table_build(&ad->jump_table, ad->grid);
+    
+    lm->LogA(L_INFO, "pathing", arena, "Built jump table (%d bytes) in %d ms.",
+        jump_table_memory_usage(&ad->jump_table), (int)TICK_DIFF(current_millis(), start));
+}
+
+/** Builds the hierarchy of the arena's grid unless it was mapped from the cache.
+ * @param arena The arena
+ */
+local void CreateHierarchy(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    if (ad->cluster_size <= 0 || ad->hierarchy) return;
+    
+    ticks_t start = current_millis();
+    
+    ad->hierarchy = amalloc(sizeof(Hierarchy));
+    hierarchy_build(ad->hierarchy, ad->grid, ad->cluster_size);
+    
+    lm->LogA(L_INFO, "pathing", arena, "Built path hierarchy with %d nodes and %d edges (%d bytes) in %d ms.",
+        ad->hierarchy->node_count, ad->hierarchy->edge_count,
+        hierarchy_memory_usage(ad->hierarchy), (int)TICK_DIFF(current_millis(), start));
+}
+
+/** Shares the level grid with another arena on the same map, maps it from the cache, or reads
+ * it from the map and labels its connected regions.
+ * @param arena The arena
+ */
+local void CreateGrid(Arena *arena) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    ad->grid = amalloc(sizeof(Grid));
+    ad->shared = NULL;
+    ad->hierarchy = NULL;
+    memset(&ad->jump_table, 0, sizeof(JumpTable));
+    memset(&ad->components, 0, sizeof(ComponentMap));
+    memset(&ad->grid_cache, 0, sizeof(GridCache));
+    ad->map_checksum = GetMapChecksum(arena);
+    
+    if (AcquireSharedGrid(arena)) return;
+    
+    if (!LoadGridCache(arena)) {
+        ticks_t start = current_millis();
+        unsigned char solid_types[256];
+        unsigned char *tiles = amalloc(1024 * 1024);
+        
+        for (int type = 0; type < 256; ++type)
+            solid_types[type] = IsSolidType(type);
+        
+        // The map can only be read a tile at a time, so the tiles are copied out once and the grid is built from them.
+        for (int y = 0; y < 1024; ++y) {
+            for (int x = 0; x < 1024; ++x)
+                tiles[y * 1024 + x] = map->GetTile(arena, x, y);
+        }
+        
+        grid_initialize(ad->grid, 1024, 1024);
+        grid_build(ad->grid, tiles, solid_types, build_threads);
+        afree(tiles);
+        
+        lm->LogA(L_INFO, "pathing", arena, "Built the grid in %d ms.", (int)TICK_DIFF(current_millis(), start));
+    }
+    
+    if (ad->components.labels) return;
+    
+    ticks_t start = current_millis();
+    
+    components_build(&ad->components, ad->grid);
+    
+    lm->LogA(L_INFO, "pathing", arena, "Labeled %d regions of the grid in %d ms.",
+        ad->components.count, (int)TICK_DIFF(current_millis(), start));
+}
+
+/** Reads tiles from the map again after they changed, such as doors or bricks.
+ * Only the tiles in the rectangle and their neighbors are updated. The grid epoch changes
+ * if any tile did, so cached paths, flow fields and running searches notice.
+ * The jump table and hierarchy aren't used until they're rebuilt in the background.
+ * @param arena The arena
+ * @param left The first x tile
+ * @param top The first y tile
+ * @param right The last x tile
+ * @param bottom The last y tile
+ */
+void UpdateTiles(Arena *arena, short left, short top, short right, short bottom) {
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    Grid *grid = ad->grid;
+    BOOL changed = FALSE;
+    
+    if (left < 0) left = 0;
+    if (top < 0) top = 0;
+    if (right >= grid->width) right = grid->width - 1;
+    if (bottom >= grid->height) bottom = grid->height - 1;
+    if (left > right || top > bottom) return;
+    
+    pthread_rwlock_wrlock(&ad->grid_lock);
+    
+    BOOL components_current = GetComponents(ad) != NULL;
+    
+    for (int y = top; y <= bottom; ++y) {
+        for (int x = left; x <= right; ++x) {
+            BOOL solid = IsSolid(arena, x, y);
+            
+            // Other arenas on the same map keep the shared tiles.
+            if (ad->shared && grid_is_solid(grid, x, y) != solid)
+                UnshareGrid(arena);
+            
+            if (grid_set_solid(grid, x, y, solid))
+                changed = TRUE;
+        }
+    }
+    
+    if (changed) {
+        // The regions can be kept up to date here. The rest waits for RebuildTimer.
+        if (components_current)
+            components_update(&ad->components, grid, left, top, right, bottom);
+        
+        ad->last_update = current_ticks();
+    }
+    
+    pthread_rwlock_unlock(&ad->grid_lock);
+}
+
+/** Returns whether or not the jump table, regions or hierarchy were built from old tiles.
+ * The caller must hold the grid lock.
+ * @param ad The arena data
+ * @return TRUE if any of them need to be rebuilt.
+ */
+local BOOL IsOutOfDate(PathingArenaData *ad) {
+    unsigned int epoch = ad->grid->epoch;
+    
+    return (ad->use_jump_table && ad->jump_table.epoch != epoch) ||
+           ad->components.epoch != epoch ||
+           (ad->cluster_size > 0 && (!ad->hierarchy || ad->hierarchy->epoch != epoch));
+}
+
+/** Rebuilds everything that was built from the grid on a copy of it, so tiles can keep
+ * changing and searches keep running while it works. The new data only replaces the old
+ * if the tiles didn't change in the meantime.
+ * @param param The arena
+ * @return NULL
+ */
+local void *RebuildWorker(void *param) {
+    Arena *arena = param;
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    Grid snapshot;
+    JumpTable table;
+    ComponentMap components;
+    Hierarchy *hierarchy = NULL;
+    ticks_t start = current_millis();
+    
+    memset(&table, 0, sizeof(JumpTable));
+    memset(&components, 0, sizeof(ComponentMap));
+    
+    grid_initialize(&snapshot, ad->grid->width, ad->grid->height);
+    
+    pthread_rwlock_rdlock(&ad->grid_lock);
+    grid_copy(&snapshot, ad->grid);
+    pthread_rwlock_unlock(&ad->grid_lock);
+    
+    if (ad->use_jump_table)
+        jump_table_build(&table, &snapshot);
+    
+    // Rebuilding the regions also splits the ones that walls were added through.
+    components_build(&components, &snapshot);
+    
+    if (ad->cluster_size > 0) {
+        hierarchy = amalloc(sizeof(Hierarchy));
+        hierarchy_build(hierarchy, &snapshot, ad->cluster_size);
+    }
+    
+    pthread_rwlock_wrlock(&ad->grid_lock);
+    
+    BOOL current = snapshot.epoch == ad->grid->epoch;
+    
+    if (current) {
+        // Swap so the old data gets freed below.
+        JumpTable old_table = ad->jump_table;
+        ComponentMap old_components = ad->components;
+        Hierarchy *old_hierarchy = ad->hierarchy;
+        
+        ad->jump_table = table;
+        ad->components = components;
+        ad->hierarchy = hierarchy;
+        
+        table = old_table;
+        components = old_components;
+        hierarchy = old_hierarchy;
+    }
+    
+    pthread_rwlock_unlock(&ad->grid_lock);
+    
+    jump_table_free(&table);
+    components_free(&components);
+    if (hierarchy) {
+        hierarchy_free(hierarchy);
+        afree(hierarchy);
+    }
+    grid_free(&snapshot);
+    
+    lm->LogA(L_INFO, "pathing", arena, current ? "Rebuilt pathing data after tile changes in %d ms." :
+        "Threw away rebuilt pathing data after %d ms because tiles changed again.", (int)TICK_DIFF(current_millis(), start));
+    
+    pthread_mutex_lock(&ad->mutex);
+    ad->rebuilding = FALSE;
+    pthread_mutex_unlock(&ad->mutex);
+    
+    return NULL;
+}
+
+/** Starts a rebuild once the tiles have stopped changing for Pathing:RebuildDelay ticks.
+ * @param param The arena
+ * @return TRUE to keep the timer running.
+ */
+local int RebuildTimer(void *param) {
+    Arena *arena = param;
+    PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    pthread_mutex_lock(&ad->mutex);
+    BOOL rebuilding = ad->rebuilding;
+    pthread_mutex_unlock(&ad->mutex);
+    
+    if (rebuilding) return TRUE;
+    
+    if (ad->rebuild_started) {
+        pthread_join(ad->rebuild_thread, NULL);
+        ad->rebuild_started = FALSE;
+    }
+    
+    pthread_rwlock_rdlock(&ad->grid_lock);
+    BOOL out_of_date = IsOutOfDate(ad);
+    pthread_rwlock_unlock(&ad->grid_lock);
+    
+    if (!out_of_date || TICK_DIFF(current_ticks(), ad->last_update) < ad->rebuild_delay)
+        return TRUE;
+    
+    ad->rebuilding = TRUE;
+    
+    if (pthread_create(&ad->rebuild_thread, NULL, RebuildWorker, arena) == 0) {
+        ad->rebuild_started = TRUE;
+    } else {
+        lm->LogA(L_ERROR, "pathing", arena, "Failed to create rebuild thread.");
+        ad->rebuilding = FALSE;
+    }
+    
+    return TRUE;
+}
+
+local helptext_t help_pathcache =
+"Module: pathing\n"
+"Targets: none\n"
+"Args: [clear]\n"
+"Shows the hit rate and memory use of the arena's path cache.\n"
+"Clears the cache if 'clear' is given.\n";
+local void Cpathcache(const char *command, const char *params, Player *p, const Target *target) {
+    PathingArenaData *ad = P_ARENA_DATA(p->arena, adkey);
+    PathCache *cache = &ad->cache;
+    
+    pthread_mutex_lock(&cache->mutex);
+    
+    if (strcasecmp(params, "clear") == 0) {
+        ClearPathCache(cache);
+        cache->hits = cache->misses = 0;
+    }
+    
+    unsigned int lookups = cache->hits + cache->misses;
+    int table_bytes = sizeof(PathCacheEntry) * (cache->capacity + 1) + sizeof(int) * (cache->bucket_mask + 1);
+    int path_bytes = cache->path_bytes + sizeof(SharedPath) * cache->count;
+    
+    chat->SendMessage(p, "Path cache: %d/%d paths, %u hits, %u misses (%.1f%% hit rate).",
+        cache->count, cache->capacity, cache->hits, cache->misses,
+        lookups ? cache->hits * 100.0 / lookups : 0.0);
+    chat->SendMessage(p, "Path cache memory: %d bytes of paths, %d bytes of tables.", path_bytes, table_bytes);
+    
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+local helptext_t help_pathinfo =
+"Module: pathing\n"
+"Targets: none\n"
+"Args: none\n"
+"Shows the memory used by the arena's grid, jump table, path hierarchy and flow fields.\n";
+local void Cpathinfo(const char *command, const char *params, Player *p, const Target *target) {
+    PathingArenaData *ad = P_ARENA_DATA(p->arena, adkey);
+    
+    pthread_rwlock_rdlock(&ad->grid_lock);
+    
+    Hierarchy *hierarchy = ad->hierarchy;
+    
+    chat->SendMessage(p, "Grid: %dx%d tiles, %d bytes, epoch %u.", ad->grid->width, ad->grid->height,
+        grid_memory_usage(ad->grid), ad->grid->epoch);
+    
+    if (ad->shared) {
+        pthread_mutex_lock(&shared_grid_mutex);
+        int others = ad->shared->refcount - 1;
+        pthread_mutex_unlock(&shared_grid_mutex);
+        
+        chat->SendMessage(p, "Shared with %d other arenas on map %08x until tiles change.", others, ad->map_checksum);
+    }
+    
+    GridCache *grid_cache = ad->shared ? &ad->shared->cache : &ad->grid_cache;
+    if (grid_cache->data)
+        chat->SendMessage(p, "Mapped from %s (%d bytes). Pages are only copied once tiles change.",
+            ad->grid_cache_file, (int)grid_cache->size);
+    
+    if (ad->jump_table.distances)
+        chat->SendMessage(p, "Jump table: %d bytes%s.", jump_table_memory_usage(&ad->jump_table),
+            ad->jump_table.epoch == ad->grid->epoch ? "" : " (out of date)");
+    else if (ad->use_jump_table)
+        chat->SendMessage(p, "Jump table: waiting to be rebuilt.");
+    else
+        chat->SendMessage(p, "Jump table: disabled.");
+    
+    chat->SendMessage(p, "Regions: %d, %d bytes%s.", ad->components.count, components_memory_usage(&ad->components),
+        ad->components.epoch == ad->grid->epoch ? "" : " (out of date)");
+    
+    if (hierarchy) {
+        chat->SendMessage(p, "Hierarchy: %dx%d clusters of %d tiles, %d nodes, %d edges, %d bytes. Used for searches over %d tiles.%s",
+            hierarchy->clusters_x, hierarchy->clusters_y, hierarchy->cluster_size,
+            hierarchy->node_count, hierarchy->edge_count, hierarchy_memory_usage(hierarchy), ad->hierarchy_distance,
+            hierarchy->epoch == ad->grid->epoch ? "" : " (out of date)");
+    } else if (ad->cluster_size > 0) {
+        chat->SendMessage(p, "Hierarchy: waiting to be rebuilt.");
+    } else {
+        chat->SendMessage(p, "Hierarchy: disabled.");
+    }
+    
+    pthread_rwlock_unlock(&ad->grid_lock);
+    
+    SharedFlowField *field;
+    Link *link;
+    int fields = 0, field_bytes = 0, users = 0;
+    
+    pthread_mutex_lock(&ad->flow_mutex);
+    FOR_EACH(&ad->flow_fields, field, link) {
+        ++fields;
+        users += field->refcount;
+        field_bytes += sizeof(SharedFlowField) + flowfield_memory_usage(&field->field);
+    }
+    pthread_mutex_unlock(&ad->flow_mutex);
+    
+    chat->SendMessage(p, "Flow fields: %d fields used by %d, %d bytes.", fields, users, field_bytes);
+}
+
+/** Picks a random open tile.
+ * @param grid The grid
+ * @param seed The random state
+ * @param x Set to the x tile
+ * @param y Set to the y tile
+ * @return TRUE if an open tile was found, FALSE otherwise.
+ */
+local BOOL RandomOpenTile(const Grid *grid, unsigned int *seed, short *x, short *y) {
+    for (int tries = 0; tries < 10000; ++tries) {
+        *seed = *seed * 1103515245 + 12345;
+        *x = (*seed >> 8) % grid->width;
+        *seed = *seed * 1103515245 + 12345;
+        *y = (*seed >> 8) % grid->height;
+        
+        if (grid_is_open(grid, *x, *y)) return TRUE;
+    }
+    
+    return FALSE;
+}
+
+local helptext_t help_pathbench =
+"Module: pathing\n"
+"Targets: none\n"
+"Args: [count]\n"
+"Times <count> (default 100) random searches on the arena's map with each open set.\n"
+"Every open set searches the same tiles. The server stalls while this runs.\n";
+local void Cpathbench(const char *command, const char *params, Player *p, const Target *target) {
+    static const char *names[] = { "heap", "buckets" };
+    PathingArenaData *ad = P_ARENA_DATA(p->arena, adkey);
+    Grid *grid = ad->grid;
+    int count = atoi(params);
+    
+    if (count <= 0) count = 100;
+    
+    pthread_rwlock_rdlock(&ad->grid_lock);
+    
+    const JumpTable *table = GetJumpTable(ad, GRID_OPEN_CLEARANCE);
+    
+    for (int type = OPEN_LIST_HEAP; type <= OPEN_LIST_BUCKETS; ++type) {
+        PathSearchContext *context = CreateContext(grid, type);
+        unsigned int seed = 1;
+        int found = 0, expansions = 0;
+        ticks_t start = current_millis();
+        
+        for (int i = 0; i < count; ++i) {
+            short startX, startY, endX, endY;
+            
+            if (!RandomOpenTile(grid, &seed, &startX, &startY) || !RandomOpenTile(grid, &seed, &endX, &endY)) {
+                chat->SendMessage(p, "Not enough open tiles to search.");
+                break;
+            }
+            
+            StartJPS(grid, context, startX, startY, endX, endY, GRID_OPEN_CLEARANCE);
+            if (RunJPS(grid, table, context, 0, ad->max_expansions) == PATH_SEARCH_FOUND)
+                ++found;
+            
+            expansions += context->expansions;
         }
+        
+        int elapsed = TICK_DIFF(current_millis(), start);
+        
+        chat->SendMessage(p, "%s: %d searches in %d ms, %d found, %d expansions.%s",
+            names[type], count, elapsed, found, expansions, type == ad->open_list ? " (in use)" : "");
+        
+        FreeContext(context);
     }
+    
+    pthread_rwlock_unlock(&ad->grid_lock);
 }
 
 local int GetInterfaces(Imodman *mm_) {
@@ -343,12 +2714,13 @@ local int GetInterfaces(Imodman *mm_) {
     aman = mm->GetInterface(I_ARENAMAN, ALLARENAS);
     chat = mm->GetInterface(I_CHAT, ALLARENAS);
     cmd = mm->GetInterface(I_CMDMAN, ALLARENAS);
+    ml = mm->GetInterface(I_MAINLOOP, ALLARENAS);
     game = mm->GetInterface(I_GAME, ALLARENAS);
     pd = mm->GetInterface(I_PLAYERDATA, ALLARENAS);
     config = mm->GetInterface(I_CONFIG, ALLARENAS);
     map = mm->GetInterface(I_MAPDATA, ALLARENAS);
 
-    if (!(lm && aman && chat && cmd && game && pd && config && map))
+    if (!(lm && aman && chat && cmd && ml && game && pd && config && map))
         mm = NULL;
         
     return mm != NULL;
@@ -359,6 +2731,7 @@ local void ReleaseInterfaces(Imodman* mm_) {
     mm_->ReleaseInterface(config);
     mm_->ReleaseInterface(pd);
     mm_->ReleaseInterface(game);
+    mm_->ReleaseInterface(ml);
     mm_->ReleaseInterface(cmd);
     mm_->ReleaseInterface(chat);
     mm_->ReleaseInterface(aman);
@@ -368,7 +2741,13 @@ local void ReleaseInterfaces(Imodman* mm_) {
 
 local Ipathing pathint = {
     INTERFACE_HEAD_INIT(I_PATHING, "pathing")
-    GetGrid, FindPath
+    GetGrid, UpdateTiles, FindPath, SnapGoal,
+    AcquireContext, ReleaseContext, FindPathContext,
+    BeginPathSearch, ContinuePathSearch,
+    FindSharedPath, ReleasePath,
+    RequestPath, CancelPathRequests,
+    AcquireFlowField, ReleaseFlowField, MoveFlowField, GetFlowStep,
+    CreateReplanner, FreeReplanner, Replan
 };
 
 EXPORT const char info_pathing[] = "pathing v0.1 by monkey\n";
@@ -389,6 +2768,17 @@ EXPORT int MM_pathing(int action, Imodman *mm_, Arena* arena) {
                 break;
             }
             
+            const char *dir = config->GetStr(GLOBAL, "Pathing", "GridCacheDir");
+            if (snprintf(grid_cache_dir, sizeof(grid_cache_dir), "%s", dir ? dir : "tmp") >= (int)sizeof(grid_cache_dir)) {
+                lm->Log(L_WARN, "<pathing> Pathing:GridCacheDir is too long. Grid caching is disabled.");
+                grid_cache_dir[0] = 0;
+            }
+            build_threads = config->GetInt(GLOBAL, "Pathing", "GridBuildThreads", 4);
+            
+            LLInit(&shared_grids);
+            
+            StartWorkers();
+            
             mm->RegInterface(&pathint, ALLARENAS);
 
             rv = MM_OK;
@@ -396,8 +2786,18 @@ EXPORT int MM_pathing(int action, Imodman *mm_, Arena* arena) {
         break;
         case MM_UNLOAD:
         {
+            // Results that are still queued on the main loop would call into this module.
+            pthread_mutex_lock(&request_mutex);
+            int outstanding = !LLIsEmpty(&outstanding_requests);
+            pthread_mutex_unlock(&request_mutex);
+            
+            if (outstanding)
+                break;
+            
             if (mm->UnregInterface(&pathint, ALLARENAS) > 0)
                 break;
+            
+            StopWorkers();
             aman->FreeArenaData(adkey);
             ReleaseInterfaces(mm_);
             rv = MM_OK;
@@ -405,7 +2805,39 @@ EXPORT int MM_pathing(int action, Imodman *mm_, Arena* arena) {
         break;
         case MM_ATTACH:
         {
+            PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
+            
+            LLInit(&ad->free_contexts);
+            LLInit(&ad->contexts);
+            pthread_mutex_init(&ad->mutex, NULL);
+            ad->running_requests = 0;
+            ad->max_expansions = config->GetInt(arena->cfg, "Pathing", "MaxExpansions", 50000);
+            ad->replan_memory = config->GetInt(arena->cfg, "Pathing", "ReplanMemory", 2048) * 1024;
+            
+            const char *open_list = config->GetStr(arena->cfg, "Pathing", "OpenList");
+            ad->open_list = open_list && strcasecmp(open_list, "buckets") == 0 ? OPEN_LIST_BUCKETS : OPEN_LIST_HEAP;
+            ad->smooth_paths = config->GetInt(arena->cfg, "Pathing", "SmoothPaths", 1);
+            ad->snap_radius = config->GetInt(arena->cfg, "Pathing", "SnapRadius", 32);
+            ad->rebuild_delay = config->GetInt(arena->cfg, "Pathing", "RebuildDelay", 100);
+            ad->last_update = current_ticks();
+            ad->rebuilding = FALSE;
+            ad->rebuild_started = FALSE;
+            pthread_rwlock_init(&ad->grid_lock, NULL);
+            
+            ReadGridSettings(arena);
             CreateGrid(arena);
+            BuildJumpTable(arena);
+            CreateHierarchy(arena);
+            SaveGridCache(arena);
+            ShareGrid(arena);
+            InitPathCache(arena, &ad->cache);
+            InitFlowFields(arena);
+            
+            cmd->AddCommand("pathcache", Cpathcache, arena, help_pathcache);
+            cmd->AddCommand("pathinfo", Cpathinfo, arena, help_pathinfo);
+            cmd->AddCommand("pathbench", Cpathbench, arena, help_pathbench);
+            
+            ml->SetTimer(RebuildTimer, 50, 50, arena, arena);
             
             rv = MM_OK;
         }
@@ -413,7 +2845,50 @@ EXPORT int MM_pathing(int action, Imodman *mm_, Arena* arena) {
         case MM_DETACH:
         {
             PathingArenaData *ad = P_ARENA_DATA(arena, adkey);
-            grid_free(ad->grid);
+            PathSearchContext *context;
+            Link *link;
+            
+            cmd->RemoveCommand("pathcache", Cpathcache, arena);
+            cmd->RemoveCommand("pathinfo", Cpathinfo, arena);
+            cmd->RemoveCommand("pathbench", Cpathbench, arena);
+            
+            ml->ClearTimer(RebuildTimer, arena);
+            if (ad->rebuild_started)
+                pthread_join(ad->rebuild_thread, NULL);
+            
+            // Wait for the workers to stop using this arena's grid.
+            CancelPathRequests(arena, NULL);
+            
+            pthread_mutex_lock(&request_mutex);
+            while (ad->running_requests > 0)
+                pthread_cond_wait(&request_finished, &request_mutex);
+            pthread_mutex_unlock(&request_mutex);
+            
+            FOR_EACH(&ad->contexts, context, link)
+                FreeContext(context);
+            LLEmpty(&ad->contexts);
+            LLEmpty(&ad->free_contexts);
+            pthread_mutex_destroy(&ad->mutex);
+            
+            FreePathCache(&ad->cache);
+            FreeFlowFields(arena);
+            
+            if (ad->shared) {
+                ReleaseSharedGrid(ad->shared);
+            } else {
+                if (ad->hierarchy) {
+                    hierarchy_free(ad->hierarchy);
+                    afree(ad->hierarchy);
+                }
+                
+                jump_table_free(&ad->jump_table);
+                components_free(&ad->components);
+                grid_free(ad->grid);
+            }
+            
+            afree(ad->grid);
+            grid_cache_close(&ad->grid_cache);
+            pthread_rwlock_destroy(&ad->grid_lock);
             rv = MM_OK;
         }
         break;
@@ -3,8 +3,56 @@
 
 #include "asss.h"
 #include "grid.h"
+#include "path.h"
 
-#define I_PATHING "pathing-1"
+#define I_PATHING "pathing-12"
+
+/** The state of a single path search. Created and owned by the pathing module. */
+typedef struct PathSearchContext PathSearchContext;
+
+/** The state of an incremental path search. */
+typedef enum PathSearchStatus {
+    /** The goal was reached. The path leads to the goal. */
+    PATH_SEARCH_FOUND,
+    
+    /** The expansion budget ran out. The path leads to the closest tile so far. */
+    PATH_SEARCH_PARTIAL,
+    
+    /** The goal can't be reached. The path leads to the closest tile that can be. */
+    PATH_SEARCH_NOT_FOUND,
+    
+    /** The search went over Pathing:MaxExpansions or the grid changed, or a replanner went over Pathing:ReplanMemory.
+     * The path leads to the closest tile so far.
+     */
+    PATH_SEARCH_ABORTED
+} PathSearchStatus;
+
+/** An immutable path that can be shared between many callers.
+ * Each holder owns a reference that must be given back with ReleasePath.
+ */
+typedef struct SharedPath {
+    /** The number of references. Managed by the pathing module. */
+    int refcount;
+    
+    /** The number of points in the path. 0 if no path was found. */
+    int count;
+    
+    /** The points of the path, from the start to the goal. */
+    PathPoint points[];
+} SharedPath;
+
+/** A flow field that is shared by everyone chasing the same target. Created and owned by the pathing module. */
+typedef struct SharedFlowField SharedFlowField;
+
+/** A search to one goal that is repaired instead of redone when tiles change. Created and owned by the pathing module. */
+typedef struct Replanner Replanner;
+
+/** Called on the main thread when a requested path is ready.
+ * @param arena The arena the path was requested in
+ * @param path The path. The callback owns a reference to it.
+ * @param userdata The userdata that was passed to RequestPath
+ */
+typedef void (*PathResultFunc)(Arena *arena, SharedPath *path, void *userdata);
 
 /** Interface used for pathfinding. */
 typedef struct Ipathing {
@@ -16,15 +64,202 @@ typedef struct Ipathing {
     */
     Grid* (*GetGrid)(Arena *arena);
     
+    /** Read tiles from the map again after they changed, such as doors opening or bricks being placed.
+     * Only the tiles in the rectangle and their neighbors are updated. The grid epoch is bumped if
+     * anything changed, so anything holding on to paths can watch GetGrid(arena)->epoch.
+     * Jump tables and the hierarchy are rebuilt in the background once the tiles stop changing.
+     * @param arena The arena
+     * @param left The first x tile that changed
+     * @param top The first y tile that changed
+     * @param right The last x tile that changed
+     * @param bottom The last y tile that changed
+    */
+    void (*UpdateTiles)(Arena *arena, short left, short top, short right, short bottom);
+    
     /** Find a path from one point to another.
      * @param arena The arena to search in
      * @param startX The starting x position.
      * @param startY The starting y position.
      * @param endX The ending x position.
      * @param endY The ending y position.
-     * @return a LinkedList which contains a path of nodes.
+     * @param clearance The distance in tiles that the path keeps from walls. Use grid_clearance_for_radius
+     *        with the ship's radius, or GRID_OPEN_CLEARANCE for the usual one tile.
+     * @param path Filled with the points of the path. Emptied if no path was found.
+     * @return TRUE if a path was found, FALSE otherwise.
+    */
+    BOOL (*FindPath)(Arena *arena, short startX, short startY, short endX, short endY, int clearance, Path *path);
+    
+    /** Move a goal to the closest open tile that can be reached from a start.
+     * Useful when the goal is inside or next to a wall, or is walled off from the start.
+     * Searching for a goal that can't be reached returns right away without a path.
+     * @param arena The arena
+     * @param startX The starting x position.
+     * @param startY The starting y position.
+     * @param goalX The goal x position. Set to the reachable tile.
+     * @param goalY The goal y position. Set to the reachable tile.
+     * @return TRUE if the goal can be reached, FALSE if no tile within Pathing:SnapRadius can be.
+    */
+    BOOL (*SnapGoal)(Arena *arena, short startX, short startY, short *goalX, short *goalY);
+    
+    /** Borrow a search context from the arena's pool.
+     * The context must be given back with ReleaseContext.
+     * @param arena The arena that the context will search in
+     * @return a search context that only the caller is using.
+    */
+    PathSearchContext* (*AcquireContext)(Arena *arena);
+    
+    /** Give a search context back to the arena's pool.
+     * @param arena The arena that the context was acquired from
+     * @param context The search context
+    */
+    void (*ReleaseContext)(Arena *arena, PathSearchContext *context);
+    
+    /** Find a path from one point to another using the caller's search context.
+     * The grid isn't modified, so searches with different contexts can run in parallel.
+     * @param arena The arena to search in
+     * @param context The search context to store the search state in.
+     * @param startX The starting x position.
+     * @param startY The starting y position.
+     * @param endX The ending x position.
+     * @param endY The ending y position.
+     * @param clearance The distance in tiles that the path keeps from walls. See FindPath.
+     * @param path Filled with the points of the path. Emptied if no path was found.
+     * @return TRUE if a path was found, FALSE otherwise.
+    */
+    BOOL (*FindPathContext)(Arena *arena, PathSearchContext *context, short startX, short startY, short endX, short endY, int clearance, Path *path);
+    
+    /** Start an incremental search in the caller's search context.
+     * Nothing is searched until ContinuePathSearch is called.
+     * @param arena The arena to search in
+     * @param context The search context to store the search state in.
+     * @param startX The starting x position.
+     * @param startY The starting y position.
+     * @param endX The ending x position.
+     * @param endY The ending y position.
+     * @param clearance The distance in tiles that the path keeps from walls. See FindPath.
+    */
+    void (*BeginPathSearch)(Arena *arena, PathSearchContext *context, short startX, short startY, short endX, short endY, int clearance);
+    
+    /** Continue an incremental search for a limited number of node expansions.
+     * Call it again on a later tick while it returns PATH_SEARCH_PARTIAL.
+     * @param arena The arena that the search was started in
+     * @param context The search context that the search was started with
+     * @param budget The most nodes to expand during this call. 0 for no limit besides Pathing:MaxExpansions.
+     * @param path Filled with the points of the best path so far.
+     * @return the state of the search.
+    */
+    PathSearchStatus (*ContinuePathSearch)(Arena *arena, PathSearchContext *context, int budget, Path *path);
+    
+    /** Find a path using the arena's path cache.
+     * Paths are cached by start region and goal tile until the grid changes.
+     * @param arena The arena to search in
+     * @param startX The starting x position.
+     * @param startY The starting y position.
+     * @param endX The ending x position.
+     * @param endY The ending y position.
+     * @param clearance The distance in tiles that the path keeps from walls. See FindPath.
+     * @return a reference to the path. Give it back with ReleasePath.
+    */
+    SharedPath* (*FindSharedPath)(Arena *arena, short startX, short startY, short endX, short endY, int clearance);
+    
+    /** Give back a reference to a shared path.
+     * @param path The path. Can be NULL.
+    */
+    void (*ReleasePath)(SharedPath *path);
+    
+    /** Search for a path on a worker thread using the arena's path cache.
+     * The callback is called from the main loop once the path is found.
+     * The amount of workers is set by Pathing:WorkerThreads in global.conf.
+     * @param arena The arena to search in
+     * @param startX The starting x position.
+     * @param startY The starting y position.
+     * @param endX The ending x position.
+     * @param endY The ending y position.
+     * @param clearance The distance in tiles that the path keeps from walls. See FindPath.
+     * @param callback The function to call with the path.
+     * @param userdata Passed to the callback.
+    */
+    void (*RequestPath)(Arena *arena, short startX, short startY, short endX, short endY, int clearance, PathResultFunc callback, void *userdata);
+    
+    /** Cancel path requests so their callbacks are never called.
+     * Must be called before the userdata of a request is freed.
+     * @param arena The arena of the requests
+     * @param userdata Only cancel requests with this userdata. NULL cancels every request in the arena.
+    */
+    void (*CancelPathRequests)(Arena *arena, void *userdata);
+    
+    /** Get a reference to the flow field that leads to a target.
+     * Everyone that passes the same key shares one field, so the cost of chasing a target
+     * doesn't depend on how many are chasing it.
+     * The field covers Pathing:FlowFieldRadius tiles around the target.
+     * @param arena The arena
+     * @param key Identifies the target, such as the Player being chased.
+     * @param targetX The x tile of the target.
+     * @param targetY The y tile of the target.
+     * @return a reference to the field. Give it back with ReleaseFlowField.
+    */
+    SharedFlowField* (*AcquireFlowField)(Arena *arena, const void *key, short targetX, short targetY);
+    
+    /** Give back a reference to a flow field.
+     * @param arena The arena of the field
+     * @param field The field. Can be NULL.
+    */
+    void (*ReleaseFlowField)(Arena *arena, SharedFlowField *field);
+    
+    /** Tell a flow field where its target is now.
+     * The field is rebuilt once the target moves more than Pathing:FlowFieldMoveDistance tiles,
+     * but no more than once every Pathing:FlowFieldDelay ticks.
+     * @param arena The arena of the field
+     * @param field The field
+     * @param targetX The x tile of the target.
+     * @param targetY The y tile of the target.
+    */
+    void (*MoveFlowField)(Arena *arena, SharedFlowField *field, short targetX, short targetY);
+    
+    /** Get the next tile to move to from a tile.
+     * @param arena The arena of the field
+     * @param field The field
+     * @param x The x tile
+     * @param y The y tile
+     * @param nextX Set to the x tile to move to.
+     * @param nextY Set to the y tile to move to.
+     * @return TRUE if the tile can reach the target through the field, FALSE otherwise.
+    */
+    BOOL (*GetFlowStep)(Arena *arena, SharedFlowField *field, short x, short y, short *nextX, short *nextY);
+    
+    /** Create a replanner that finds paths to one goal from a start that moves.
+     * It keeps its search between calls, so moving the start or changing tiles with UpdateTiles
+     * only repairs the part of the search that's affected instead of searching again.
+     * Each replanner holds the tiles it has searched, so keep one per follower rather than per path.
+     * Its paths keep GRID_OPEN_CLEARANCE from walls, so ships that need more should use RequestPath.
+     * @param arena The arena
+     * @param goalX The goal x position.
+     * @param goalY The goal y position.
+     * @return the replanner. Free it with FreeReplanner.
+    */
+    Replanner* (*CreateReplanner)(Arena *arena, short goalX, short goalY);
+    
+    /** Free a replanner.
+     * @param arena The arena of the replanner
+     * @param replanner The replanner. Can be NULL.
+    */
+    void (*FreeReplanner)(Arena *arena, Replanner *replanner);
+    
+    /** Find a path from a start to the goal of a replanner for a limited number of node expansions.
+     * Only call it from the main thread or with one thread per replanner.
+     * Running out of budget keeps the work done, so call it again on a later tick while it returns
+     * PATH_SEARCH_PARTIAL. The path isn't touched until the search is done, so the old one can be followed until then.
+     * A replanner that goes over Pathing:ReplanMemory throws its search away and returns PATH_SEARCH_ABORTED.
+     * Use RequestPath instead of it after that.
+     * @param arena The arena of the replanner
+     * @param replanner The replanner
+     * @param startX The starting x position.
+     * @param startY The starting y position.
+     * @param budget The most nodes to expand during this call. 0 for no limit.
+     * @param path Replaced with the path if it was found, emptied if the goal can't be reached and left alone otherwise.
+     * @return the state of the search.
     */
-    LinkedList* (*FindPath)(Arena *arena, short startX, short startY, short endX, short endY);
+    PathSearchStatus (*Replan)(Arena *arena, Replanner *replanner, short startX, short startY, int budget, Path *path);
 } Ipathing;
 
 #endif
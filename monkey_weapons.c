@@ -3,6 +3,7 @@
 #include "asss.h"
 #include "fake.h"
 #include "packets/kill.h"
+#include "weapon_move.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -37,6 +38,9 @@ local const char *ShipNames[] = { "Warbird", "Javelin", "Spider", "Leviathan",
 typedef struct {
     /** The radius for each ship. */
     int radius[8];
+    
+    /** The largest radius of any ship. */
+    int max_radius;
 
     /** The bullet speed for each ship. */
     int bullet_speed[8];
@@ -98,13 +102,158 @@ typedef struct {
     int repel_time;
 } ArenaConfig;
 
+/** The data of a weapon that isn't needed to move it. */
+typedef struct {
+    /** The player that shot this weapon. */
+    Player *shooter;
+    
+    /** When this weapon was created in ticks. */
+    int created;
+    
+    /** The weapon level. */
+    int level;
+    
+    /** The maximum amount of damage this weapon can cause. */
+    int max_damage;
+    
+    /** Number of bounces left (bombs) */
+    int bounces_left;
+} WeaponInfo;
+
+/** The active weapons of an arena.
+ * Each field has its own array with the weapons packed at the start, so a tick reads every
+ * field in order. Destroying a weapon moves the last one into its place. Handles go through
+ * slots, which know where their weapon is packed and are reused through a free list.
+ * Weapons that were fired together are a family, linked in a ring through their slots.
+ */
+typedef struct {
+    /** The x position of each weapon in pixels. */
+    double *x;
+    
+    /** The y position of each weapon in pixels. */
+    double *y;
+    
+    /** How fast each weapon is traveling in the x direction. */
+    double *xspeed;
+    
+    /** How fast each weapon is traveling in the y direction. */
+    double *yspeed;
+    
+    /** The direction each weapon is traveling. */
+    double *rotation;
+    
+    /** How far each weapon moves in the x direction each tick, from its rotation, speed and xspeed. */
+    double *vx;
+    
+    /** How far each weapon moves in the y direction each tick, from its rotation, speed and yspeed. */
+    double *vy;
+    
+    /** The speed of each weapon in pixels / second * 10. */
+    int *speed;
+    
+    /** The tick when each weapon times out. */
+    int *expires;
+    
+    /** The type of each weapon. Values are from ppk.h */
+    unsigned char *type;
+    
+    /** The WEAPON_ flags of each weapon. */
+    unsigned char *flags;
+    
+    /** The rest of the data of each weapon. */
+    WeaponInfo *info;
+    
+    /** The slot of each weapon. */
+    int *slots;
+    
+    /** The weapons that need to be traced this tick. */
+    int *slow;
+    
+    /** The number of weapons. */
+    int count;
+    
+    /** The number of weapons and slots allocated. */
+    int capacity;
+    
+    /** The generation of each slot. Changes every time its weapon is destroyed. */
+    unsigned int *generations;
+    
+    /** Where the weapon of each slot is packed, or the next free slot if the slot is free. */
+    int *indices;
+    
+    /** The slot of the next weapon in the family of each slot. A weapon on its own points to itself. */
+    int *family;
+    
+    /** The first free slot. -1 if every slot is in use. */
+    int free_slot;
+} WeaponPool;
+
+/** The size of a player index cell in pixels. */
+#define PLAYER_CELL_SIZE 256
+
+/** The number of player index cells along each side of the map. */
+#define PLAYER_CELLS (1024 * 16 / PLAYER_CELL_SIZE)
+
+/** The highest level of a weapon. */
+#define MAX_WEAPON_LEVEL 3
+
+/** A player that weapons can hit, as it was when the index was built. */
+typedef struct {
+    /** The player. */
+    Player *player;
+    
+    /** The x position of the player in pixels. */
+    int x;
+    
+    /** The y position of the player in pixels. */
+    int y;
+    
+    /** The frequency of the player. */
+    int freq;
+    
+    /** The ship of the player. */
+    int ship;
+    
+    /** The position of the player in the arena's player list. Players are checked for hits in this order. */
+    int order;
+} IndexedPlayer;
+
+/** The players in an arena that weapons can hit, bucketed into cells by position.
+ * It's rebuilt at the start of every tick, so each weapon only checks the players around it.
+ */
+typedef struct {
+    /** The players, sorted by cell. */
+    IndexedPlayer *players;
+    
+    /** The players in the order of the arena's player list, before they're sorted. */
+    IndexedPlayer *unsorted;
+    
+    /** Filled by FindPlayers. */
+    IndexedPlayer **found;
+    
+    /** Where the players of each cell start, with the player count at the end. (PLAYER_CELLS * PLAYER_CELLS + 1) */
+    int *cell_start;
+    
+    /** The DANGER_ flags of each danger cell. (DANGER_CELLS * DANGER_CELLS) */
+    int *danger;
+    
+    /** The number of players in a safe zone. Their weapons are removed. */
+    int safe_count;
+    
+    /** The number of players. */
+    int count;
+    
+    /** The number of players allocated. */
+    int capacity;
+} PlayerIndex;
+
 /** The data that's associated with each arena. */
 typedef struct {
-    /** The list of active weapons in this arena. */
-    LinkedList weapons;
+    /** The active weapons in this arena. */
+    WeaponPool pool;
     
-    /** The list of active weapons to be destroyed next tick. */
-    LinkedList weapons_destroy;
+    /** The players that weapons can hit this tick. */
+    PlayerIndex players;
 
     /** The configuration settings for this arena. */
     ArenaConfig config;
@@ -120,149 +269,567 @@ typedef struct {
 } WeaponsArenaData;
 local int adkey;
 
+/** The data that's associated with each player. */
+typedef struct {
+    /** The last tick that the player was in a safe zone at. Set by BuildPlayerIndex. */
+    int safe_tick;
+} WeaponsPlayerData;
+local int pdkey;
+
 
 local void ReadConfig(Arena* arena);
 local int InSafe(Arena *arena, int x, int y);
 
 /************************/
 
-/** Removes weapon from arena list and frees the memory.
- * @param weapons The list of weapons that are active in the arena.
- * @param weapon The weapon that should be destroyed.
+/** Doubles the size of a weapon pool and puts the new slots on the free list.
+ * @param pool The pool to grow.
+ */
+local void GrowPool(WeaponPool *pool) {
+    int capacity = pool->capacity ? pool->capacity * 2 : 256;
+    
+    pool->x = arealloc(pool->x, sizeof(double) * capacity);
+    pool->y = arealloc(pool->y, sizeof(double) * capacity);
+    pool->xspeed = arealloc(pool->xspeed, sizeof(double) * capacity);
+    pool->yspeed = arealloc(pool->yspeed, sizeof(double) * capacity);
+    pool->rotation = arealloc(pool->rotation, sizeof(double) * capacity);
+    pool->vx = arealloc(pool->vx, sizeof(double) * capacity);
+    pool->vy = arealloc(pool->vy, sizeof(double) * capacity);
+    pool->speed = arealloc(pool->speed, sizeof(int) * capacity);
+    pool->expires = arealloc(pool->expires, sizeof(int) * capacity);
+    pool->type = arealloc(pool->type, capacity);
+    pool->flags = arealloc(pool->flags, capacity);
+    pool->info = arealloc(pool->info, sizeof(WeaponInfo) * capacity);
+    pool->slots = arealloc(pool->slots, sizeof(int) * capacity);
+    pool->slow = arealloc(pool->slow, sizeof(int) * capacity);
+    pool->generations = arealloc(pool->generations, sizeof(unsigned int) * capacity);
+    pool->indices = arealloc(pool->indices, sizeof(int) * capacity);
+    pool->family = arealloc(pool->family, sizeof(int) * capacity);
+    
+    for (int slot = pool->capacity; slot < capacity; ++slot) {
+        pool->generations[slot] = 1;
+        pool->indices[slot] = slot + 1 < capacity ? slot + 1 : -1;
+    }
+    
+    pool->free_slot = pool->capacity;
+    pool->capacity = capacity;
+}
+
+/** Frees the memory of a weapon pool and empties it.
+ * @param pool The pool to free.
+ */
+local void FreePool(WeaponPool *pool) {
+    afree(pool->x);
+    afree(pool->y);
+    afree(pool->xspeed);
+    afree(pool->yspeed);
+    afree(pool->rotation);
+    afree(pool->vx);
+    afree(pool->vy);
+    afree(pool->speed);
+    afree(pool->expires);
+    afree(pool->type);
+    afree(pool->flags);
+    afree(pool->info);
+    afree(pool->slots);
+    afree(pool->slow);
+    afree(pool->generations);
+    afree(pool->indices);
+    afree(pool->family);
+    
+    memset(pool, 0, sizeof(WeaponPool));
+    pool->free_slot = -1;
+}
+
+/** Copies everything but the slot of one weapon over another.
+ * @param pool The pool of the weapons.
+ * @param dest The index of the weapon to overwrite.
+ * @param src The index of the weapon to copy.
+ */
+local void CopyWeapon(WeaponPool *pool, int dest, int src) {
+    pool->x[dest] = pool->x[src];
+    pool->y[dest] = pool->y[src];
+    pool->xspeed[dest] = pool->xspeed[src];
+    pool->yspeed[dest] = pool->yspeed[src];
+    pool->rotation[dest] = pool->rotation[src];
+    pool->vx[dest] = pool->vx[src];
+    pool->vy[dest] = pool->vy[src];
+    pool->speed[dest] = pool->speed[src];
+    pool->expires[dest] = pool->expires[src];
+    pool->type[dest] = pool->type[src];
+    pool->flags[dest] = pool->flags[src];
+    pool->info[dest] = pool->info[src];
+}
+
+/** Adds a weapon to a pool with every field cleared.
+ * @param pool The pool to add the weapon to.
+ * @return the index of the new weapon.
+ */
+local int CreateWeapon(WeaponPool *pool) {
+    if (pool->free_slot == -1)
+        GrowPool(pool);
+    
+    int slot = pool->free_slot;
+    int index = pool->count++;
+    
+    pool->free_slot = pool->indices[slot];
+    pool->indices[slot] = index;
+    pool->family[slot] = slot;
+    pool->slots[index] = slot;
+    
+    pool->x[index] = pool->y[index] = 0;
+    pool->xspeed[index] = pool->yspeed[index] = 0;
+    pool->rotation[index] = 0;
+    pool->vx[index] = pool->vy[index] = 0;
+    pool->speed[index] = 0;
+    pool->expires[index] = 0;
+    pool->type[index] = 0;
+    pool->flags[index] = 0;
+    memset(&pool->info[index], 0, sizeof(WeaponInfo));
+    
+    return index;
+}
+
+/** Works out how far a weapon moves each tick. Must be called again when its rotation, speed or xspeed / yspeed change.
+ * @param pool The pool of the weapon.
+ * @param index The index of the weapon.
  */
-local void DestroyWeapon(LinkedList *weapons, EnemyWeapon* weapon) {
-    LLRemove(weapons, weapon);
-    afree(weapon);
+local void SetVelocity(WeaponPool *pool, int index) {
+    // A tick is 1/100 of a second.
+    double dist = (pool->speed[index] / 10.0) / 100.0;
+    
+    pool->vx[index] = cos(pool->rotation[index]) * dist + pool->xspeed[index] / 10 / 100.0;
+    pool->vy[index] = -sin(pool->rotation[index]) * dist + pool->yspeed[index] / 10 / 100.0;
 }
 
-/** Flags a weapon and its parent / children to be destroyed on next tick.
+/** Removes a weapon from a pool. The last weapon is moved into its place and every handle to it stops matching.
+ * @param pool The pool of the weapon.
+ * @param index The index of the weapon to destroy.
+ */
+local void DestroyWeapon(WeaponPool *pool, int index) {
+    int slot = pool->slots[index];
+    int last = --pool->count;
+    int previous = slot;
+    
+    // Take the weapon out of its family.
+    while (pool->family[previous] != slot)
+        previous = pool->family[previous];
+    
+    pool->family[previous] = pool->family[slot];
+    
+    if (index != last) {
+        CopyWeapon(pool, index, last);
+        pool->slots[index] = pool->slots[last];
+        pool->indices[pool->slots[index]] = index;
+    }
+    
+    // Generation 0 is kept for handles to no weapon.
+    if (++pool->generations[slot] == 0)
+        pool->generations[slot] = 1;
+    
+    pool->indices[slot] = pool->free_slot;
+    pool->free_slot = slot;
+}
+
+/** Returns the handle of a weapon.
+ * @param pool The pool of the weapon.
+ * @param index The index of the weapon.
+ * @return the handle, which stays unique after the weapon is destroyed.
+ */
+local WeaponHandle GetHandle(WeaponPool *pool, int index) {
+    WeaponHandle handle;
+    
+    handle.slot = pool->slots[index];
+    handle.generation = pool->generations[handle.slot];
+    
+    return handle;
+}
+
+/** Puts a weapon that's on its own into the family of another, so only 1 weapon of the family hits.
+ * @param pool The pool of the weapons.
+ * @param index The index of a weapon in the family.
+ * @param member The index of the weapon to add.
+ */
+local void JoinFamily(WeaponPool *pool, int index, int member) {
+    int slot = pool->slots[index];
+    int other = pool->slots[member];
+    
+    pool->family[other] = pool->family[slot];
+    pool->family[slot] = other;
+}
+
+/** Finds the weapon of a handle.
+ * @param pool The pool of the weapon.
+ * @param handle The handle of the weapon.
+ * @return the index of the weapon, or -1 if it was destroyed.
+ */
+local int FindWeapon(WeaponPool *pool, WeaponHandle handle) {
+    if (handle.generation == 0 || handle.slot < 0 || handle.slot >= pool->capacity) return -1;
+    
+    // A slot's generation changes when its weapon is destroyed, so a match is always in use.
+    if (pool->generations[handle.slot] != handle.generation) return -1;
+    
+    return pool->indices[handle.slot];
+}
+
+/** Fills in a copy of a weapon's data for callbacks.
+ * @param arena The arena of the weapon.
+ * @param index The index of the weapon.
+ * @param weapon The copy to fill in.
+ */
+local void GetWeaponData(Arena *arena, int index, EnemyWeapon *weapon) {
+    WeaponsArenaData *ad = P_ARENA_DATA(arena, adkey);
+    WeaponPool *pool = &ad->pool;
+    WeaponInfo *info = &pool->info[index];
+    
+    weapon->handle = GetHandle(pool, index);
+    weapon->arena = arena;
+    weapon->x = pool->x[index];
+    weapon->y = pool->y[index];
+    weapon->xspeed = pool->xspeed[index];
+    weapon->yspeed = pool->yspeed[index];
+    weapon->rotation = pool->rotation[index];
+    weapon->speed = pool->speed[index];
+    weapon->created = info->created;
+    weapon->bouncing = (pool->flags[index] & WEAPON_BOUNCING) != 0;
+    weapon->bounces_left = info->bounces_left;
+    weapon->type = pool->type[index];
+    weapon->level = info->level;
+    weapon->max_damage = info->max_damage;
+    weapon->shooter = info->shooter;
+    weapon->active = (pool->flags[index] & WEAPON_ACTIVE) != 0;
+}
+
+/** Returns how long a type of weapon is alive.
+ * @param ad The data of the weapon's arena.
+ * @param type The weapon type.
+ * @return the lifetime in ticks.
+ */
+local int GetLifetime(WeaponsArenaData *ad, int type) {
+    if (type == W_BOMB || type == W_PROXBOMB)
+        return ad->config.bomb_alive_time;
+    if (type == W_REPEL)
+        return UPDATE_FREQUENCY + ad->config.repel_time;
+    
+    return ad->config.bullet_alive_time;
+}
+
+/** Calls the weapon created callbacks.
+ * @param arena The arena of the weapon.
+ * @param index The index of the new weapon.
+ */
+local void WeaponCreated(Arena *arena, int index) {
+    EnemyWeapon weapon;
+    
+    GetWeaponData(arena, index, &weapon);
+    DO_CBS(CB_WEAPONCREATED, arena, WeaponCreatedFunc, (&weapon));
+}
+
+/** Flags a weapon and the rest of its family to be destroyed at the end of the tick.
  * @param arena The arena where the weapon exists.
- * @param weapon The weapon to destroy.
+ * @param index The index of the weapon to destroy.
  */
-local void FlagWeaponForDestroy(Arena *arena, EnemyWeapon *weapon) {
+local void FlagWeaponForDestroy(Arena *arena, int index) {
     WeaponsArenaData *ad = P_ARENA_DATA(arena, adkey);
+    WeaponPool *pool = &ad->pool;
     
     pthread_mutex_lock(&ad->mutex);
     
-    EnemyWeapon *parent = weapon->parent;
-    EnemyWeapon *w;
-    Link *link;
+    int slot = pool->slots[index];
     
-    FOR_EACH(&ad->weapons, w, link) {
-        if ((w == parent || w->parent == weapon || (parent && w->parent == parent)) && w->destroy == 0) {
-            w->destroy = 1;
-            LLAdd(&ad->weapons_destroy, w);
-        }
-    }
+    for (int other = pool->family[slot]; other != slot; other = pool->family[other])
+        pool->flags[pool->indices[other]] |= WEAPON_DESTROY;
     
-    if (weapon->destroy == 0) {
-        weapon->destroy = 1;
-        LLAdd(&ad->weapons_destroy, weapon);
-    }
+    pool->flags[index] |= WEAPON_DESTROY;
     
     pthread_mutex_unlock(&ad->mutex);
 }
 
-/** Does damage to all of the ai players near a bomb.
- * Arena mutex should always be locked before calling this.
- * @param arena The arena where the collision happened.
- * @param weapon The weapon that collided.
+/** Returns the player index cell that a position is in.
+ * @param position The x or y position in pixels. Positions off of the map are put in the edge cells.
+ * @return the cell along that axis.
  */
-local void DoBombDamage(Arena *arena, EnemyWeapon *weapon) {
-    WeaponsArenaData *ad = P_ARENA_DATA(arena, adkey);
+local int GetCell(double position) {
+    if (position < 0) return 0;
+    if (position >= PLAYER_CELLS * PLAYER_CELL_SIZE) return PLAYER_CELLS - 1;
     
-    int radius = ad->config.bomb_explode_pixels + ad->config.bomb_explode_pixels * weapon->level;
+    return (int)position / PLAYER_CELL_SIZE;
+}
+
+/** Flags the danger cells within a distance of a player.
+ * @param index The player index.
+ * @param target The player.
+ * @param reach The distance along each axis in pixels.
+ * @param flag The DANGER_ flag to set.
+ */
+local void MarkDanger(PlayerIndex *index, IndexedPlayer *target, int reach, int flag) {
+    int left = weapon_danger_cell(target->x - reach), right = weapon_danger_cell(target->x + reach);
+    int top = weapon_danger_cell(target->y - reach), bottom = weapon_danger_cell(target->y + reach);
     
-    if (weapon->type == W_PROXBOMB) {
-        int prox_dist = ad->config.proximity_distance + weapon->level;
-        radius += prox_dist * 16;
+    for (int cy = top; cy <= bottom; ++cy) {
+        for (int cx = left; cx <= right; ++cx)
+            index->danger[cy * DANGER_CELLS + cx] |= flag;
     }
+}
+
+/** Rebuilds the player index from the players that are in a ship in the arena.
+ * Also stamps the players in a safe zone with the tick and flags the danger cells around the players.
+ * @param arena The arena whose index should be rebuilt.
+ * @param ticks The current tick.
+ */
+local void BuildPlayerIndex(Arena *arena, int ticks) {
+    WeaponsArenaData *ad = P_ARENA_DATA(arena, adkey);
+    PlayerIndex *index = &ad->players;
+    int order = 0;
     
     Player *p;
     Link *link;
     
-    DO_CBS(CB_BOMBEXPLOSION, arena, BombExplosionFunc, (weapon));
+    index->count = 0;
+    index->safe_count = 0;
     
     pd->Lock();
-    FOR_EACH_PLAYER_IN_ARENA(p, arena) {   
-        if (p->p_ship == SHIP_SPEC || p->p_freq == weapon->shooter->p_freq) continue;
+    FOR_EACH_PLAYER_IN_ARENA(p, arena) {
+        int position = order++;
         
-        int dx = p->position.x - weapon->x;
-        int dy = p->position.y - weapon->y;
+        if (InSafe(arena, p->position.x / 16, p->position.y / 16)) {
+            WeaponsPlayerData *data = PPDATA(p, pdkey);
+            
+            data->safe_tick = ticks;
+            ++index->safe_count;
+        }
         
-        double dist = sqrt(dx * dx + dy * dy);
+        if (p->p_ship == SHIP_SPEC) continue;
+        
+        if (index->count == index->capacity) {
+            index->capacity = index->capacity ? index->capacity * 2 : 64;
+            index->players = arealloc(index->players, sizeof(IndexedPlayer) * index->capacity);
+            index->unsorted = arealloc(index->unsorted, sizeof(IndexedPlayer) * index->capacity);
+            index->found = arealloc(index->found, sizeof(IndexedPlayer *) * index->capacity);
+        }
         
-        if (dist <= radius + 4)
-            DO_CBS(CB_WEAPONHIT, arena, WeaponHitFunc, (p, weapon));
+        IndexedPlayer *entry = &index->unsorted[index->count++];
+        
+        entry->player = p;
+        entry->x = p->position.x;
+        entry->y = p->position.y;
+        entry->freq = p->p_freq;
+        entry->ship = p->p_ship;
+        entry->order = position;
     }
     pd->Unlock();
+    
+    // Count the players of each cell and sum the counts up to where each cell ends.
+    memset(index->cell_start, 0, sizeof(int) * (PLAYER_CELLS * PLAYER_CELLS + 1));
+    
+    for (int i = 0; i < index->count; ++i)
+        ++index->cell_start[GetCell(index->unsorted[i].y) * PLAYER_CELLS + GetCell(index->unsorted[i].x)];
+    
+    for (int cell = 1; cell < PLAYER_CELLS * PLAYER_CELLS; ++cell)
+        index->cell_start[cell] += index->cell_start[cell - 1];
+    
+    index->cell_start[PLAYER_CELLS * PLAYER_CELLS] = index->count;
+    
+    // Filling each cell from its end leaves its start behind and keeps the players in list order.
+    for (int i = index->count - 1; i >= 0; --i) {
+        IndexedPlayer *entry = &index->unsorted[i];
+        int cell = GetCell(entry->y) * PLAYER_CELLS + GetCell(entry->x);
+        
+        index->players[--index->cell_start[cell]] = *entry;
+    }
+    
+    // A weapon that stays in its tile moves less than a tile along each axis.
+    int near_reach = ad->config.max_radius + 3 + 16;
+    int prox_reach = near_reach + (ad->config.proximity_distance + MAX_WEAPON_LEVEL) * 16;
+    
+    memset(index->danger, 0, sizeof(int) * DANGER_CELLS * DANGER_CELLS);
+    
+    for (int i = 0; i < index->count; ++i) {
+        MarkDanger(index, &index->players[i], near_reach, DANGER_NEAR);
+        MarkDanger(index, &index->players[i], prox_reach, DANGER_PROX);
+    }
 }
 
-/** Checks for weapon/player collisions.
- * @param player The player to check
- * @param weapon The weapon to check
- * @return 1 if the weapon hit the player, 0 otherwise
+/** Finds the players that might be within a distance of a point.
+ * Every player in the cells that the distance touches is found, so some can be farther away.
+ * @param index The player index.
+ * @param x The x position in pixels.
+ * @param y The y position in pixels.
+ * @param distance The distance in pixels.
+ * @return the number of players put in index->found, which are in the order of the arena's player list.
  */
-local int CheckWeaponHit(Player *player, EnemyWeapon *weapon) {
-    if (weapon->active == 0 || weapon->destroy == 1) return 0;
-    if (weapon->shooter->p_freq == player->p_freq) return 0;
-    if (weapon->shooter == player) return 0;
-    if (weapon->type == W_REPEL) return 0;
+local int FindPlayers(PlayerIndex *index, double x, double y, double distance) {
+    int left = GetCell(x - distance), right = GetCell(x + distance);
+    int top = GetCell(y - distance), bottom = GetCell(y + distance);
+    int count = 0;
+    
+    for (int cy = top; cy <= bottom; ++cy) {
+        for (int cx = left; cx <= right; ++cx) {
+            int cell = cy * PLAYER_CELLS + cx;
+            
+            for (int i = index->cell_start[cell]; i < index->cell_start[cell + 1]; ++i) {
+                IndexedPlayer *entry = &index->players[i];
+                int j = count++;
+                
+                while (j > 0 && index->found[j - 1]->order > entry->order) {
+                    index->found[j] = index->found[j - 1];
+                    --j;
+                }
+                
+                index->found[j] = entry;
+            }
+        }
+    }
     
-    WeaponsArenaData *ad = P_ARENA_DATA(player->arena, adkey);
+    return count;
+}
 
-    pthread_mutex_lock(&ad->mutex);
+/** Does damage to all of the ai players near a bomb.
+ * Arena mutex should always be locked before calling this.
+ * @param arena The arena where the collision happened.
+ * @param index The index of the weapon that collided.
+ */
+local void DoBombDamage(Arena *arena, int index) {
+    WeaponsArenaData *ad = P_ARENA_DATA(arena, adkey);
+    EnemyWeapon weapon;
     
-    // Used for bomb calculations
-    double ed = ad->config.bomb_explode_delay;
+    GetWeaponData(arena, index, &weapon);
     
-    int ship_radius = ad->config.radius[player->p_ship] + 3;
-    int hit_dist = ship_radius;
+    int radius = ad->config.bomb_explode_pixels + ad->config.bomb_explode_pixels * weapon.level;
     
-    if (weapon->type == W_PROXBOMB) {
-        int prox_dist = ad->config.proximity_distance + weapon->level;
-        hit_dist = ship_radius + prox_dist * 16;
+    if (weapon.type == W_PROXBOMB) {
+        int prox_dist = ad->config.proximity_distance + weapon.level;
+        radius += prox_dist * 16;
     }
     
-    struct PlayerPosition *pos = &player->position;
-    
-    double x = pos->x;
-    double y = pos->y;
+    PlayerIndex *players = &ad->players;
+    int left = GetCell(weapon.x - (radius + 4)), right = GetCell(weapon.x + (radius + 4));
+    int top = GetCell(weapon.y - (radius + 4)), bottom = GetCell(weapon.y + (radius + 4));
     
-   /* if (weapon->type == W_BOMB || weapon->type == W_PROXBOMB) {
-        x += (pos->xspeed / 10) * (UPDATE_FREQUENCY / 100.0);
-        y += (pos->yspeed / 10) * (UPDATE_FREQUENCY / 100.0);
-    }*/
+    DO_CBS(CB_BOMBEXPLOSION, arena, BombExplosionFunc, (&weapon));
     
-    double dx = weapon->x - x;
-    double dy = weapon->y - y;
+    for (int cy = top; cy <= bottom; ++cy) {
+        for (int cx = left; cx <= right; ++cx) {
+            int cell = cy * PLAYER_CELLS + cx;
+            
+            for (int i = players->cell_start[cell]; i < players->cell_start[cell + 1]; ++i) {
+                IndexedPlayer *target = &players->players[i];
+                
+                if (target->freq == weapon.shooter->p_freq) continue;
+                
+                int dx = target->x - weapon.x;
+                int dy = target->y - weapon.y;
+                
+                double dist = sqrt(dx * dx + dy * dy);
+                
+                if (dist <= radius + 4)
+                    DO_CBS(CB_WEAPONHIT, arena, WeaponHitFunc, (target->player, &weapon));
+            }
+        }
+    }
+}
 
-    double dist = sqrt(dx * dx + dy * dy);
-    int rv = 0;
+/** Returns how close a weapon has to get to a player to hit them.
+ * @param target The player
+ * @param index The index of the weapon
+ * @return the distance along each axis in pixels, or -1 if the weapon can't hit the player.
+ */
+local int GetHitDistance(IndexedPlayer *target, int index) {
+    WeaponsArenaData *ad = P_ARENA_DATA(target->player->arena, adkey);
+    WeaponPool *pool = &ad->pool;
+    Player *shooter = pool->info[index].shooter;
+    int type = pool->type[index];
     
-    int x_min = x - hit_dist;
-    int x_max = x + hit_dist;
-    int y_min = x - hit_dist;
-    int y_max = x + hit_dist;
+    if (!(pool->flags[index] & WEAPON_ACTIVE) || (pool->flags[index] & WEAPON_DESTROY)) return -1;
+    if (shooter->p_freq == target->freq) return -1;
+    if (shooter == target->player) return -1;
+    if (type == W_REPEL) return -1;
     
-    if (weapon->x >= x_min && weapon->x <= x_max && weapon->y >= y_min && weapon->y <= y_max) {
-        if (weapon->type == W_PROXBOMB) {
-            // Move weapon position and player position by the bomb explode delay then calculate damage.
-            weapon->x += cos(weapon->rotation) * (ed / 100.0) + ((weapon->xspeed / 10) * (ed / 100.0));
-            weapon->y -= sin(weapon->rotation) * (ed / 100.0) - ((weapon->yspeed / 10) * (ed / 100.0));
-           
-            DoBombDamage(player->arena, weapon);
-        } else if (weapon->type == W_BOMB) {
-            DoBombDamage(player->arena, weapon);
-        } else {
-            DO_CBS(CB_WEAPONHIT, player->arena, WeaponHitFunc, (player, weapon));
-        }
+    int hit_dist = ad->config.radius[target->ship] + 3;
+    
+    if (type == W_PROXBOMB)
+        hit_dist += (ad->config.proximity_distance + pool->info[index].level) * 16;
+    
+    return hit_dist;
+}
 
-        rv = 1;
+/** Narrows down the part of a tick that a moving weapon is within a range along one axis.
+ * @param position The position of the weapon at the start of the tick
+ * @param velocity The distance the weapon moves in the whole tick
+ * @param min The start of the range
+ * @param max The end of the range
+ * @param enter The fraction of the tick when the weapon enters the range. Only made later.
+ * @param exit The fraction of the tick when the weapon leaves the range. Only made earlier.
+ * @return 1 if the weapon is still within the range for part of the tick, 0 otherwise
+ */
+local int ClipAxis(double position, double velocity, double min, double max, double *enter, double *exit) {
+    if (velocity == 0)
+        return position >= min && position <= max;
+    
+    double t0 = (min - position) / velocity;
+    double t1 = (max - position) / velocity;
+    
+    if (t0 > t1) {
+        double t = t0;
+        t0 = t1;
+        t1 = t;
     }
     
-    pthread_mutex_unlock(&ad->mutex);
-    return rv;
+    if (t0 > *enter) *enter = t0;
+    if (t1 < *exit) *exit = t1;
+    
+    return *enter <= *exit;
+}
+
+/** Finds when a moving weapon first gets close enough to a player to hit them.
+ * The player is hit anywhere in the square around them, so this is where the weapon's path enters it.
+ * @param target The player
+ * @param hit_dist The distance from GetHitDistance
+ * @param x The x position of the weapon at the start of the tick
+ * @param y The y position of the weapon at the start of the tick
+ * @param vx The distance the weapon moves along x in the whole tick
+ * @param vy The distance the weapon moves along y in the whole tick
+ * @param end The fraction of the tick that the weapon moves for
+ * @return the fraction of the tick when the weapon hits the player, or -1 if it doesn't
+ */
+local double GetHitTime(IndexedPlayer *target, int hit_dist, double x, double y, double vx, double vy, double end) {
+    double enter = 0;
+    double exit = end;
+    
+    if (!ClipAxis(x, vx, target->x - hit_dist, target->x + hit_dist, &enter, &exit)) return -1;
+    if (!ClipAxis(y, vy, target->y - hit_dist, target->y + hit_dist, &enter, &exit)) return -1;
+    
+    return enter;
+}
+
+/** Hits a player with a weapon that has reached them. Bombs explode and damage everyone
+ * around them, other weapons only hit the player.
+ * @param target The player
+ * @param index The index of the weapon
+ */
+local void HitPlayer(IndexedPlayer *target, int index) {
+    Player *player = target->player;
+    WeaponsArenaData *ad = P_ARENA_DATA(player->arena, adkey);
+    WeaponPool *pool = &ad->pool;
+    int type = pool->type[index];
+    
+    if (type == W_PROXBOMB) {
+        // Move weapon position by the bomb explode delay then calculate damage.
+        double ed = ad->config.bomb_explode_delay;
+        double rotation = pool->rotation[index];
+        
+        pool->x[index] += cos(rotation) * (ed / 100.0) + ((pool->xspeed[index] / 10) * (ed / 100.0));
+        pool->y[index] -= sin(rotation) * (ed / 100.0) - ((pool->yspeed[index] / 10) * (ed / 100.0));
+        
+        DoBombDamage(player->arena, index);
+    } else if (type == W_BOMB) {
+        DoBombDamage(player->arena, index);
+    } else {
+        EnemyWeapon weapon;
+        
+        GetWeaponData(player->arena, index, &weapon);
+        DO_CBS(CB_WEAPONHIT, player->arena, WeaponHitFunc, (player, &weapon));
+    }
 }
 
 /** Determines if the tile x, y is in a safe zone.
@@ -294,189 +861,219 @@ local int IsSolid(Arena *arena, int x, int y) {
 }
 
 /** Traces along the weapon's path
- * @param weapon The weapon is that is being traced.
+ * The path is straight until the weapon bounces, so the tiles it crosses are walked one
+ * boundary at a time and players are hit where the path first reaches them.
+ * @param arena The arena of the weapon.
+ * @param index The index of the weapon that is being traced.
  * @param dt The timestep.
  * @return Returns 1 if wall collision happened, 0 otherwise.
  */
-local int TraceWeapon(EnemyWeapon *weapon, int dt) {
-    Arena *arena = weapon->arena;
+local int TraceWeapon(Arena *arena, int index, int dt) {
     WeaponsArenaData *ad = P_ARENA_DATA(arena, adkey);
+    WeaponPool *pool = &ad->pool;
 
-    // Stop moving if it hits a wall and not bouncing
-    double x = weapon->x;
-    double y = weapon->y;
+    double x = pool->x[index];
+    double y = pool->y[index];
+    int type = pool->type[index];
     int solid = 0;
 
-    double dist = (weapon->speed / 10.0) * (dt / 100.0);
-    double xtravel = weapon->xspeed / 10 * (dt / 100.0);
-    double ytravel = weapon->yspeed / 10 * (dt / 100.0);
+    // How far the weapon moves in the whole tick if it doesn't bounce.
+    double vx = pool->vx[index] * dt;
+    double vy = pool->vy[index] * dt;
     
-    int tile_x = 0;
-    int tile_y = 0;
-    int last_tile_x = floor(x / 16.0);
-    int last_tile_y = floor(y / 16.0);
+    // Kept apart from the position, which is on the edge of the tile after a bounce.
+    int tile_x = floor(x / 16.0);
+    int tile_y = floor(y / 16.0);
     
-    int ticks = current_ticks();
+    // The part of the tick that's left to move through.
+    double remaining = 1;
     
     pthread_mutex_lock(&ad->mutex);
     
-    if (weapon->type == W_BULLET || weapon->type == W_BOUNCEBULLET || weapon->type == W_BURST) {
-        if (ticks - weapon->created >= ad->config.bullet_alive_time) {
-            // weapon time out
-            FlagWeaponForDestroy(arena, weapon);
-            pthread_mutex_unlock(&ad->mutex);
-            return 0;
+    // Every player that the weapon can hit this tick is near the part of its path that it covers.
+    double reach = ad->config.max_radius + 3;
+    
+    if (type == W_PROXBOMB)
+        reach += (ad->config.proximity_distance + pool->info[index].level) * 16;
+    
+    int candidates = FindPlayers(&ad->players, x, y, fabs(vx) + fabs(vy) + reach + 1);
+    
+    while (remaining > 0) {
+        int step_x = vx > 0 ? 1 : -1;
+        int step_y = vy > 0 ? 1 : -1;
+        
+        // When the path crosses the next tile boundary along each axis, and how long it takes to cross a whole tile.
+        double next_x = vx != 0 ? ((tile_x + (vx > 0)) * 16 - x) / vx : INFINITY;
+        double next_y = vy != 0 ? ((tile_y + (vy > 0)) * 16 - y) / vy : INFINITY;
+        double delta_x = vx != 0 ? 16 / fabs(vx) : INFINITY;
+        double delta_y = vy != 0 ? 16 / fabs(vy) : INFINITY;
+        
+        double end = remaining;
+        int vertical = 0;
+        
+        // Visit the tiles that the path crosses in order until one is solid.
+        while (next_x <= remaining || next_y <= remaining) {
+            double crossed;
+            
+            if (next_x < next_y) {
+                tile_x += step_x;
+                crossed = next_x;
+                next_x += delta_x;
+                vertical = 1;
+            } else {
+                tile_y += step_y;
+                crossed = next_y;
+                next_y += delta_y;
+                vertical = 0;
+            }
+            
+            if (IsSolid(arena, tile_x, tile_y)) {
+                solid = 1;
+                end = crossed > 0 ? crossed : 0;
+                break;
+            }
         }
-    } else if (weapon->type == W_BOMB || weapon->type == W_PROXBOMB) {
-        if (ticks - weapon->created >= ad->config.bomb_alive_time) {
-            // weapon time out
-            FlagWeaponForDestroy(arena, weapon);
+        
+        // Hit the player that the path reaches first before it gets to the wall.
+        IndexedPlayer *hit = NULL;
+        double hit_time = 0;
+        
+        for (int j = 0; j < candidates; ++j) {
+            IndexedPlayer *target = ad->players.found[j];
+            int hit_dist = GetHitDistance(target, index);
+            
+            if (hit_dist < 0) continue;
+            
+            double t = GetHitTime(target, hit_dist, x, y, vx, vy, end);
+            
+            if (t >= 0 && (!hit || t < hit_time)) {
+                hit = target;
+                hit_time = t;
+            }
+        }
+        
+        if (hit) {
+            pool->x[index] = x + vx * hit_time;
+            pool->y[index] = y + vy * hit_time;
+            
+            HitPlayer(hit, index);
+            
             pthread_mutex_unlock(&ad->mutex);
-            return 0;
+            return 1;
         }
-    }
- 
-    for (int i = 0; i < dist; ++i) {
-        x += cos(weapon->rotation) + xtravel / dist;
-        y -= sin(weapon->rotation) - ytravel / dist;
-        
-        tile_x = floor(x / 16.0);
-        tile_y = floor(y / 16.0);
-        
-        if (tile_x != last_tile_x && tile_y != last_tile_y) {            
-            solid = IsSolid(arena, tile_x, tile_y);
-
-            if (solid) {
-                if (weapon->type == W_BOMB || weapon->type == W_PROXBOMB) {
-                    if ((weapon->bouncing && weapon->bounces_left-- <= 0) || !weapon->bouncing) {
-                        DoBombDamage(arena, weapon);
-                        break;
-                    }
-                }
-                
-                // if bouncing then flip the rotation of the weapon when it collides with a tile
-                if (weapon->bouncing) {
-                    if (weapon->type == W_BURST && weapon->active == 0)
-                        weapon->active = 1;
-                    
-                    int dx = tile_x - last_tile_x;
-                    int dy = tile_y - last_tile_y;
-                    
-                    int below = (int)(floor(y)) % 16 < 3;
-                    int above = (int)(floor(y)) % 16 > 13;
-                    int right = (int)(floor(x)) % 16 < 3;
-                    int left = (int)(floor(x)) % 16 > 13;
-                    
-                    int horizontal = (below && dy > 0) || (above && dy < 0);
-                    int vertical = (right && dx > 0) || (left && dx < 0);
-                    
-                    double c = cos(weapon->rotation);
-                    double s = sin(weapon->rotation);
-                    
-                    if (horizontal) {
-                        s = -s;
-                        weapon->yspeed *= -1;
-                    }
-                        
-                    if (vertical) {
-                        c = -c;
-                        weapon->xspeed *= -1;
-                    }
-                    
-                    weapon->rotation = atan2(s, c);
-                    
-                    solid = 0;
-                } else {
-                    break;
-                }
+        
+        x += vx * end;
+        y += vy * end;
+        remaining -= end;
+        
+        pool->x[index] = x;
+        pool->y[index] = y;
+        
+        if (!solid) break;
+        
+        int bouncing = (pool->flags[index] & WEAPON_BOUNCING) != 0;
+        
+        if (type == W_BOMB || type == W_PROXBOMB) {
+            if ((bouncing && pool->info[index].bounces_left-- <= 0) || !bouncing) {
+                DoBombDamage(arena, index);
+                break;
             }
-
-            last_tile_x = tile_x;
-            last_tile_y = tile_y;
         }
         
-        Link *link;
-        Player *player;
-        
-        weapon->x = x;
-        weapon->y = y;
-        
-        pd->Lock();
-        FOR_EACH_PLAYER_IN_ARENA(player, arena) {
-            if (player->p_ship != SHIP_SPEC && 
-                player->p_freq != weapon->shooter->p_freq)
-            {
-                if (CheckWeaponHit(player, weapon)) {
-                    pd->Unlock();
-                    pthread_mutex_unlock(&ad->mutex);
-                    return 1;
-                }
-            }
+        if (!bouncing) break;
+        
+        if (type == W_BURST)
+            pool->flags[index] |= WEAPON_ACTIVE;
+        
+        // Flip the weapon off of the side of the tile that it crossed and go back to the open tile.
+        double c = cos(pool->rotation[index]);
+        double s = sin(pool->rotation[index]);
+        
+        if (vertical) {
+            tile_x -= step_x;
+            vx = -vx;
+            c = -c;
+            pool->xspeed[index] *= -1;
+            pool->vx[index] *= -1;
+        } else {
+            tile_y -= step_y;
+            vy = -vy;
+            s = -s;
+            pool->yspeed[index] *= -1;
+            pool->vy[index] *= -1;
         }
-        pd->Unlock();
+        
+        pool->rotation[index] = atan2(s, c);
+        
+        solid = 0;
     }
     
-    weapon->x = x;
-    weapon->y = y;
-    
     pthread_mutex_unlock(&ad->mutex);
     
     return solid;
 }
 
 
-/** Pushes any ai players inside the repel radius.
- * @param weapon The repel weapon that is being updated.
- * @param dt The timestep.
- * @return Returns 1 if the repel has timed out, 0 otherwise.
- */
-local int UpdateRepel(EnemyWeapon *weapon, int dt) {
-    WeaponsArenaData *ad = P_ARENA_DATA(weapon->arena, adkey);
-
-    int ticks = current_ticks();
-    
-    pthread_mutex_lock(&ad->mutex);
-    if (ticks - weapon->created >= UPDATE_FREQUENCY + ad->config.repel_time) {
-        pthread_mutex_unlock(&ad->mutex);
-        return 1;   // It will be marked as destroyed in the calling function
-    }
-    
-    pthread_mutex_unlock(&ad->mutex);
-    return 0;
-}
-
+/** The WeaponMoveFunc for this CPU. Picked when the module loads. */
+local WeaponMoveFunc move_weapons = weapon_move_scalar;
 
 /** Update weapons by a single tick.
  * @param arena The arena to update.
  */
 local void DoTick(Arena *arena) {
     WeaponsArenaData *ad = P_ARENA_DATA(arena, adkey);
+    WeaponPool *pool = &ad->pool;
     
-    Link *link;
-    
-    EnemyWeapon *weapon;
+    int ticks = current_ticks();
     
     pthread_mutex_lock(&ad->mutex);
     
-    // Update each weapon 1 tick
-    FOR_EACH(&ad->weapons, weapon, link) {
-        // update weapon position
-        if (InSafe(arena, weapon->shooter->position.x / 16, weapon->shooter->position.y / 16)) {
-            // weapon owner in safe
-            FlagWeaponForDestroy(arena, weapon);
+    BuildPlayerIndex(arena, ticks);
+    
+    // Update each weapon 1 tick. Weapons that are created during the tick start moving next tick.
+    int count = pool->count;
+    
+    // weapon owner in safe
+    if (ad->players.safe_count > 0) {
+        for (int i = 0; i < count; ++i) {
+            WeaponsPlayerData *data = PPDATA(pool->info[i].shooter, pdkey);
+            
+            if (data->safe_tick == ticks)
+                FlagWeaponForDestroy(arena, i);
+        }
+    }
+    
+    // Most weapons only need to move. The rest are checked and traced in order.
+    WeaponMotion motion = {
+        .x = pool->x, .y = pool->y, .vx = pool->vx, .vy = pool->vy,
+        .expires = pool->expires, .type = pool->type, .flags = pool->flags, .prox_type = W_PROXBOMB
+    };
+    int slow_count = move_weapons(&motion, 0, count, ticks, ad->players.danger, pool->slow);
+    
+    for (int k = 0; k < slow_count; ++k) {
+        int i = pool->slow[k];
+        
+        if (pool->flags[i] & WEAPON_DESTROY) continue;
+        
+        if (ticks - pool->expires[i] >= 0) {
+            // weapon time out
+            FlagWeaponForDestroy(arena, i);
             continue;
         }
 
-        if (weapon->update(weapon, 1)) {
-            FlagWeaponForDestroy(arena, weapon);
+        // Repels only wait to time out.
+        if (pool->type[i] != W_REPEL && TraceWeapon(arena, i, 1)) {
+            FlagWeaponForDestroy(arena, i);
             continue;
         }
     }
     
-    // Remove weapons that are flagged to be destroyed
-    FOR_EACH(&ad->weapons_destroy, weapon, link)
-        DestroyWeapon(&ad->weapons, weapon);
-    LLEmpty(&ad->weapons_destroy);
+    // Remove weapons that are flagged to be destroyed. Going backward means the
+    // weapon that's moved into each removed one has already been checked.
+    for (int i = pool->count - 1; i >= 0; --i) {
+        if (pool->flags[i] & WEAPON_DESTROY)
+            DestroyWeapon(pool, i);
+    }
     
     pthread_mutex_unlock(&ad->mutex);
 }
@@ -517,29 +1114,29 @@ local void OnPPK(Player *p, const struct C2SPosition *pos) {
     
     Arena *arena = p->arena;
     WeaponsArenaData *ad = P_ARENA_DATA(arena, adkey);
+    WeaponPool *pool = &ad->pool;
+    int created = current_ticks();
     
     pthread_mutex_lock(&ad->mutex);
     
     if (pos->weapon.type == W_REPEL) {
-        EnemyWeapon *weapon = amalloc(sizeof(EnemyWeapon));
-        weapon->x = pos->x;
-        weapon->y = pos->y;
-        
-        weapon->type = W_REPEL;
-        weapon->destroy = 0;
-        weapon->created = current_ticks();
-        weapon->arena = arena;
-        weapon->parent = NULL;
-        weapon->update = UpdateRepel;
-        weapon->shooter = p;
-        weapon->active = 1;
-        weapon->level = 0;
-        
-        LLAdd(&ad->weapons, weapon);
+        int index = CreateWeapon(pool);
+        EnemyWeapon weapon;
+        
+        pool->x[index] = pos->x;
+        pool->y[index] = pos->y;
+        
+        pool->type[index] = W_REPEL;
+        pool->flags[index] = WEAPON_ACTIVE;
+        pool->expires[index] = created + GetLifetime(ad, W_REPEL);
+        pool->info[index].created = created;
+        pool->info[index].shooter = p;
+        
+        GetWeaponData(arena, index, &weapon);
         
         pthread_mutex_unlock(&ad->mutex);
         
-        DO_CBS(CB_WEAPONCREATED, arena, WeaponCreatedFunc, (weapon));
+        DO_CBS(CB_WEAPONCREATED, arena, WeaponCreatedFunc, (&weapon));
         return;
     } else if (pos->weapon.type == W_BURST) {
         int amount = ad->config.burst_shrapnel[p->p_ship];
@@ -547,135 +1144,145 @@ local void OnPPK(Player *p, const struct C2SPosition *pos) {
         double rotation = 0.0;
         double rot_inc = (2.0 * M_PI) / amount;
         for (int i = 0; i < amount; ++i) {
-            EnemyWeapon *weapon = amalloc(sizeof(EnemyWeapon));
-            weapon->x = pos->x;
-            weapon->y = pos->y;
-            
-            weapon->type = W_BURST;
-            weapon->destroy = 0;
-            weapon->created = current_ticks();
-            weapon->arena = arena;
-            weapon->parent = NULL;
-            weapon->update = TraceWeapon;
-            weapon->shooter = p;
-            weapon->active = 0;
-            weapon->max_damage = ad->config.burst_damage_level;
-            weapon->rotation = rotation;
-            weapon->bouncing = 1;
-            weapon->xspeed = 0;
-            weapon->yspeed = 0;
-            weapon->level = 0;
-            weapon->speed = ad->config.burst_speed[p->p_ship];
-            
-            LLAdd(&ad->weapons, weapon);
+            int index = CreateWeapon(pool);
+            
+            pool->x[index] = pos->x;
+            pool->y[index] = pos->y;
+            
+            pool->type[index] = W_BURST;
+            pool->flags[index] = WEAPON_BOUNCING;
+            pool->expires[index] = created + GetLifetime(ad, W_BURST);
+            pool->rotation[index] = rotation;
+            pool->speed[index] = ad->config.burst_speed[p->p_ship];
+            SetVelocity(pool, index);
+            pool->info[index].created = created;
+            pool->info[index].shooter = p;
+            pool->info[index].max_damage = ad->config.burst_damage_level;
             
             rotation += rot_inc;
             
-            DO_CBS(CB_WEAPONCREATED, arena, WeaponCreatedFunc, (weapon));
+            WeaponCreated(arena, index);
         }
         
         pthread_mutex_unlock(&ad->mutex);
         return;
     }
           
-    EnemyWeapon *weapon = amalloc(sizeof(EnemyWeapon));
-    
-    weapon->rotation = ((40 - (pos->rotation + 30) % 40) * 9) * (M_PI / 180);
+    int index = CreateWeapon(pool);
+    int type = pos->weapon.type;
+    double rotation = ((40 - (pos->rotation + 30) % 40) * 9) * (M_PI / 180);
     
     int radius = ad->config.radius[p->p_ship];
     
+    pool->rotation[index] = rotation;
+    pool->xspeed[index] = p->position.xspeed;
+    pool->yspeed[index] = p->position.yspeed;
+    pool->type[index] = type;
+    pool->info[index].level = pos->weapon.level;
     
-    weapon->xspeed = p->position.xspeed;
-    weapon->yspeed = p->position.yspeed;
-    weapon->type = pos->weapon.type;
-    weapon->destroy = 0;
-    weapon->level = pos->weapon.level;
-    
-    weapon->speed = ad->config.bullet_speed[p->p_ship];
+    pool->speed[index] = ad->config.bullet_speed[p->p_ship];
     
-    if (weapon->type == W_BOMB || weapon->type == W_PROXBOMB) {
-        weapon->bounces_left = ad->config.bounce_count[p->p_ship];
-        weapon->max_damage = ad->config.bomb_damage_level;
-        weapon->bouncing = weapon->bounces_left > 0;
+    if (type == W_BOMB || type == W_PROXBOMB) {
+        pool->info[index].bounces_left = ad->config.bounce_count[p->p_ship];
+        pool->info[index].max_damage = ad->config.bomb_damage_level;
+        if (pool->info[index].bounces_left > 0)
+            pool->flags[index] |= WEAPON_BOUNCING;
         
-        weapon->speed = ad->config.bomb_speed[p->p_ship];
-        weapon->x = pos->x + radius * cos(weapon->rotation);
-        weapon->y = pos->y - radius * sin(weapon->rotation);;
+        pool->speed[index] = ad->config.bomb_speed[p->p_ship];
+        pool->x[index] = pos->x + radius * cos(rotation);
+        pool->y[index] = pos->y - radius * sin(rotation);
     }
     
-    if (weapon->type == W_BULLET || weapon->type == W_BOUNCEBULLET) {
+    if (type == W_BULLET || type == W_BOUNCEBULLET) {
         int level = pos->weapon.level;
-        weapon->max_damage = ad->config.bullet_damage_level + ad->config.bullet_damage_upgrade * level;
+        int max_damage = ad->config.bullet_damage_level + ad->config.bullet_damage_upgrade * level;
         
         if (ad->config.bullet_exact_damage == 0)
-            weapon->max_damage = prng->Number(1, weapon->max_damage);
-        weapon->x = pos->x + radius * cos(weapon->rotation);
-        weapon->y = pos->y - radius * sin(weapon->rotation);
-        weapon->bouncing = pos->weapon.type == W_BOUNCEBULLET;
+            max_damage = prng->Number(1, max_damage);
+        pool->info[index].max_damage = max_damage;
+        pool->x[index] = pos->x + radius * cos(rotation);
+        pool->y[index] = pos->y - radius * sin(rotation);
+        if (type == W_BOUNCEBULLET)
+            pool->flags[index] |= WEAPON_BOUNCING;
     }
     
-    weapon->created = current_ticks();
-    weapon->arena = arena;
-    weapon->parent = NULL;
-    weapon->update = TraceWeapon;
-    weapon->shooter = p;
-    weapon->active = 1;
+    pool->flags[index] |= WEAPON_ACTIVE;
+    pool->expires[index] = created + GetLifetime(ad, type);
+    pool->info[index].created = created;
+    pool->info[index].shooter = p;
+    SetVelocity(pool, index);
     
-    LLAdd(&ad->weapons, weapon);
-    
-    if (weapon->type == W_BULLET || weapon->type == W_BOUNCEBULLET) {
+    if (type == W_BULLET || type == W_BOUNCEBULLET) {
         if (ad->config.double_barrel[p->p_ship]) {
             int offset = radius * 0.7;
             
-            int xoffset = offset * sin(weapon->rotation);
-            int yoffset = offset * cos(weapon->rotation);
-            
-            EnemyWeapon *other = amalloc(sizeof(EnemyWeapon));
-            *other = *weapon;
+            int xoffset = offset * sin(rotation);
+            int yoffset = offset * cos(rotation);
             
-            weapon->x += xoffset;
-            weapon->y += yoffset;
+            int other = CreateWeapon(pool);
+            CopyWeapon(pool, other, index);
             
-            other->x -= xoffset;
-            other->y -= yoffset;
+            pool->x[index] += xoffset;
+            pool->y[index] += yoffset;
             
-            other->parent = weapon;
+            pool->x[other] -= xoffset;
+            pool->y[other] -= yoffset;
             
-            LLAdd(&ad->weapons, other);
+            JoinFamily(pool, index, other);
         }
         
         if (pos->weapon.alternate == 1) {
             // multifire
             double angle = (ad->config.multifire_angle[p->p_ship] / 111.0) * (M_PI / 180);
             
-            EnemyWeapon *first = amalloc(sizeof(EnemyWeapon));
-            *first = *weapon;
+            int first = CreateWeapon(pool);
+            CopyWeapon(pool, first, index);
             
-            EnemyWeapon *second = amalloc(sizeof(EnemyWeapon));
-            *second = *weapon;
+            int second = CreateWeapon(pool);
+            CopyWeapon(pool, second, index);
             
-            first->rotation = weapon->rotation + angle;
-            second->rotation = weapon->rotation - angle;
+            pool->rotation[first] = rotation + angle;
+            pool->rotation[second] = rotation - angle;
+            SetVelocity(pool, first);
+            SetVelocity(pool, second);
             
-            first->x = pos->x + radius * cos(first->rotation);
-            first->y = pos->y - radius * sin(first->rotation);
+            pool->x[first] = pos->x + radius * cos(pool->rotation[first]);
+            pool->y[first] = pos->y - radius * sin(pool->rotation[first]);
             
-            second->x = pos->x + radius * cos(second->rotation);
-            second->y = pos->y - radius * sin(second->rotation);
+            pool->x[second] = pos->x + radius * cos(pool->rotation[second]);
+            pool->y[second] = pos->y - radius * sin(pool->rotation[second]);
             
-            first->parent = weapon;
-            second->parent = weapon;
+            JoinFamily(pool, index, first);
+            JoinFamily(pool, index, second);
             
-            LLAdd(&ad->weapons, first);
-            LLAdd(&ad->weapons, second);
-            
-            DO_CBS(CB_WEAPONCREATED, arena, WeaponCreatedFunc, (first));
-            DO_CBS(CB_WEAPONCREATED, arena, WeaponCreatedFunc, (second));
+            WeaponCreated(arena, first);
+            WeaponCreated(arena, second);
         }
     }
     
-    DO_CBS(CB_WEAPONCREATED, arena, WeaponCreatedFunc, (weapon));
+    WeaponCreated(arena, index);
+    pthread_mutex_unlock(&ad->mutex);
+}
+
+/** Copies the current data of a weapon.
+ * @param arena The arena of the weapon.
+ * @param handle The handle of the weapon.
+ * @param weapon Filled with the weapon's data if it still exists.
+ * @return 1 if the weapon still exists, 0 if it was destroyed.
+ */
+local int GetWeapon(Arena *arena, WeaponHandle handle, EnemyWeapon *weapon) {
+    WeaponsArenaData *ad = P_ARENA_DATA(arena, adkey);
+    
+    pthread_mutex_lock(&ad->mutex);
+    
+    int index = FindWeapon(&ad->pool, handle);
+    
+    if (index != -1)
+        GetWeaponData(arena, index, weapon);
+    
     pthread_mutex_unlock(&ad->mutex);
+    
+    return index != -1;
 }
 
 /** Arena action callback. Reload the configuration settings. */
@@ -696,6 +1303,8 @@ local void ReadConfig(Arena* arena) {
     
     for (int i = 0; i < 8; ++i) {
         ad->config.radius[i] = config->GetInt(arena->cfg, ShipNames[i], "Radius", 14);
+        if (i == 0 || ad->config.radius[i] > ad->config.max_radius)
+            ad->config.max_radius = ad->config.radius[i];
         ad->config.bullet_speed[i] = config->GetInt(arena->cfg, ShipNames[i], "BulletSpeed", 2000);
         ad->config.bomb_speed[i] = config->GetInt(arena->cfg, ShipNames[i], "BombSpeed", 2000);
         
@@ -765,6 +1374,12 @@ local void ReleaseInterfaces(Imodman* mm_) {
     mm = NULL;
 }
 
+local Iweapons myweapons =
+{
+    INTERFACE_HEAD_INIT(I_WEAPONS, "weapons")
+    GetWeapon
+};
+
 EXPORT const char info_weapons[] = "weapons v1.0 by monkey\n";
 EXPORT int MM_weapons(int action, Imodman *mm_, Arena* arena) {
     int rv = MM_FAIL;
@@ -783,11 +1398,25 @@ EXPORT int MM_weapons(int action, Imodman *mm_, Arena* arena) {
                 break;
             }
             
+            pdkey = pd->AllocatePlayerData(sizeof(WeaponsPlayerData));
+            if (pdkey == -1) {
+                aman->FreeArenaData(adkey);
+                ReleaseInterfaces(mm_);
+                break;
+            }
+            
+            mm->RegInterface(&myweapons, ALLARENAS);
+            
+            move_weapons = weapon_move_select();
+
             rv = MM_OK;
         }
         break;
         case MM_UNLOAD:
         {
+            if (mm->UnregInterface(&myweapons, ALLARENAS) > 0)
+                break;
+            pd->FreePlayerData(pdkey);
             aman->FreeArenaData(adkey);
             ReleaseInterfaces(mm_);
             rv = MM_OK;
@@ -809,8 +1438,12 @@ EXPORT int MM_weapons(int action, Imodman *mm_, Arena* arena) {
             
             ad->last_update = current_ticks();
 
-            LLInit(&ad->weapons);
-            LLInit(&ad->weapons_destroy);
+            memset(&ad->pool, 0, sizeof(WeaponPool));
+            ad->pool.free_slot = -1;
+            
+            memset(&ad->players, 0, sizeof(PlayerIndex));
+            ad->players.cell_start = amalloc(sizeof(int) * (PLAYER_CELLS * PLAYER_CELLS + 1));
+            ad->players.danger = amalloc(sizeof(int) * DANGER_CELLS * DANGER_CELLS);
             
             ml->SetTimer(UpdateTimer, UPDATE_FREQUENCY, UPDATE_FREQUENCY, arena, NULL);
 
@@ -829,14 +1462,13 @@ EXPORT int MM_weapons(int action, Imodman *mm_, Arena* arena) {
 
             ml->ClearTimer(UpdateTimer, NULL);
 
-            LLEmpty(&ad->weapons_destroy);
+            FreePool(&ad->pool);
             
-            EnemyWeapon* weapon= LLRemoveFirst(&ad->weapons);
-            while (weapon) {
-                afree(weapon);
-                weapon = LLRemoveFirst(&ad->weapons);
-            }
-            LLEmpty(&ad->weapons);
+            afree(ad->players.players);
+            afree(ad->players.unsorted);
+            afree(ad->players.found);
+            afree(ad->players.cell_start);
+            afree(ad->players.danger);
             
             pthread_mutexattr_destroy(&ad->pthread_attr);
             pthread_mutex_destroy(&ad->mutex);
@@ -3,13 +3,26 @@
 
 #include "asss.h"
 
-struct EnemyWeapon;           
-                       
-/** Function that is called to update a weapon */
-typedef int (*WeaponUpdate)(struct EnemyWeapon *, int);
+/** Identifies a weapon in its arena's weapon pool.
+ * Pool slots are reused once their weapon is destroyed, so a handle also holds the
+ * generation of its slot and stops matching anything when the weapon is gone.
+ */
+typedef struct WeaponHandle {
+    /** The slot of the weapon in the pool. */
+    int slot;
+    
+    /** The generation of the slot when the weapon was created. 0 for no weapon. */
+    unsigned int generation;
+} WeaponHandle;
 
-/** The data that's associated with each active weapon. */
+/** The data that's associated with each active weapon.
+ * Callbacks are passed a copy that's filled in from the pool when they're called,
+ * so it stays valid after the weapon is destroyed and its slot is reused.
+ */
 typedef struct EnemyWeapon {
+    /** The handle of this weapon. Use it to look the weapon up again later. */
+    WeaponHandle handle;
+    
     /** The arena that this weapon is active in. */
     Arena *arena;
 
@@ -49,17 +62,6 @@ typedef struct EnemyWeapon {
     /** The maximum amount of damage this weapon can cause. */
     int max_damage;
     
-    /** The parent weapon of this weapon. Used so only 1 bullet of the set hits. */
-    struct EnemyWeapon *parent;
-    
-    /** Marks the weapon to be destroyed next tick. */
-    int destroy;
-    
-    /** The update function to call every tick.
-     * The weapon is marked as destroy if it returns 1.
-     */
-    WeaponUpdate update;
-    
     /** The player that shot this weapon. */
     Player *shooter;
     
@@ -76,4 +78,19 @@ typedef void (*BombExplosionFunc)(EnemyWeapon *weapon);
 #define CB_WEAPONCREATED "weaponcreated"
 typedef void (*WeaponCreatedFunc)(EnemyWeapon *weapon);
 
+#define I_WEAPONS "weapons-1"
+
+/** Interface used to look up active weapons. */
+typedef struct Iweapons {
+    INTERFACE_HEAD_DECL
+    
+    /** Copies the current data of a weapon.
+     * @param arena The arena of the weapon.
+     * @param handle The handle of the weapon.
+     * @param weapon Filled with the weapon's data if it still exists.
+     * @return 1 if the weapon still exists, 0 if it was destroyed.
+     */
+    int (*GetWeapon)(Arena *arena, WeaponHandle handle, EnemyWeapon *weapon);
+} Iweapons;
+
 #endif
@@ -90,17 +90,18 @@ EXPORT int MM_zombies(int action, Imodman *mm_, Arena* arena) {
             
             mm->RegCallback(CB_BOMBEXPLOSION, OnBombExplosion, arena);
             
-            LinkedList *pathlist = path->FindPath(arena, 512, 512, 545, 535);
-            Node *p;
-            Link *link;
+            Path found;
             
-            FOR_EACH(pathlist, p, link) {
-                lm->Log(L_INFO, "Path: %d, %d", p->x, p->y);
+            path_init(&found);
+            path->FindPath(arena, 512, 512, 545, 535, GRID_OPEN_CLEARANCE, &found);
+            
+            for (int i = 0; i < found.count; ++i) {
+                lm->Log(L_INFO, "Path: %d, %d", found.points[i].x, found.points[i].y);
             }
             
-            lm->Log(L_INFO, "Path size: %d", LLCount(pathlist));
+            lm->Log(L_INFO, "Path size: %d", found.count);
 
-            LLFree(pathlist);
+            path_free(&found);
             rv = MM_OK;
         }
         break;
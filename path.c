@@ -0,0 +1,42 @@
+#include "path.h"
+#include <stdlib.h>
+#include <string.h>
+
+void path_init(Path *path) {
+    path->points = NULL;
+    path->count = path->capacity = path->next = 0;
+}
+
+void path_free(Path *path) {
+    free(path->points);
+    path_init(path);
+}
+
+void path_clear(Path *path) {
+    path->count = path->next = 0;
+}
+
+PathPoint *path_resize(Path *path, int count) {
+    if (count > path->capacity) {
+        // Grow by at least double so paths that get a little longer each time don't reallocate often.
+        int capacity = path->capacity ? path->capacity * 2 : 32;
+        
+        while (capacity < count)
+            capacity *= 2;
+        
+        path->points = realloc(path->points, sizeof(PathPoint) * capacity);
+        path->capacity = capacity;
+    }
+    
+    path->count = count;
+    path->next = 0;
+    
+    return path->points;
+}
+
+void path_copy(Path *path, const PathPoint *points, int count) {
+    if (count > 0)
+        memcpy(path_resize(path, count), points, sizeof(PathPoint) * count);
+    else
+        path_clear(path);
+}
@@ -0,0 +1,90 @@
+#ifndef PATH_H_
+#define PATH_H_
+
+#include "grid.h"
+#include <stddef.h>
+
+/** A tile on a path. */
+typedef struct PathPoint {
+    /** The x tile. */
+    short x;
+    
+    /** The y tile. */
+    short y;
+} PathPoint;
+
+/** A path owned by the caller.
+ * The points are stored in one array that is kept between searches, so a path
+ * can be filled again and again without allocating once it's big enough.
+ * The points are copies, so they don't depend on the grid or a search context.
+ */
+typedef struct Path {
+    /** The points of the path, from the start to the goal. */
+    PathPoint *points;
+    
+    /** The number of points in the path. 0 if no path was found. */
+    int count;
+    
+    /** The number of points allocated. */
+    int capacity;
+    
+    /** The index of the next point to follow. Points before it have been popped. */
+    int next;
+} Path;
+
+/** Initializes an empty path.
+ * @param path The path
+ */
+void path_init(Path *path);
+
+/** Frees the points of a path. The path is empty afterwards.
+ * @param path The path
+ */
+void path_free(Path *path);
+
+/** Removes every point but keeps the memory.
+ * @param path The path
+ */
+void path_clear(Path *path);
+
+/** Sets the number of points and starts following from the first one.
+ * The points are left for the caller to fill in.
+ * @param path The path
+ * @param count The number of points
+ * @return the points of the path.
+ */
+PathPoint *path_resize(Path *path, int count);
+
+/** Replaces the points of a path with a copy of other points.
+ * @param path The path
+ * @param points The points to copy
+ * @param count The number of points
+ */
+void path_copy(Path *path, const PathPoint *points, int count);
+
+/** Returns the number of points that haven't been popped.
+ * @param path The path
+ * @return the number of points left to follow.
+ */
+static inline int path_remaining(const Path *path) {
+    return path->count - path->next;
+}
+
+/** Returns the next point to follow.
+ * @param path The path
+ * @return the next point, or NULL if every point has been popped.
+ */
+static inline PathPoint *path_peek(Path *path) {
+    return path->next < path->count ? &path->points[path->next] : NULL;
+}
+
+/** Moves on to the point after the next one.
+ * @param path The path
+ * @return the new next point, or NULL if every point has been popped.
+ */
+static inline PathPoint *path_pop(Path *path) {
+    if (path->next < path->count) ++path->next;
+    return path_peek(path);
+}
+
+#endif
@@ -12,6 +12,15 @@ PQueue pq_new(PQComparator comp, int size) {
     return q;
 }
 
+void pq_free(PQueue q) {
+    free(q->elements);
+    free(q);
+}
+
+void pq_clear(PQueue q) {
+    q->num = 1;
+}
+
 void pq_push(PQueue q, const void *data) {
     PQElement *b;
     int n, m;
@@ -61,3 +70,307 @@ void* pq_pop(PQueue q) {
 int pq_empty(PQueue q) {
     return q->num <= 1;
 }
+
+// Moves an item toward the top of the heap until its parent has a lower key.
+static void ipq_sift_up(IndexedPriorityQueue *q, int n, IndexedPQEntry entry) {
+    IndexedPQEntry *b = q->entries;
+    
+    while (n > 0) {
+        int m = (n - 1) / 4;
+        if (b[m].key <= entry.key) break;
+        b[n] = b[m];
+        q->positions[b[n].index] = n;
+        n = m;
+    }
+    
+    b[n] = entry;
+    q->positions[entry.index] = n;
+}
+
+void ipq_init(IndexedPriorityQueue *q, int index_count, int size) {
+    int i;
+    
+    q->entries = malloc(sizeof(IndexedPQEntry) * size);
+    q->size = size;
+    q->num = 0;
+    q->positions = malloc(sizeof(int) * index_count);
+    q->index_count = index_count;
+    
+    for (i = 0; i < index_count; ++i)
+        q->positions[i] = -1;
+}
+
+void ipq_free(IndexedPriorityQueue *q) {
+    free(q->entries);
+    free(q->positions);
+    q->entries = NULL;
+    q->positions = NULL;
+}
+
+void ipq_clear(IndexedPriorityQueue *q) {
+    int i;
+    
+    for (i = 0; i < q->num; ++i)
+        q->positions[q->entries[i].index] = -1;
+    
+    q->num = 0;
+}
+
+void ipq_push(IndexedPriorityQueue *q, int64_t key, int index) {
+    IndexedPQEntry entry;
+    int n = q->positions[index];
+    
+    if (n != -1) {
+        // Decrease key
+        if (key >= q->entries[n].key) return;
+    } else {
+        if (q->num >= q->size) {
+            q->size *= 2;
+            q->entries = realloc(q->entries, sizeof(IndexedPQEntry) * q->size);
+        }
+        
+        n = q->num++;
+    }
+    
+    entry.key = key;
+    entry.index = index;
+    ipq_sift_up(q, n, entry);
+}
+
+// Moves an item toward the bottom of the heap until its children have higher keys.
+static void ipq_sift_down(IndexedPriorityQueue *q, int n, IndexedPQEntry entry) {
+    IndexedPQEntry *b = q->entries;
+    
+    while (1) {
+        int first = n * 4 + 1;
+        int end = first + 4 < q->num ? first + 4 : q->num;
+        int m = first, i;
+        
+        if (first >= q->num) break;
+        
+        for (i = first + 1; i < end; ++i) {
+            if (b[i].key < b[m].key) m = i;
+        }
+        
+        if (entry.key <= b[m].key) break;
+        
+        b[n] = b[m];
+        q->positions[b[n].index] = n;
+        n = m;
+    }
+    
+    b[n] = entry;
+    q->positions[entry.index] = n;
+}
+
+int ipq_pop(IndexedPriorityQueue *q) {
+    int out;
+    
+    if (q->num == 0) return -1;
+    
+    out = q->entries[0].index;
+    ipq_remove(q, out);
+    
+    return out;
+}
+
+void ipq_remove(IndexedPriorityQueue *q, int index) {
+    IndexedPQEntry last;
+    int n = q->positions[index];
+    
+    if (n == -1) return;
+    
+    q->positions[index] = -1;
+    last = q->entries[--q->num];
+    
+    if (n == q->num) return;
+    
+    // The last item fills the hole. It can belong above or below it.
+    if (n > 0 && q->entries[(n - 1) / 4].key > last.key)
+        ipq_sift_up(q, n, last);
+    else
+        ipq_sift_down(q, n, last);
+}
+
+void ipq_reserve(IndexedPriorityQueue *q, int index_count) {
+    int i;
+    
+    if (index_count <= q->index_count) return;
+    
+    q->positions = realloc(q->positions, sizeof(int) * index_count);
+    
+    for (i = q->index_count; i < index_count; ++i)
+        q->positions[i] = -1;
+    
+    q->index_count = index_count;
+}
+
+// The number of buckets covered by each word of the used bitmap.
+#define BPQ_WORD_BITS 64
+
+// Returns the position of the lowest set bit. The bits must not be 0.
+static inline int lowest_bit(uint64_t bits) {
+#ifdef __GNUC__
+    return __builtin_ctzll(bits);
+#else
+    int bit = 0;
+    
+    while (!(bits & 1)) {
+        bits >>= 1;
+        ++bit;
+    }
+    
+    return bit;
+#endif
+}
+
+void bpq_init(BucketPriorityQueue *q, int index_count, int bucket_count) {
+    int i;
+    
+    // Whole words of buckets keep the bitmap simple.
+    if (bucket_count < BPQ_WORD_BITS) bucket_count = BPQ_WORD_BITS;
+    bucket_count = (bucket_count + BPQ_WORD_BITS - 1) / BPQ_WORD_BITS * BPQ_WORD_BITS;
+    
+    q->heads = malloc(sizeof(int) * bucket_count);
+    q->used = calloc(bucket_count / BPQ_WORD_BITS, sizeof(uint64_t));
+    q->bucket_count = bucket_count;
+    q->next = malloc(sizeof(int) * index_count);
+    q->prev = malloc(sizeof(int) * index_count);
+    q->keys = malloc(sizeof(int) * index_count);
+    q->index_count = index_count;
+    q->cursor = 0;
+    q->max_key = -1;
+    q->num = 0;
+    
+    for (i = 0; i < bucket_count; ++i)
+        q->heads[i] = -1;
+    
+    for (i = 0; i < index_count; ++i)
+        q->keys[i] = -1;
+}
+
+void bpq_free(BucketPriorityQueue *q) {
+    free(q->heads);
+    free(q->used);
+    free(q->next);
+    free(q->prev);
+    free(q->keys);
+    q->heads = q->next = q->prev = q->keys = NULL;
+    q->used = NULL;
+}
+
+void bpq_clear(BucketPriorityQueue *q) {
+    int key, index;
+    
+    // The buckets below the cursor are already empty.
+    for (key = q->cursor; key <= q->max_key; ++key) {
+        for (index = q->heads[key]; index != -1; index = q->next[index])
+            q->keys[index] = -1;
+        
+        q->heads[key] = -1;
+    }
+    
+    if (q->max_key >= 0) {
+        for (key = q->cursor / BPQ_WORD_BITS; key <= q->max_key / BPQ_WORD_BITS; ++key)
+            q->used[key] = 0;
+    }
+    
+    q->cursor = 0;
+    q->max_key = -1;
+    q->num = 0;
+}
+
+// Unlinks an item from its bucket.
+static void bpq_remove(BucketPriorityQueue *q, int index) {
+    int key = q->keys[index];
+    
+    if (q->prev[index] != -1)
+        q->next[q->prev[index]] = q->next[index];
+    else
+        q->heads[key] = q->next[index];
+    
+    if (q->next[index] != -1)
+        q->prev[q->next[index]] = q->prev[index];
+    
+    if (q->heads[key] == -1)
+        q->used[key / BPQ_WORD_BITS] &= ~((uint64_t)1 << (key % BPQ_WORD_BITS));
+    
+    q->keys[index] = -1;
+    --q->num;
+}
+
+void bpq_push(BucketPriorityQueue *q, int key, int index) {
+    if (q->keys[index] != -1) {
+        // Decrease key
+        if (key >= q->keys[index]) return;
+        bpq_remove(q, index);
+    }
+    
+    if (key >= q->bucket_count) {
+        int count = q->bucket_count;
+        int i;
+        
+        while (key >= count)
+            count *= 2;
+        
+        q->heads = realloc(q->heads, sizeof(int) * count);
+        q->used = realloc(q->used, sizeof(uint64_t) * (count / BPQ_WORD_BITS));
+        
+        for (i = q->bucket_count; i < count; ++i)
+            q->heads[i] = -1;
+        
+        for (i = q->bucket_count / BPQ_WORD_BITS; i < count / BPQ_WORD_BITS; ++i)
+            q->used[i] = 0;
+        
+        q->bucket_count = count;
+    }
+    
+    q->keys[index] = key;
+    q->prev[index] = -1;
+    q->next[index] = q->heads[key];
+    
+    if (q->heads[key] != -1)
+        q->prev[q->heads[key]] = index;
+    
+    q->heads[key] = index;
+    q->used[key / BPQ_WORD_BITS] |= (uint64_t)1 << (key % BPQ_WORD_BITS);
+    ++q->num;
+    
+    if (key < q->cursor || q->num == 1) q->cursor = key;
+    if (key > q->max_key) q->max_key = key;
+}
+
+int bpq_pop(BucketPriorityQueue *q) {
+    int word, index;
+    uint64_t bits;
+    
+    if (q->num == 0) return -1;
+    
+    // Skip a whole word of empty buckets at a time.
+    word = q->cursor / BPQ_WORD_BITS;
+    bits = q->used[word] & (~(uint64_t)0 << (q->cursor % BPQ_WORD_BITS));
+    
+    while (bits == 0)
+        bits = q->used[++word];
+    
+    q->cursor = word * BPQ_WORD_BITS + lowest_bit(bits);
+    index = q->heads[q->cursor];
+    bpq_remove(q, index);
+    
+    return index;
+}
+
+void bpq_reserve(BucketPriorityQueue *q, int index_count) {
+    int i;
+    
+    if (index_count <= q->index_count) return;
+    
+    q->next = realloc(q->next, sizeof(int) * index_count);
+    q->prev = realloc(q->prev, sizeof(int) * index_count);
+    q->keys = realloc(q->keys, sizeof(int) * index_count);
+    
+    for (i = q->index_count; i < index_count; ++i)
+        q->keys[i] = -1;
+    
+    q->index_count = index_count;
+}
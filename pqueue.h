@@ -1,6 +1,8 @@
 #ifndef PQUEUE_H_
 #define PQUEUE_H_
 
+#include <stdint.h>
+
 typedef int(*PQComparator)(const void *, const void *);
 typedef void* PQElement;
 
@@ -25,6 +27,16 @@ typedef struct PriorityQueue {
  */
 PQueue pq_new(PQComparator comp, int size);
 
+/** Frees the queue and its element storage.
+ * @param q The queue
+ */
+void pq_free(PQueue q);
+
+/** Removes every item from the queue but keeps its storage.
+ * @param q The queue
+ */
+void pq_clear(PQueue q);
+
 /** Pushes a new item into the queue
  * @param q The queue
  * @param data The data to push
@@ -43,4 +55,181 @@ void* pq_pop(PQueue q);
  */
 int pq_empty(PQueue q);
 
+/** An item in an indexed priority queue. */
+typedef struct IndexedPQEntry {
+    /** The priority of the item. Lower keys come out first.
+     * 64 bits wide so a search can pack a tie breaker under its main key.
+     */
+    int64_t key;
+    
+    /** The index of the item. */
+    int index;
+} IndexedPQEntry;
+
+/** A 4-ary min heap of (key, index) pairs.
+ * Each index can be in the queue once. The position of every index is tracked,
+ * so the key of an item that's already in the queue can be lowered.
+ */
+typedef struct IndexedPriorityQueue {
+    /** The heap of items. */
+    IndexedPQEntry *entries;
+    
+    /** The number of items in the queue. */
+    int num;
+    
+    /** The number of items allocated. */
+    int size;
+    
+    /** The position of each index in the heap. -1 if the index isn't in the queue. (index_count) */
+    int *positions;
+    
+    /** The number of indices that can be stored. */
+    int index_count;
+} IndexedPriorityQueue;
+
+/** Initializes an indexed priority queue.
+ * @param q The queue
+ * @param index_count Indices in the queue must be less than this.
+ * @param size The initial size of the queue. It grows when needed.
+ */
+void ipq_init(IndexedPriorityQueue *q, int index_count, int size);
+
+/** Frees the storage of the queue.
+ * @param q The queue
+ */
+void ipq_free(IndexedPriorityQueue *q);
+
+/** Removes every item from the queue but keeps its storage.
+ * Only touches the items that are still in the queue.
+ * @param q The queue
+ */
+void ipq_clear(IndexedPriorityQueue *q);
+
+/** Pushes an item into the queue, or lowers its key if it's already in the queue.
+ * A key that's higher than the current key of the item is ignored.
+ * @param q The queue
+ * @param key The priority of the item
+ * @param index The index of the item
+ */
+void ipq_push(IndexedPriorityQueue *q, int64_t key, int index);
+
+/** Pops the item with the lowest key off the queue.
+ * @param q The queue
+ * @return the index of the item, or -1 if the queue is empty.
+ */
+int ipq_pop(IndexedPriorityQueue *q);
+
+/** Removes an item from the queue. Does nothing if the index isn't in the queue.
+ * @param q The queue
+ * @param index The index of the item
+ */
+void ipq_remove(IndexedPriorityQueue *q, int index);
+
+/** Makes room for more indices. Indices that are already in the queue keep their place.
+ * @param q The queue
+ * @param index_count Indices in the queue must be less than this.
+ */
+void ipq_reserve(IndexedPriorityQueue *q, int index_count);
+
+/** Returns whether or not an index is in the queue.
+ * @param q The queue
+ * @param index The index
+ * @return 1 if the index is in the queue, 0 otherwise.
+ */
+static inline int ipq_contains(const IndexedPriorityQueue *q, int index) {
+    return q->positions[index] != -1;
+}
+
+/** Returns whether or not the queue is empty.
+ * @param q The queue
+ * @return 1 if the queue is empty, 0 if it has items.
+ */
+static inline int ipq_empty(const IndexedPriorityQueue *q) {
+    return q->num == 0;
+}
+
+/** A priority queue of indices with small integer keys.
+ * Each key has a bucket holding a doubly linked list of its indices, so pushing,
+ * lowering a key and removing are O(1). Popping scans a bitmap of the buckets forward
+ * from the lowest key to the next bucket that isn't empty. Keys can be pushed in any order.
+ */
+typedef struct BucketPriorityQueue {
+    /** The first index in each bucket. -1 if the bucket is empty. (bucket_count) */
+    int *heads;
+    
+    /** One bit for each bucket that has items, so popping can skip empty buckets quickly. (bucket_count / 64) */
+    uint64_t *used;
+    
+    /** The number of buckets allocated. Grows to fit the highest key. */
+    int bucket_count;
+    
+    /** The next index in the same bucket. (index_count) */
+    int *next;
+    
+    /** The previous index in the same bucket. (index_count) */
+    int *prev;
+    
+    /** The key of each index. -1 if the index isn't in the queue. (index_count) */
+    int *keys;
+    
+    /** The number of indices that can be stored. */
+    int index_count;
+    
+    /** No bucket below this one has any items. */
+    int cursor;
+    
+    /** The highest key that has been pushed since the queue was cleared. */
+    int max_key;
+    
+    /** The number of items in the queue. */
+    int num;
+} BucketPriorityQueue;
+
+/** Initializes a bucket priority queue.
+ * @param q The queue
+ * @param index_count Indices in the queue must be less than this.
+ * @param bucket_count The initial number of buckets. It grows when needed.
+ */
+void bpq_init(BucketPriorityQueue *q, int index_count, int bucket_count);
+
+/** Frees the storage of the queue.
+ * @param q The queue
+ */
+void bpq_free(BucketPriorityQueue *q);
+
+/** Removes every item from the queue but keeps its storage.
+ * Only touches the buckets that were used.
+ * @param q The queue
+ */
+void bpq_clear(BucketPriorityQueue *q);
+
+/** Pushes an item into the queue, or lowers its key if it's already in the queue.
+ * A key that's higher than the current key of the item is ignored.
+ * @param q The queue
+ * @param key The priority of the item. Must not be negative.
+ * @param index The index of the item
+ */
+void bpq_push(BucketPriorityQueue *q, int key, int index);
+
+/** Pops an item with the lowest key off the queue.
+ * Items with the same key come out in last in, first out order.
+ * @param q The queue
+ * @return the index of the item, or -1 if the queue is empty.
+ */
+int bpq_pop(BucketPriorityQueue *q);
+
+/** Makes room for more indices. Indices that are already in the queue keep their place.
+ * @param q The queue
+ * @param index_count Indices in the queue must be less than this.
+ */
+void bpq_reserve(BucketPriorityQueue *q, int index_count);
+
+/** Returns whether or not the queue is empty.
+ * @param q The queue
+ * @return 1 if the queue is empty, 0 if it has items.
+ */
+static inline int bpq_empty(const BucketPriorityQueue *q) {
+    return q->num == 0;
+}
+
 #endif
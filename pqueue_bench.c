@@ -0,0 +1,191 @@
+/* Microbenchmark for the priority queues in pqueue.c.
+ * Runs the same search-like workload through the comparator heap, the indexed heap and the bucket queue.
+ * Not part of the module. Build it by hand:
+ *     gcc -O2 -o pqueue_bench pqueue_bench.c pqueue.c
+ */
+#include "pqueue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ITEM_COUNT (1024 * 1024)
+#define POPS 2000000
+#define PUSHES_PER_POP 4
+
+typedef struct {
+    int key;
+    int index;
+} Item;
+
+static int best_key[ITEM_COUNT];
+static int done[ITEM_COUNT];
+static unsigned int rng;
+
+static int rnd(int n) {
+    rng = rng * 1103515245 + 12345;
+    return (rng >> 8) % n;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int ItemComparator(const void *lhs, const void *rhs) {
+    return ((const Item *)lhs)->key < ((const Item *)rhs)->key;
+}
+
+// The comparator heap has no decrease-key, so better keys are pushed again and stale ones are skipped.
+static unsigned int bench_pqueue(int *pops_done) {
+    PQueue q = pq_new(ItemComparator, 30);
+    Item *items = malloc(sizeof(Item) * POPS * (PUSHES_PER_POP + 1));
+    int item_count = 0;
+    unsigned int sum = 0;
+    int pops = 0;
+    int i;
+    
+    rng = 1;
+    for (i = 0; i < ITEM_COUNT; ++i) {
+        best_key[i] = -1;
+        done[i] = 0;
+    }
+    
+    items[item_count].key = 0;
+    items[item_count].index = 0;
+    best_key[0] = 0;
+    pq_push(q, &items[item_count++]);
+    
+    while (!pq_empty(q) && pops < POPS) {
+        Item *item = pq_pop(q);
+        
+        if (done[item->index] || item->key != best_key[item->index]) continue;
+        done[item->index] = 1;
+        sum += item->key;
+        ++pops;
+        
+        for (i = 0; i < PUSHES_PER_POP; ++i) {
+            int index = rnd(ITEM_COUNT);
+            int key = item->key + 10 + rnd(5);
+            
+            if (done[index] || (best_key[index] != -1 && key >= best_key[index])) continue;
+            
+            best_key[index] = key;
+            items[item_count].key = key;
+            items[item_count].index = index;
+            pq_push(q, &items[item_count++]);
+        }
+    }
+    
+    pq_free(q);
+    free(items);
+    *pops_done = pops;
+    return sum;
+}
+
+static unsigned int bench_indexed(int *pops_done) {
+    IndexedPriorityQueue q;
+    unsigned int sum = 0;
+    int pops = 0;
+    int i;
+    
+    ipq_init(&q, ITEM_COUNT, 64);
+    
+    rng = 1;
+    for (i = 0; i < ITEM_COUNT; ++i) {
+        best_key[i] = -1;
+        done[i] = 0;
+    }
+    
+    best_key[0] = 0;
+    ipq_push(&q, 0, 0);
+    
+    while (!ipq_empty(&q) && pops < POPS) {
+        int index = ipq_pop(&q);
+        int current = best_key[index];
+        
+        done[index] = 1;
+        sum += current;
+        ++pops;
+        
+        for (i = 0; i < PUSHES_PER_POP; ++i) {
+            int next = rnd(ITEM_COUNT);
+            int key = current + 10 + rnd(5);
+            
+            if (done[next] || (best_key[next] != -1 && key >= best_key[next])) continue;
+            
+            best_key[next] = key;
+            ipq_push(&q, key, next);
+        }
+    }
+    
+    ipq_free(&q);
+    *pops_done = pops;
+    return sum;
+}
+
+static unsigned int bench_bucket(int *pops_done) {
+    BucketPriorityQueue q;
+    unsigned int sum = 0;
+    int pops = 0;
+    int i;
+    
+    bpq_init(&q, ITEM_COUNT, 4096);
+    
+    rng = 1;
+    for (i = 0; i < ITEM_COUNT; ++i) {
+        best_key[i] = -1;
+        done[i] = 0;
+    }
+    
+    best_key[0] = 0;
+    bpq_push(&q, 0, 0);
+    
+    while (!bpq_empty(&q) && pops < POPS) {
+        int index = bpq_pop(&q);
+        int current = best_key[index];
+        
+        done[index] = 1;
+        sum += current;
+        ++pops;
+        
+        for (i = 0; i < PUSHES_PER_POP; ++i) {
+            int next = rnd(ITEM_COUNT);
+            int key = current + 10 + rnd(5);
+            
+            if (done[next] || (best_key[next] != -1 && key >= best_key[next])) continue;
+            
+            best_key[next] = key;
+            bpq_push(&q, key, next);
+        }
+    }
+    
+    bpq_free(&q);
+    *pops_done = pops;
+    return sum;
+}
+
+int main(void) {
+    double start, pq_time, ipq_time, bpq_time;
+    unsigned int pq_sum, ipq_sum, bpq_sum;
+    int pq_pops, ipq_pops, bpq_pops;
+    
+    start = now();
+    pq_sum = bench_pqueue(&pq_pops);
+    pq_time = now() - start;
+    
+    start = now();
+    ipq_sum = bench_indexed(&ipq_pops);
+    ipq_time = now() - start;
+    
+    start = now();
+    bpq_sum = bench_bucket(&bpq_pops);
+    bpq_time = now() - start;
+    
+    printf("comparator heap: %d pops in %.3f s (checksum %u)\n", pq_pops, pq_time, pq_sum);
+    printf("indexed 4-ary heap: %d pops in %.3f s (checksum %u)\n", ipq_pops, ipq_time, ipq_sum);
+    printf("bucket queue: %d pops in %.3f s (checksum %u)\n", bpq_pops, bpq_time, bpq_sum);
+    printf("speedup: %.2fx indexed, %.2fx buckets\n", pq_time / ipq_time, pq_time / bpq_time);
+    
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "weapon_move.h"
+#include <math.h>
+#include <string.h>
+
+#ifdef WEAPON_MOVE_AVX2
+#include <immintrin.h>
+#endif
+
+int weapon_move_scalar(const WeaponMotion *motion, int start, int count, int ticks, const int *danger, int *slow) {
+    int slow_count = 0;
+    
+    for (int i = start; i < count; ++i) {
+        double x = motion->x[i];
+        double y = motion->y[i];
+        double next_x = x + motion->vx[i];
+        double next_y = y + motion->vy[i];
+        double tile_x = floor(next_x / 16.0);
+        double tile_y = floor(next_y / 16.0);
+        
+        int cell = weapon_danger_cell(y) * DANGER_CELLS + weapon_danger_cell(x);
+        int flag = motion->type[i] == motion->prox_type ? DANGER_PROX : DANGER_NEAR;
+        
+        if (floor(x / 16.0) == tile_x && tile_x < next_x / 16.0 && floor(y / 16.0) == tile_y && tile_y < next_y / 16.0 &&
+            ticks - motion->expires[i] < 0 && !(motion->flags[i] & WEAPON_DESTROY) && !(danger[cell] & flag)) {
+            motion->x[i] = next_x;
+            motion->y[i] = next_y;
+        } else {
+            slow[slow_count++] = i;
+        }
+    }
+    
+    return slow_count;
+}
+
+#ifdef WEAPON_MOVE_AVX2
+__attribute__((target("avx2")))
+int weapon_move_avx2(const WeaponMotion *motion, int start, int count, int ticks, const int *danger, int *slow) {
+    const __m256d tile_scale = _mm256_set1_pd(1 / 16.0);
+    const __m256d map_min = _mm256_setzero_pd();
+    const __m256d map_max = _mm256_set1_pd(DANGER_CELLS * DANGER_CELL_SIZE - 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i now = _mm_set1_epi32(ticks);
+    const __m128i cells = _mm_set1_epi32(DANGER_CELLS);
+    const __m128i prox = _mm_set1_epi32(motion->prox_type);
+    const __m128i destroy = _mm_set1_epi32(WEAPON_DESTROY);
+    const __m128i near_flag = _mm_set1_epi32(DANGER_NEAR);
+    const __m128i prox_flag = _mm_set1_epi32(DANGER_PROX);
+    int slow_count = 0;
+    int i = start;
+    
+    for (; i + 4 <= count; i += 4) {
+        __m256d x = _mm256_loadu_pd(motion->x + i);
+        __m256d y = _mm256_loadu_pd(motion->y + i);
+        __m256d next_x = _mm256_add_pd(x, _mm256_loadu_pd(motion->vx + i));
+        __m256d next_y = _mm256_add_pd(y, _mm256_loadu_pd(motion->vy + i));
+        
+        // Multiplying by 1/16 is exact, so the tiles match floor(x / 16.0).
+        __m256d next_tile_x = _mm256_mul_pd(next_x, tile_scale);
+        __m256d next_tile_y = _mm256_mul_pd(next_y, tile_scale);
+        __m256d tile_x = _mm256_floor_pd(next_tile_x);
+        __m256d tile_y = _mm256_floor_pd(next_tile_y);
+        __m256d inside_x = _mm256_and_pd(_mm256_cmp_pd(_mm256_floor_pd(_mm256_mul_pd(x, tile_scale)), tile_x, _CMP_EQ_OQ),
+            _mm256_cmp_pd(tile_x, next_tile_x, _CMP_LT_OQ));
+        __m256d inside_y = _mm256_and_pd(_mm256_cmp_pd(_mm256_floor_pd(_mm256_mul_pd(y, tile_scale)), tile_y, _CMP_EQ_OQ),
+            _mm256_cmp_pd(tile_y, next_tile_y, _CMP_LT_OQ));
+        
+        int types, flags;
+        memcpy(&types, motion->type + i, sizeof(int));
+        memcpy(&flags, motion->flags + i, sizeof(int));
+        
+        __m128i type = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(types));
+        __m128i flag = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(flags));
+        __m128i expires = _mm_loadu_si128((const __m128i *)(motion->expires + i));
+        
+        // Clamped to the map like weapon_danger_cell, and positive so the truncation and shift match it.
+        __m128i cell_x = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(x, map_min), map_max));
+        __m128i cell_y = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(y, map_min), map_max));
+        __m128i cell = _mm_add_epi32(_mm_mullo_epi32(_mm_srli_epi32(cell_y, DANGER_CELL_SHIFT), cells),
+            _mm_srli_epi32(cell_x, DANGER_CELL_SHIFT));
+        __m128i near = _mm_and_si128(_mm_i32gather_epi32(danger, cell, sizeof(int)),
+            _mm_blendv_epi8(near_flag, prox_flag, _mm_cmpeq_epi32(type, prox)));
+        
+        __m128i alive = _mm_and_si128(_mm_cmplt_epi32(_mm_sub_epi32(now, expires), zero),
+            _mm_cmpeq_epi32(_mm_and_si128(flag, destroy), zero));
+        __m128i safe = _mm_and_si128(alive, _mm_cmpeq_epi32(near, zero));
+        __m256i move = _mm256_and_si256(_mm256_cvtepi32_epi64(safe), _mm256_castpd_si256(_mm256_and_pd(inside_x, inside_y)));
+        
+        _mm256_maskstore_pd(motion->x + i, move, next_x);
+        _mm256_maskstore_pd(motion->y + i, move, next_y);
+        
+        int moved = _mm256_movemask_pd(_mm256_castsi256_pd(move));
+        
+        for (int k = 0; k < 4; ++k) {
+            if (!(moved & (1 << k)))
+                slow[slow_count++] = i + k;
+        }
+    }
+    
+    return slow_count + weapon_move_scalar(motion, i, count, ticks, danger, slow + slow_count);
+}
+#endif
+
+WeaponMoveFunc weapon_move_select(void) {
+#ifdef WEAPON_MOVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return weapon_move_avx2;
+#endif
+
+    return weapon_move_scalar;
+}
@@ -0,0 +1,102 @@
+#ifndef WEAPON_MOVE_H_
+#define WEAPON_MOVE_H_
+
+// The AVX2 kernel is built with a target attribute and only used if the CPU has AVX2.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WEAPON_MOVE_AVX2
+#endif
+
+/** The weapon can hit players. Burst bullets aren't active until they bounce. */
+#define WEAPON_ACTIVE 1
+
+/** The weapon bounces off of walls. */
+#define WEAPON_BOUNCING 2
+
+/** The weapon is destroyed at the end of the tick. */
+#define WEAPON_DESTROY 4
+
+/** The size of a danger cell in pixels, as a power of 2. */
+#define DANGER_CELL_SHIFT 7
+
+/** The size of a danger cell in pixels. */
+#define DANGER_CELL_SIZE (1 << DANGER_CELL_SHIFT)
+
+/** The number of danger cells along each side of the map. */
+#define DANGER_CELLS (1024 * 16 / DANGER_CELL_SIZE)
+
+/** A danger cell is near enough to a player for any weapon to hit them this tick. */
+#define DANGER_NEAR 1
+
+/** A danger cell is near enough to a player for a prox bomb to go off this tick. */
+#define DANGER_PROX 2
+
+/** The arrays of a weapon pool that moving weapons reads and writes.
+ * Each array has the weapons packed at the start, in the same order.
+ */
+typedef struct WeaponMotion {
+    /** The x position of each weapon in pixels. */
+    double *x;
+    
+    /** The y position of each weapon in pixels. */
+    double *y;
+    
+    /** How far each weapon moves in the x direction each tick. */
+    const double *vx;
+    
+    /** How far each weapon moves in the y direction each tick. */
+    const double *vy;
+    
+    /** The tick when each weapon times out. */
+    const int *expires;
+    
+    /** The type of each weapon. */
+    const unsigned char *type;
+    
+    /** The WEAPON_ flags of each weapon. */
+    const unsigned char *flags;
+    
+    /** The type of prox bombs, which check their danger cell for DANGER_PROX instead of DANGER_NEAR. */
+    int prox_type;
+} WeaponMotion;
+
+/** Moves the weapons that can't reach a wall or a player this tick and lists the rest.
+ * A weapon just moves if it stays inside its tile, hasn't expired, isn't flagged to be destroyed
+ * and isn't in a danger cell that it could hit a player from. Landing on the edge of a tile counts
+ * as leaving it, since the tile on the other side has to be checked.
+ * @param motion The weapons.
+ * @param start The index of the first weapon to move.
+ * @param count The index after the last weapon to move.
+ * @param ticks The current tick.
+ * @param danger The DANGER_ flags of each danger cell. (DANGER_CELLS * DANGER_CELLS)
+ * @param slow Filled with the indices of the weapons that didn't move, in order.
+ * @return the number of weapons put in slow.
+ */
+typedef int (*WeaponMoveFunc)(const WeaponMotion *motion, int start, int count, int ticks, const int *danger, int *slow);
+
+/** Returns the danger cell that a position is in.
+ * @param position The x or y position in pixels. Positions off of the map are put in the edge cells.
+ * @return the cell along that axis.
+ */
+static inline int weapon_danger_cell(double position) {
+    if (position < 0) return 0;
+    if (position >= DANGER_CELLS * DANGER_CELL_SIZE) return DANGER_CELLS - 1;
+    
+    return (int)position / DANGER_CELL_SIZE;
+}
+
+/** WeaponMoveFunc for any CPU, one weapon at a time. */
+int weapon_move_scalar(const WeaponMotion *motion, int start, int count, int ticks, const int *danger, int *slow);
+
+#ifdef WEAPON_MOVE_AVX2
+/** WeaponMoveFunc for CPUs with AVX2, 4 weapons at a time. Gives the same results as weapon_move_scalar.
+ * Only call it if the CPU has AVX2.
+ */
+int weapon_move_avx2(const WeaponMotion *motion, int start, int count, int ticks, const int *danger, int *slow);
+#endif
+
+/** Returns the fastest WeaponMoveFunc that this CPU can run.
+ * @return weapon_move_avx2 if the CPU has AVX2, weapon_move_scalar otherwise.
+ */
+WeaponMoveFunc weapon_move_select(void);
+
+#endif